@@ -2,19 +2,35 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdio.h>      /* rename() only: all output goes through write_all */
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <termios.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
 
 /* --------------------- Config --------------------- */
 #define MAX_LINE   256
 #define MAX_ARGS   64
 #define MAX_CMDS   8
 #define MAX_JOBS   64
+#define MAX_COPROCS 8
+#define GLOB_CACHE_DIRS 16          /* directory listings kept between prompts */
+#define GLOB_MAX_OPS    128         /* compiled pattern length, per path component */
+#define DENTS_BUF       (256*1024)  /* getdents64 buffer */
+#define PAR_MAX          64         /* par: most replicas of a stage */
+#define PAR_CHUNK        (1024*1024)/* and the default chunk of input each gets */
+#define PIPESTAT_MS      10         /* pipe statistics: sampling interval */
+#define PIPESTAT_LIVE_MS 1000       /* and how often MYSH_PIPESTATS=live reports */
 
 /* --------------------- Robust write helpers --------------------- */
 /* returns 0 on success, -1 on error */
@@ -55,12 +71,26 @@ typedef struct {
 } job_t;
 
 static job_t jobs[MAX_JOBS];
+
+/* a coprocess: a background job whose stdin and stdout stay connected to
+   the shell (rfd reads its output, wfd writes its input) */
+typedef struct {
+    int   used;
+    char  name[64];
+    pid_t pgid;
+    int   rfd, wfd;
+} coproc_t;
+static coproc_t coprocs[MAX_COPROCS];
+enum { CO_INPUT, CO_EXITED, CO_RELEASE };
 static pid_t shell_pgid = 0;
 static struct termios shell_tmodes;
+static int interactive = 0;     /* owns the terminal; a script run leaves it alone */
 
 /* --------------------- Prototypes --------------------- */
 static void install_shell(void);
 static void give_terminal_to(pid_t pgid);
+static int  fg_wait_flags(void);
+static void detach_stdin(void);
 static void ignore_job_signals_in_shell(void);
 static void reap_done_jobs(void);
 
@@ -69,11 +99,28 @@ static void skip_ws(char **p);
 static int  parse_argv(char *s, char **argv);
 static int  split_pipeline(char *line, char *stages[], int max);
 static void s_ncpy(char *dst, const char *src, size_t n);
+static size_t s_cat(char *dst, size_t n, const char *src);
 static int  read_line(char *buf, int maxlen);
 
+static uint64_t fnv1a(const char *s, size_t n);
+static void var_init(void);
+static const char *var_get(const char *name);
+static int  var_set(const char *name, size_t len, const char *value, int export_it);
+static void var_unset(const char *name);
+static char **var_envp(void);
+static size_t var_name_len(const char *s);
+static int  is_assignment(const char *w);
+static char *expand_word(const char *w);
+
+typedef struct { char **v; size_t n, cap; } strvec_t;   /* NULL-terminated when n>0 */
+static int  sv_push(strvec_t *sv, char *s);
+static int  has_glob_meta(const char *w);
+static void glob_expand(const char *pattern, strvec_t *out, strvec_t *owned);
+
 static int  try_exec_with_path(char **argv);
 static void apply_redirs(char **argv);
 static void exec_simple(char **argv);
+static int  par_run(char **argv);
 
 static int  add_job(pid_t pgid, int bg, const char *cmdline);
 static job_t* find_job_by_pgid(pid_t pgid);
@@ -83,12 +130,22 @@ static void print_job(const job_t *j);
 
 static int  is_number(const char *s);
 static int  builtin_cd(char **argv);
+static void builtin_export(char **argv);
+static int  builtin_read(char **argv);
+static int  builtin_echo(char **argv);
+static int  builtin_coproc(char **argv);
+static void coproc_close(coproc_t *c, int what);
 static void builtin_jobs(void);
 static int  resume_job_bg(job_t *j);
 static int  resume_job_fg(job_t *j);
 static int  try_builtins(char **argv); /* 0=not builtin; 1=handled; 2=request exit */
 
-static pid_t launch_pipeline(char *stage_strs[], int nstages, const char *cmdline, int background, pid_t *out_pgid);
+static void pipestat_wait(pid_t pgid, const pid_t pids[], int rfd[], char **stage_argv[], int nstages, int live, int *stopped);
+static pid_t launch_pipeline(char **stage_argv[], int nstages, const char *cmdline, int background, pid_t *out_pgid);
+static int  run_line(char **stage_argv[], int nstages, const char *cmdline, int background);
+static int  run_expanded(char **stage_argv[], int nstages, const char *cmdline, int background);
+
+static int  run_script(const char *path);
 
 /* --------------------- Tiny utils --------------------- */
 static void trim_trailing(char *s){
@@ -127,6 +184,14 @@ static void s_ncpy(char *dst, const char *src, size_t n){
     size_t i=0; for(; i+1<n && src[i]; ++i) dst[i]=src[i]; dst[i]='\0';
 }
 
+/* append src to dst (size n), truncating; returns the new length */
+static size_t s_cat(char *dst, size_t n, const char *src){
+    size_t i = strlen(dst);
+    for (; i+1<n && *src; ++i) dst[i] = *src++;
+    dst[i]='\0';
+    return i;
+}
+
 /* --------------------- Read line (Enter vs EOF) --------------------- */
 static int read_line(char *buf, int maxlen){
     int off=0;
@@ -148,22 +213,455 @@ static int read_line(char *buf, int maxlen){
     return off; /* 0 => empty line; >0 => content */
 }
 
+/* --------------------- Shell variables --------------------- */
+/* All variables live in one chained hash table; the environment is read
+   into it at startup (exported).  Each entry keeps its "NAME=value" string
+   ready-made, so the envp handed to execve is just an array of pointers
+   into the table.  That array is rebuilt only when an exported variable has
+   changed since the last build (env_dirty), so running commands costs
+   nothing per fork however large the environment is. */
+typedef struct var {
+    struct var *next;
+    uint64_t hash;
+    size_t   name_len;
+    int      exported;
+    char    *pair;          /* "NAME=value" */
+} var_t;
+
+static var_t **var_tab = NULL;
+static size_t var_cap = 0, var_count = 0;
+static char **env_cache = NULL;
+static size_t env_cap = 0;
+static int env_dirty = 1;
+
+extern char **environ;
+
+static uint64_t fnv1a(const char *s, size_t n){
+    uint64_t h = 14695981039346656037ULL;
+    while (n--){ h ^= (unsigned char)*s++; h *= 1099511628211ULL; }
+    return h;
+}
+
+static var_t *var_find(const char *name, size_t len, uint64_t h){
+    if (!var_cap) return NULL;
+    for (var_t *v = var_tab[h & (var_cap-1)]; v; v = v->next)
+        if (v->hash==h && v->name_len==len && memcmp(v->pair, name, len)==0) return v;
+    return NULL;
+}
+
+static void var_grow(void){
+    size_t cap = var_cap ? var_cap*2 : 64;
+    var_t **tab = calloc(cap, sizeof(*tab));
+    if (!tab) return;                   /* keep the old table: only slower */
+    for (size_t i=0;i<var_cap;i++){
+        for (var_t *v = var_tab[i], *next; v; v = next){
+            next = v->next;
+            v->next = tab[v->hash & (cap-1)];
+            tab[v->hash & (cap-1)] = v;
+        }
+    }
+    free(var_tab);
+    var_tab = tab; var_cap = cap;
+}
+
+/* length of the variable name at the start of s (0 if none) */
+static size_t var_name_len(const char *s){
+    size_t n = 0;
+    if (!((s[0]>='A'&&s[0]<='Z')||(s[0]>='a'&&s[0]<='z')||s[0]=='_')) return 0;
+    while ((s[n]>='A'&&s[n]<='Z')||(s[n]>='a'&&s[n]<='z')||(s[n]>='0'&&s[n]<='9')||s[n]=='_') n++;
+    return n;
+}
+
+/* NAME=value */
+static int is_assignment(const char *w){
+    size_t n = var_name_len(w);
+    return n>0 && w[n]=='=';
+}
+
+static const char *var_get(const char *name){
+    size_t len = strlen(name);
+    var_t *v = var_find(name, len, fnv1a(name, len));
+    return v ? v->pair + len + 1 : NULL;
+}
+
+/* set name (its first len bytes) to value; export_it: 1 = export, 0 = leave as is */
+static int var_set(const char *name, size_t len, const char *value, int export_it){
+    uint64_t h = fnv1a(name, len);
+    size_t vlen = strlen(value);
+    char *pair = malloc(len + vlen + 2);
+    if (!pair){ puterr("mysh: out of memory\n"); return -1; }
+    memcpy(pair, name, len); pair[len] = '='; memcpy(pair+len+1, value, vlen+1);
+
+    var_t *v = var_find(name, len, h);
+    if (!v){
+        if (var_count+1 > var_cap - var_cap/4) var_grow();
+        if (!var_cap || !(v = calloc(1, sizeof(*v)))){ free(pair); puterr("mysh: out of memory\n"); return -1; }
+        v->hash = h; v->name_len = len;
+        v->next = var_tab[h & (var_cap-1)];
+        var_tab[h & (var_cap-1)] = v;
+        var_count++;
+    }else{
+        free(v->pair);
+    }
+    v->pair = pair;
+    if (export_it) v->exported = 1;
+    if (v->exported) env_dirty = 1;
+    return 0;
+}
+
+static void var_unset(const char *name){
+    size_t len = strlen(name);
+    uint64_t h = fnv1a(name, len);
+    if (!var_cap) return;
+    for (var_t **pp = &var_tab[h & (var_cap-1)]; *pp; pp = &(*pp)->next){
+        var_t *v = *pp;
+        if (v->hash==h && v->name_len==len && memcmp(v->pair, name, len)==0){
+            *pp = v->next;
+            if (v->exported) env_dirty = 1;
+            free(v->pair); free(v);
+            var_count--;
+            return;
+        }
+    }
+}
+
+static void var_init(void){
+    for (char **e = environ; e && *e; e++){
+        const char *eq = strchr(*e, '=');
+        if (eq) (void)var_set(*e, (size_t)(eq - *e), eq + 1, 1);
+    }
+}
+
+/* the exported variables as an envp array, rebuilt only if one has changed */
+static char **var_envp(void){
+    if (!env_dirty && env_cache) return env_cache;
+
+    size_t n = 0;
+    for (size_t i=0;i<var_cap;i++) for (var_t *v = var_tab[i]; v; v = v->next) if (v->exported) n++;
+    if (n+1 > env_cap){
+        char **e = realloc(env_cache, (n+1) * sizeof(*e));
+        if (!e) return env_cache ? env_cache : environ;
+        env_cache = e; env_cap = n+1;
+    }
+    n = 0;
+    for (size_t i=0;i<var_cap;i++) for (var_t *v = var_tab[i]; v; v = v->next) if (v->exported) env_cache[n++] = v->pair;
+    env_cache[n] = NULL;
+    env_dirty = 0;
+    return env_cache;
+}
+
+/* $NAME and ${NAME} substituted (unset = empty): a malloc'd copy, or NULL
+   when w has nothing to expand (the common case costs one strchr) */
+static char *expand_word(const char *w){
+    if (!strchr(w, '$')) return NULL;
+
+    size_t cap = strlen(w) + 64, len = 0;
+    char *out = malloc(cap);
+    if (!out) return NULL;
+
+    while (*w){
+        const char *val = NULL; size_t vlen = 1, skip = 1;
+        if (w[0]=='$' && w[1]=='{'){
+            const char *close = strchr(w+2, '}');
+            size_t n = var_name_len(w+2);
+            if (close && n == (size_t)(close - (w+2)) && n > 0){
+                char name[256]; s_ncpy(name, w+2, n+1 < sizeof(name) ? n+1 : sizeof(name));
+                val = var_get(name); if (!val) val = "";
+                vlen = strlen(val); skip = n + 3;
+            }
+        }else if (w[0]=='$' && var_name_len(w+1) > 0){
+            size_t n = var_name_len(w+1);
+            char name[256]; s_ncpy(name, w+1, n+1 < sizeof(name) ? n+1 : sizeof(name));
+            val = var_get(name); if (!val) val = "";
+            vlen = strlen(val); skip = n + 1;
+        }
+        if (!val) val = w;              /* anything else is literal */
+
+        if (len + vlen + 1 > cap){
+            while (len + vlen + 1 > cap) cap *= 2;
+            char *p = realloc(out, cap);
+            if (!p){ free(out); return NULL; }
+            out = p;
+        }
+        memcpy(out+len, val, vlen); len += vlen;
+        w += skip;
+    }
+    out[len] = '\0';
+    return out;
+}
+
+/* --------------------- Globbing --------------------- */
+/* *, ? and [...] in a word are matched against directory entries, one path
+   component at a time.  Each component with wildcards is compiled once into
+   a small op array, and every entry is run through that rather than through
+   fnmatch.  Directories are read with getdents64 into a large buffer, and
+   the listing is kept (up to GLOB_CACHE_DIRS of them): within one command
+   line it's used as is, and at the next it's reused if the directory's
+   mtime hasn't changed - so repeated globs over a big directory don't
+   rescan it.  Words that match nothing are left as they are; names starting
+   with '.' only match a pattern that starts with '.'. */
+long syscall(long number, ...);     /* not declared under strict POSIX */
+
+enum { G_LIT, G_ANY, G_STAR, G_SET };
+typedef struct { unsigned char op, c; unsigned char set[32]; } gop_t;
+typedef struct { gop_t ops[GLOB_MAX_OPS]; int n; } gpat_t;
+
+enum { D_UNKNOWN = 0, D_DIR = 4, D_LNK = 10 };   /* linux_dirent64 d_type values */
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+typedef struct {
+    char     path[1024];
+    dev_t    dev; ino_t ino;
+    time_t   mt_sec; long mt_nsec;
+    unsigned gen;                   /* glob_gen when last checked; 0 = free */
+    char    *names;                 /* d_type byte, then the NUL-terminated name, per entry */
+    size_t   len, count;
+    int      pinned;                /* being walked: not to be replaced until released */
+    int      spare;                 /* not a cache slot (they were all pinned): freed on release */
+} dcache_t;
+
+static dcache_t dcache[GLOB_CACHE_DIRS];
+static unsigned glob_gen = 1;
+
+static int sv_push(strvec_t *sv, char *s){
+    if (sv->n+2 > sv->cap){
+        size_t cap = sv->cap ? sv->cap*2 : 16;
+        char **v = realloc(sv->v, cap * sizeof(*v));
+        if (!v) return -1;
+        sv->v = v; sv->cap = cap;
+    }
+    sv->v[sv->n++] = s;
+    sv->v[sv->n] = NULL;
+    return 0;
+}
+
+static int has_glob_meta(const char *w){ return strpbrk(w, "*?[") != NULL; }
+
+/* compile one path component (len bytes of p); -1 if too long */
+static int gpat_compile(const char *p, size_t len, gpat_t *g){
+    const char *end = p + len;
+    g->n = 0;
+    while (p < end){
+        if (g->n >= GLOB_MAX_OPS) return -1;
+        gop_t *o = &g->ops[g->n];
+        memset(o, 0, sizeof(*o));
+        if (*p=='*'){
+            if (g->n==0 || g->ops[g->n-1].op!=G_STAR){ o->op = G_STAR; g->n++; }
+            p++; continue;
+        }
+        if (*p=='?'){ o->op = G_ANY; g->n++; p++; continue; }
+        if (*p=='['){
+            const char *q = p + 1;
+            int negate = 0;
+            if (q<end && (*q=='!'||*q=='^')){ negate = 1; q++; }
+            const char *first = q;
+            while (q<end && (*q!=']' || q==first)) q++;
+            if (q<end){                 /* a complete class: p+1 .. q */
+                o->op = G_SET;
+                for (const char *c = first; c<q; c++){
+                    unsigned char lo = (unsigned char)*c, hi = lo;
+                    if (c+2<q && c[1]=='-'){ hi = (unsigned char)c[2]; c += 2; }
+                    for (unsigned v = lo; v <= hi; v++) o->set[v>>3] |= (unsigned char)(1u << (v&7));
+                }
+                if (negate) for (int i=0;i<32;i++) o->set[i] = (unsigned char)~o->set[i];
+                g->n++; p = q + 1; continue;
+            }
+        }
+        if (*p=='\\' && p+1<end) p++;   /* \* etc. are literal */
+        o->op = G_LIT; o->c = (unsigned char)*p++; g->n++;
+    }
+    return 0;
+}
+
+static int gpat_match(const gpat_t *g, const char *s){
+    int pi = 0, star_pi = -1;
+    const char *star_s = NULL;
+
+    if (*s=='.' && (g->n==0 || g->ops[0].op!=G_LIT || g->ops[0].c!='.')) return 0;
+
+    while (*s){
+        if (pi < g->n){
+            const gop_t *o = &g->ops[pi];
+            unsigned char c = (unsigned char)*s;
+            if (o->op==G_STAR){ star_pi = ++pi; star_s = s; continue; }
+            if ((o->op==G_LIT && o->c==c) || o->op==G_ANY
+                || (o->op==G_SET && (o->set[c>>3] & (1u << (c&7))))){ pi++; s++; continue; }
+        }
+        if (star_pi < 0) return 0;
+        pi = star_pi; s = ++star_s;     /* let the last * take one more character */
+    }
+    while (pi < g->n && g->ops[pi].op==G_STAR) pi++;
+    return pi == g->n;
+}
+
+/* read path into e; -1 (and e left free) if it can't be */
+static int dir_read(dcache_t *e, const char *path){
+    struct stat st;
+    e->gen = 0; e->len = e->count = 0;
+    if (strlen(path) >= sizeof(e->path)) return -1;
+
+    int fd = open(path, O_RDONLY|O_DIRECTORY);
+    if (fd<0) return -1;
+    char *buf = malloc(DENTS_BUF);
+    size_t cap = 0;
+    if (!buf || fstat(fd, &st)<0){ free(buf); close(fd); return -1; }
+
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, DENTS_BUF)) > 0){
+        for (long off = 0; off < n; ){
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(void *)(buf + off);
+            off += d->d_reclen;
+            if (d->d_name[0]=='.' && (!d->d_name[1] || (d->d_name[1]=='.' && !d->d_name[2]))) continue;
+            size_t nl = strlen(d->d_name) + 2;
+            if (e->len + nl > cap){
+                size_t ncap = cap ? cap*2 : 64*1024;
+                while (ncap < e->len + nl) ncap *= 2;
+                char *p = realloc(e->names, ncap);
+                if (!p){ n = -1; break; }
+                if (e->names != p) e->names = p;
+                cap = ncap;
+            }
+            e->names[e->len] = (char)d->d_type;
+            memcpy(e->names + e->len + 1, d->d_name, nl - 1);
+            e->len += nl; e->count++;
+        }
+        if (n < 0) break;
+    }
+    free(buf); close(fd);
+    if (n < 0) return -1;
+
+    s_ncpy(e->path, path, sizeof(e->path));
+    e->dev = st.st_dev; e->ino = st.st_ino;
+    e->mt_sec = st.st_mtim.tv_sec; e->mt_nsec = st.st_mtim.tv_nsec;
+    e->gen = glob_gen;
+    return 0;
+}
+
+/* done with a listing from dir_list */
+static void dir_release(dcache_t *e){
+    if (!e->spare){ e->pinned--; return; }
+    free(e->names); free(e);
+}
+
+/* the listing of dir ("" = current), from the cache if it's still good;
+   dir_release it when done.  The listings a walk is still going through
+   are pinned, and a new one replaces the least recently checked of the
+   others - or, when there are none (a walk deeper than the cache), is
+   read into a spare that isn't kept. */
+static dcache_t *dir_list(const char *dir){
+    const char *path = *dir ? dir : ".";
+    dcache_t *e = NULL, *victim = NULL;
+    struct stat st;
+
+    for (int i=0;i<GLOB_CACHE_DIRS;i++){
+        if (dcache[i].gen && strcmp(dcache[i].path, path)==0){ e = &dcache[i]; break; }
+        if (!dcache[i].pinned && (!victim || dcache[i].gen < victim->gen)) victim = &dcache[i];
+    }
+    if (e && (e->gen==glob_gen || (stat(path, &st)==0 && st.st_dev==e->dev && st.st_ino==e->ino
+        && st.st_mtim.tv_sec==e->mt_sec && st.st_mtim.tv_nsec==e->mt_nsec))){
+        e->gen = glob_gen;
+    }else{                              /* (re)read it */
+        if (!e) e = victim;
+        if (!e){
+            if (!(e = calloc(1, sizeof(*e)))) return NULL;
+            e->spare = 1;
+        }
+        if (dir_read(e, path)<0){
+            if (e->spare){ free(e->names); free(e); }
+            return NULL;
+        }
+    }
+    e->pinned++;
+    return e;
+}
+
+static char *str_join(const char *a, const char *b, size_t blen){
+    size_t alen = strlen(a);
+    char *s = malloc(alen + blen + 1);
+    if (!s) return NULL;
+    memcpy(s, a, alen); memcpy(s+alen, b, blen); s[alen+blen] = '\0';
+    return s;
+}
+
+/* match rest (the pattern after prefix, which is "" or ends in '/') */
+static void glob_walk(const char *prefix, const char *rest, strvec_t *out, strvec_t *owned){
+    const char *slash = strchr(rest, '/');
+    size_t clen = slash ? (size_t)(slash - rest) : strlen(rest);
+
+    if (!memchr(rest, '*', clen) && !memchr(rest, '?', clen) && !memchr(rest, '[', clen)){
+        /* a plain component: no listing needed, only a check at the end */
+        char *p = str_join(prefix, rest, slash ? clen+1 : clen);
+        struct stat st;
+        if (!p) return;
+        if (slash) glob_walk(p, slash+1, out, owned);
+        else if (lstat(p, &st)==0 && sv_push(owned, p)==0){ (void)sv_push(out, p); return; }
+        free(p);
+        return;
+    }
+
+    gpat_t g;
+    dcache_t *d;
+    if (gpat_compile(rest, clen, &g)<0 || !(d = dir_list(prefix))) return;
+
+    /* d stays pinned while the deeper walks below list other directories */
+    for (size_t off = 0; off < d->len; ){
+        unsigned char type = (unsigned char)d->names[off];
+        const char *name = d->names + off + 1;
+        size_t nl = strlen(name);
+        off += nl + 2;
+        if (!gpat_match(&g, name)) continue;
+
+        char *p = str_join(prefix, name, nl);
+        if (!p) break;
+        if (!slash){
+            if (sv_push(owned, p)<0){ free(p); break; }
+            (void)sv_push(out, p);
+            continue;
+        }
+        struct stat st;
+        if (type==D_DIR || ((type==D_UNKNOWN || type==D_LNK) && stat(p, &st)==0 && S_ISDIR(st.st_mode))){
+            char *q = str_join(p, "/", 1);
+            if (q){ glob_walk(q, slash+1, out, owned); free(q); }
+        }
+        free(p);
+    }
+    dir_release(d);
+}
+
+static int cmp_str(const void *a, const void *b){
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* append the sorted matches of pattern to out (nothing if none) */
+static void glob_expand(const char *pattern, strvec_t *out, strvec_t *owned){
+    size_t before = out->n;
+    if (pattern[0]=='/') glob_walk("/", pattern+1, out, owned);
+    else                 glob_walk("", pattern, out, owned);
+    if (out->n - before > 1) qsort(out->v + before, out->n - before, sizeof(char *), cmp_str);
+}
+
 /* --------------------- PATH search (no execvp) --------------------- */
 static int try_exec_with_path(char **argv){
     if (!argv[0]) return -1;
 
     if (strchr(argv[0], '/')){
-        execv(argv[0], argv);
+        execve(argv[0], argv, var_envp());
         return -1; /* only returns on failure */
     }
 
-    char *path = getenv("PATH");
+    const char *path = var_get("PATH");
     if (!path) return -1;
 
     char buf[1024];
-    char *p = path;
+    const char *p = path;
     while (1){
-        char *start = p, *end = p;
+        const char *start = p, *end = p;
         while (*end && *end!=':') end++;
         int seglen = (int)(end - start);
 
@@ -178,7 +676,7 @@ static int try_exec_with_path(char **argv){
         while (*nm && off<(int)sizeof(buf)-1) buf[off++]=*nm++;
         buf[off]='\0';
 
-        execv(buf, argv);               /* returns only on failure */
+        execve(buf, argv, var_envp());  /* returns only on failure */
 
         if (!*end) break;
         p = end + 1;
@@ -205,18 +703,33 @@ static void apply_redirs(char **argv){
             if (fd<0){ puterr("mysh: cannot open input file: "); puterr(argv[i+1]); puterr("\n"); _exit(1); }
             (void)dup2(fd, STDIN_FILENO); (void)close(fd);
             argv[i]=NULL; i+=2; continue;
+        }else if ((argv[i][0]=='>' || argv[i][0]=='<') && argv[i][1]=='&' && is_number(argv[i]+2)){
+            /* >&N, <&N: an open descriptor, such as a coprocess's */
+            int target = argv[i][0]=='>' ? STDOUT_FILENO : STDIN_FILENO;
+            if (dup2(atoi(argv[i]+2), target)<0){ puterr("mysh: bad file descriptor: "); puterr(argv[i]+2); puterr("\n"); _exit(1); }
+            argv[i]=NULL; i++; continue;
         }
         i++;
     }
 }
 
 static void exec_simple(char **argv){
+    /* leading NAME=value words go into this command's environment only
+       (this is the child's copy of the table) */
+    while (argv[0] && is_assignment(argv[0])){
+        size_t n = var_name_len(argv[0]);
+        (void)var_set(argv[0], n, argv[0]+n+1, 1);
+        argv++;
+    }
     apply_redirs(argv);
     if (!argv[0]){ puterr("mysh: empty command\n"); _exit(127); }
 
     signal(SIGINT,  SIG_DFL);
     signal(SIGTSTP, SIG_DFL);
     signal(SIGQUIT, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);   /* par reaps its own replicas: the shell's handler mustn't */
+
+    if (strcmp(argv[0], "par")==0) _exit(par_run(argv));
 
     if (try_exec_with_path(argv) < 0){
         puterr("mysh: command not found: "); puterr(argv[0]); puterr("\n");
@@ -224,6 +737,200 @@ static void exec_simple(char **argv){
     }
 }
 
+/* --------------------- par: parallel replicas of a stage --------------------- */
+/* "par N [-k] [-b KiB] cmd [args]" as a command or a pipeline stage runs
+   cmd over its input up to N at a time.  The input is cut into chunks of
+   about PAR_CHUNK (or -b KiB), always at a newline, and each chunk is fed
+   to a fresh cmd; its whole output is that chunk's output.  Output is
+   merged in arrival order, a line at a time, or with -k in the order of the
+   input: the oldest chunk's output streams straight through and later ones
+   wait in memory (at most 2N chunks ahead of it, so that stays bounded).
+
+   A process per chunk is what makes -k possible for any filter: a
+   long-running cmd gives no way to tell which output belongs to which
+   input.  So cmd must treat lines independently (grep, sed, jq -c, ...);
+   chunks are large to keep the cost of starting it small.
+
+   par itself is just a process in the job's process group, and so are its
+   replicas: the job table sees one job, and ^C, ^Z and fg reach them all. */
+typedef struct {
+    pid_t  pid;                     /* 0: free */
+    unsigned long seq;              /* which chunk */
+    int    in, out;                 /* its stdin (-1 once all fed), its stdout (-1 at EOF) */
+    char  *chunk; size_t len, fed;
+    char  *obuf;  size_t olen, ocap;
+} par_slot_t;
+
+typedef struct { int ready; char *buf; size_t len; } par_done_t;
+
+static int par_grow(char **buf, size_t *cap, size_t need){
+    if (need <= *cap) return 0;
+    size_t cap2 = *cap ? *cap : 65536;
+    while (cap2 < need) cap2 *= 2;
+    char *p = realloc(*buf, cap2);
+    if (!p) return -1;
+    *buf = p; *cap = cap2;
+    return 0;
+}
+
+/* start cmd on a chunk: pipes both ways, ours non-blocking, none inherited */
+static int par_spawn(par_slot_t *sl, char **cmd){
+    int to[2], from[2];
+    if (pipe(to)<0) return -1;
+    if (pipe(from)<0){ close(to[0]); close(to[1]); return -1; }
+    for (int i=0;i<2;i++){ (void)fcntl(to[i], F_SETFD, FD_CLOEXEC); (void)fcntl(from[i], F_SETFD, FD_CLOEXEC); }
+
+    pid_t pid = fork();
+    if (pid<0){ close(to[0]); close(to[1]); close(from[0]); close(from[1]); return -1; }
+    if (pid==0){
+        (void)dup2(to[0], STDIN_FILENO); (void)dup2(from[1], STDOUT_FILENO);
+        signal(SIGPIPE, SIG_DFL);       /* par ignores it; cmd shouldn't */
+        exec_simple(cmd);
+    }
+    close(to[0]); close(from[1]);
+    (void)fcntl(to[1], F_SETFL, O_NONBLOCK);
+    (void)fcntl(from[0], F_SETFL, O_NONBLOCK);
+    sl->pid = pid; sl->in = to[1]; sl->out = from[0];
+    sl->fed = 0; sl->olen = 0;
+    return 0;
+}
+
+/* write out the first n bytes of a slot's output */
+static int par_emit(par_slot_t *sl, size_t n){
+    if (n==0) return 0;
+    if (write_all(STDOUT_FILENO, sl->obuf, n)<0) return -1;
+    memmove(sl->obuf, sl->obuf + n, sl->olen - n);
+    sl->olen -= n;
+    return 0;
+}
+
+static int par_run(char **argv){
+    int n = 0, keep = 0, i = 1;
+    size_t chunk = PAR_CHUNK;
+    if (argv[i] && is_number(argv[i])) n = atoi(argv[i++]);
+    for (; argv[i] && argv[i][0]=='-'; i++){
+        if (strcmp(argv[i], "-k")==0) keep = 1;
+        else if (strcmp(argv[i], "-b")==0 && is_number(argv[i+1]) && atoi(argv[i+1])>0) chunk = (size_t)atoi(argv[++i]) * 1024;
+        else break;
+    }
+    if (n<1 || n>PAR_MAX || !argv[i]){
+        puterr("usage: par N [-k] [-b KiB] command [args...]  (N up to 64)\n");
+        return 2;
+    }
+    char **cmd = argv + i;
+
+    par_slot_t slots[PAR_MAX];
+    par_done_t done[2*PAR_MAX];
+    struct pollfd pfd[1 + 2*PAR_MAX];
+    int who[1 + 2*PAR_MAX];             /* pfd index -> slot, or -1 for stdin */
+    char *pend = NULL; size_t plen = 0, pcap = 0;
+    unsigned long next_seq = 0, next_out = 0, window = 2 * (unsigned long)n;
+    int in_eof = 0, running = 0, status_out = 0;
+
+    memset(slots, 0, sizeof(slots)); memset(done, 0, sizeof(done));
+    signal(SIGPIPE, SIG_IGN);           /* a replica that quits early must not take par with it */
+
+    for (;;){
+        /* hand out chunks: complete lines, about chunk bytes each */
+        while (running < n && plen > 0 && (!keep || next_seq < next_out + window)){
+            size_t cut = 0;
+            if (plen >= chunk){
+                for (cut = chunk; cut > 0 && pend[cut-1]!='\n'; cut--) { /* back to a newline */ }
+                if (cut==0){            /* a line longer than a chunk: all of it */
+                    char *nl = memchr(pend + chunk, '\n', plen - chunk);
+                    cut = nl ? (size_t)(nl - pend) + 1 : (in_eof ? plen : 0);
+                }
+            }else if (in_eof){
+                cut = plen;
+            }
+            if (cut==0) break;          /* wait for more input */
+
+            par_slot_t *sl = NULL;
+            for (int k=0;k<n && !sl;k++) if (!slots[k].pid) sl = &slots[k];
+            sl->chunk = malloc(cut);
+            if (!sl->chunk || par_spawn(sl, cmd)<0){ puterr("par: cannot start a replica\n"); return 1; }
+            memcpy(sl->chunk, pend, cut); sl->len = cut;
+            memmove(pend, pend + cut, plen - cut); plen -= cut;
+            sl->seq = next_seq++;
+            running++;
+        }
+        if (running==0 && in_eof && plen==0) break;
+
+        int np = 0;
+        if (!in_eof && (plen < chunk || !memchr(pend, '\n', plen))){
+            pfd[np].fd = STDIN_FILENO; pfd[np].events = POLLIN; who[np++] = -1;
+        }
+        for (int k=0;k<n;k++){
+            if (!slots[k].pid) continue;
+            if (slots[k].in>=0){ pfd[np].fd = slots[k].in; pfd[np].events = POLLOUT; who[np++] = k; }
+            if (slots[k].out>=0){ pfd[np].fd = slots[k].out; pfd[np].events = POLLIN; who[np++] = k; }
+        }
+        if (np==0) break;               /* can't happen: something is always pending */
+        if (poll(pfd, (nfds_t)np, -1)<0){ if (errno==EINTR) continue; puterr("par: poll failed\n"); return 1; }
+
+        for (int q=0;q<np;q++){
+            if (!pfd[q].revents) continue;
+            if (who[q] < 0){            /* more input */
+                if (par_grow(&pend, &pcap, plen + chunk)<0){ puterr("par: out of memory\n"); return 1; }
+                ssize_t r = read(STDIN_FILENO, pend + plen, pcap - plen);
+                if (r>0) plen += (size_t)r;
+                else if (r==0 || errno!=EINTR) in_eof = 1;
+                continue;
+            }
+            par_slot_t *sl = &slots[who[q]];
+            if (pfd[q].fd == sl->in){   /* feed it */
+                ssize_t w = write(sl->in, sl->chunk + sl->fed, sl->len - sl->fed);
+                if (w>0) sl->fed += (size_t)w;
+                if ((w<0 && errno!=EAGAIN && errno!=EINTR) || sl->fed == sl->len){
+                    close(sl->in); sl->in = -1;
+                    free(sl->chunk); sl->chunk = NULL;
+                }
+                continue;
+            }
+
+            /* its output */
+            if (par_grow(&sl->obuf, &sl->ocap, sl->olen + 65536)<0){ puterr("par: out of memory\n"); return 1; }
+            ssize_t r = read(sl->out, sl->obuf + sl->olen, sl->ocap - sl->olen);
+            if (r<0 && (errno==EAGAIN || errno==EINTR)) continue;
+            if (r>0){
+                sl->olen += (size_t)r;
+                size_t upto = sl->olen;
+                if (!keep) while (upto > 0 && sl->obuf[upto-1]!='\n') upto--;   /* whole lines only */
+                if ((!keep || sl->seq==next_out) && par_emit(sl, upto)<0) return 1;
+                continue;
+            }
+
+            /* end of its output: it's finished */
+            int st; pid_t w;
+            close(sl->out); sl->out = -1;
+            if (sl->in>=0){ close(sl->in); sl->in = -1; free(sl->chunk); sl->chunk = NULL; }
+            while ((w = waitpid(sl->pid, &st, 0))<0 && errno==EINTR) { /* retry */ }
+            if (w<0){ puterr("par: cannot wait for a replica\n"); return 1; }
+            if (WIFEXITED(st) && WEXITSTATUS(st)==127) return 127;     /* not found: every chunk would fail */
+            if (!WIFEXITED(st) || WEXITSTATUS(st)!=0) status_out = WIFEXITED(st) ? WEXITSTATUS(st) : 1;
+            sl->pid = 0; running--;
+
+            if (!keep || sl->seq==next_out){
+                if (par_emit(sl, sl->olen)<0) return 1;
+                if (keep) next_out++;
+            }else{                      /* park it until its turn */
+                par_done_t *d = &done[sl->seq % window];
+                d->ready = 1; d->buf = sl->obuf; d->len = sl->olen;
+                sl->obuf = NULL; sl->olen = sl->ocap = 0;
+            }
+            while (keep && done[next_out % window].ready){
+                par_done_t *d = &done[next_out % window];
+                if (write_all(STDOUT_FILENO, d->buf, d->len)<0) return 1;
+                free(d->buf); memset(d, 0, sizeof(*d));
+                next_out++;
+            }
+            for (int k=0;keep && k<n;k++)   /* the new oldest chunk streams from now on */
+                if (slots[k].pid && slots[k].seq==next_out && par_emit(&slots[k], slots[k].olen)<0) return 1;
+        }
+    }
+    return status_out;
+}
+
 /* --------------------- Signals & reaping --------------------- */
 static void sigchld_handler(int sig){
     (void)sig;
@@ -265,14 +972,33 @@ static void reap_done_jobs(void){
             memset(&jobs[i], 0, sizeof(jobs[i]));
         }
     }
+    for (int i=0;i<MAX_COPROCS;i++){
+        if (coprocs[i].used && coprocs[i].pgid && kill(-coprocs[i].pgid, 0) == -1 && errno == ESRCH)
+            coproc_close(&coprocs[i], CO_EXITED);
+    }
 }
 
 /* --------------------- Terminal ownership --------------------- */
 static void give_terminal_to(pid_t pgid){
+    if (!interactive) return;
     while (tcsetpgrp(STDIN_FILENO, pgid)==-1 && errno==EINTR) { /* retry */ }
 }
 
+/* a foreground wait: with job control a stopped job goes back to the
+   prompt; a script, like sh, just waits for it to finish */
+static int fg_wait_flags(void){
+    return interactive ? WUNTRACED : 0;
+}
+
+/* without job control, background commands read /dev/null rather than the
+   terminal (as in sh); a < redirection still applies over it */
+static void detach_stdin(void){
+    int fd = open("/dev/null", O_RDONLY);
+    if (fd>=0){ (void)dup2(fd, STDIN_FILENO); if (fd!=STDIN_FILENO) close(fd); }
+}
+
 static void install_shell(void){
+    interactive = 1;
     shell_pgid = getpid();
     setpgid(shell_pgid, shell_pgid);
     give_terminal_to(shell_pgid);
@@ -333,11 +1059,27 @@ static int is_number(const char *s){
 }
 
 static int builtin_cd(char **argv){
-    const char *dir = argv[1] ? argv[1] : getenv("HOME");
+    const char *dir = argv[1] ? argv[1] : var_get("HOME");
     if (!dir){ puterr("cd: HOME not set\n"); return -1; }
     if (chdir(dir)<0){ puterr("cd: "); puterr(dir); puterr(": No such file or directory\n"); return -1; }
     return 0;
 }
+static void builtin_export(char **argv){
+    if (!argv[1]){                      /* list the environment */
+        for (char **e = var_envp(); *e; e++){ putstr("export "); putstr(*e); putstr("\n"); }
+        return;
+    }
+    for (int i=1; argv[i]; i++){
+        size_t n = var_name_len(argv[i]);
+        if (n==0 || (argv[i][n]!='=' && argv[i][n]!='\0')){
+            puterr("export: not a valid name: "); puterr(argv[i]); puterr("\n");
+            continue;
+        }
+        if (argv[i][n]=='='){ (void)var_set(argv[i], n, argv[i]+n+1, 1); continue; }
+        const char *val = var_get(argv[i]);
+        (void)var_set(argv[i], n, val ? val : "", 1);
+    }
+}
 static void builtin_jobs(void){
     for (int i=0;i<MAX_JOBS;i++) if (jobs[i].used) print_job(&jobs[i]);
 }
@@ -356,7 +1098,7 @@ static int resume_job_fg(job_t *j){
 
     int status; pid_t w;
     do {
-        w = waitpid(-j->pgid, &status, WUNTRACED);
+        w = waitpid(-j->pgid, &status, fg_wait_flags());
         if (w==-1){ if (errno==EINTR) continue; if (errno==ECHILD) break; break; }
     } while (!(WIFEXITED(status)||WIFSIGNALED(status)||WIFSTOPPED(status)));
 
@@ -366,6 +1108,146 @@ static int resume_job_fg(job_t *j){
     return 0;
 }
 
+/* read [-u fd] NAME: one line (without the newline) into NAME.  Byte by
+   byte, so nothing past the line is taken from a shared pipe. */
+static int builtin_read(char **argv){
+    int fd = STDIN_FILENO, i = 1;
+    if (argv[i] && strcmp(argv[i], "-u")==0 && is_number(argv[i+1])){ fd = atoi(argv[i+1]); i += 2; }
+    if (!argv[i] || var_name_len(argv[i]) != strlen(argv[i])){ puterr("usage: read [-u fd] NAME\n"); return -1; }
+
+    char buf[4096]; size_t n = 0; ssize_t r = 0;
+    while (n+1 < sizeof(buf)){
+        char c;
+        r = read(fd, &c, 1);
+        if (r<0 && errno==EINTR) continue;
+        if (r<=0 || c=='\n') break;
+        buf[n++] = c;
+    }
+    buf[n] = '\0';
+    (void)var_set(argv[i], strlen(argv[i]), buf, 0);
+    return (r<=0 && n==0) ? -1 : 0;     /* -1 at end of input */
+}
+
+/* echo [-n] WORDS [>&N]: written by the shell itself, in one write, so a
+   script can feed a coprocess (echo rec >&$NAME_W) without a fork per
+   line.  0 if there's another redirection, for the external echo to do. */
+static int builtin_echo(char **argv){
+    int fd = STDOUT_FILENO, i = 1, newline = 1, end;
+    if (argv[i] && strcmp(argv[i], "-n")==0){ newline = 0; i++; }
+    for (end = i; argv[end]; end++){
+        if (strcmp(argv[end], ">")==0 || strcmp(argv[end], ">>")==0 || strcmp(argv[end], "<")==0
+            || (argv[end][0]=='<' && argv[end][1]=='&')) return 0;
+        if (argv[end][0]=='>' && argv[end][1]=='&' && is_number(argv[end]+2)) break;
+    }
+    if (argv[end]){
+        for (int k=end+1; argv[k]; k++)     /* as apply_redirs: the words stop at the first redirection */
+            if (argv[k][0]=='<' || argv[k][0]=='>') return 0;
+        fd = atoi(argv[end]+2);
+        if (fcntl(fd, F_GETFD)<0){ puterr("mysh: bad file descriptor: "); puterr(argv[end]+2); puterr("\n"); return 1; }
+    }
+
+    size_t len = 2;                     /* the newline and the NUL */
+    for (int k=i; k<end; k++) len += strlen(argv[k]) + 1;
+    char *buf = malloc(len);
+    if (!buf){ puterr("mysh: out of memory\n"); return 1; }
+    buf[0] = '\0';
+    for (int k=i; k<end; k++){ if (k>i) s_cat(buf, len, " "); s_cat(buf, len, argv[k]); }
+    if (newline) s_cat(buf, len, "\n");
+
+    /* a coprocess that has exited mustn't take the shell with it */
+    void (*old)(int) = signal(SIGPIPE, SIG_IGN);
+    if (write_all(fd, buf, strlen(buf))<0){ puterr("echo: write failed: "); puterr(strerror(errno)); puterr("\n"); }
+    signal(SIGPIPE, old);
+    free(buf);
+    return 1;
+}
+
+/* set NAME<suffix> to the number v */
+static void var_set_num(const char *name, const char *suffix, long v){
+    char var[96], num[24]; int i = (int)sizeof(num) - 1;
+    var[0] = '\0'; s_cat(var, sizeof(var), name); s_cat(var, sizeof(var), suffix);
+    num[i] = '\0';
+    do { num[--i] = (char)('0' + v%10); v /= 10; } while (v && i>0);
+    (void)var_set(var, strlen(var), num + i, 0);
+}
+
+static void coproc_unset(const coproc_t *c, const char *suffix){
+    char var[96];
+    var[0] = '\0'; s_cat(var, sizeof(var), c->name); s_cat(var, sizeof(var), suffix);
+    var_unset(var);
+}
+
+/* what closes a coprocess, a step at a time: its input (it sees end of
+   file), then, when it has exited, its pid; its output stays readable
+   until released, so nothing it wrote before exiting is lost */
+static void coproc_close(coproc_t *c, int what){
+    if (what==CO_INPUT && c->wfd >= 0){ close(c->wfd); c->wfd = -1; coproc_unset(c, "_W"); }
+    if (what==CO_EXITED){ coproc_close(c, CO_INPUT); c->pgid = 0; coproc_unset(c, "_PID"); }
+    if (what==CO_RELEASE){ coproc_close(c, CO_INPUT); close(c->rfd); coproc_unset(c, "_PID"); coproc_unset(c, "_R"); memset(c, 0, sizeof(*c)); }
+}
+
+/* coproc NAME cmd [args]: start cmd as a background job with its stdin and
+   stdout on pipes held by the shell, and set NAME_R (read its output),
+   NAME_W (write its input) and NAME_PID.  Later commands reach it with
+   >&$NAME_W and <&$NAME_R, or echo ... >&$NAME_W and read -u $NAME_R
+   without a fork.  The shell's ends are
+   close-on-exec, so no other program holds them open by accident.
+   coproc -c NAME closes its input; once that's closed, or the coprocess
+   has exited, a second coproc -c NAME releases its output too. */
+static int builtin_coproc(char **argv){
+    coproc_t *c = NULL;
+
+    if (argv[1] && strcmp(argv[1], "-c")==0){
+        for (int i=0;i<MAX_COPROCS;i++)
+            if (coprocs[i].used && argv[2] && strcmp(coprocs[i].name, argv[2])==0){
+                coproc_close(&coprocs[i], coprocs[i].wfd >= 0 ? CO_INPUT : CO_RELEASE);
+                return 0;
+            }
+        puterr("coproc: no such coprocess\n");
+        return -1;
+    }
+    if (!argv[1] || !argv[2] || var_name_len(argv[1]) != strlen(argv[1]) || strlen(argv[1]) >= sizeof(c->name)){
+        puterr("usage: coproc NAME command [args...] | coproc -c NAME\n");
+        return -1;
+    }
+    for (int i=0;i<MAX_COPROCS;i++){
+        if (coprocs[i].used && strcmp(coprocs[i].name, argv[1])==0){
+            if (coprocs[i].pgid){ puterr("coproc: already running: "); puterr(argv[1]); puterr("\n"); return -1; }
+            coproc_close(&coprocs[i], CO_RELEASE);
+        }
+        if (!coprocs[i].used && !c) c = &coprocs[i];
+    }
+    if (!c){ puterr("coproc: too many coprocesses\n"); return -1; }
+
+    int to[2], from[2];
+    if (pipe(to)<0) { puterr("mysh: pipe failed\n"); return -1; }
+    if (pipe(from)<0){ close(to[0]); close(to[1]); puterr("mysh: pipe failed\n"); return -1; }
+
+    pid_t pid = fork();
+    if (pid<0){ puterr("mysh: fork failed\n"); close(to[0]); close(to[1]); close(from[0]); close(from[1]); return -1; }
+    if (pid==0){
+        setpgid(0, 0);
+        (void)dup2(to[0], STDIN_FILENO); (void)dup2(from[1], STDOUT_FILENO);
+        close(to[0]); close(to[1]); close(from[0]); close(from[1]);
+        exec_simple(argv + 2);
+    }
+    setpgid(pid, pid);
+    close(to[0]); close(from[1]);
+    (void)fcntl(to[1], F_SETFD, FD_CLOEXEC);
+    (void)fcntl(from[0], F_SETFD, FD_CLOEXEC);
+
+    c->used = 1; c->pgid = pid; c->rfd = from[0]; c->wfd = to[1];
+    s_ncpy(c->name, argv[1], sizeof(c->name));
+    var_set_num(c->name, "_PID", pid);
+    var_set_num(c->name, "_R", c->rfd);
+    var_set_num(c->name, "_W", c->wfd);
+
+    char cmdline[MAX_LINE]; cmdline[0] = '\0';
+    for (int i=0; argv[i]; i++){ if (i) s_cat(cmdline, sizeof(cmdline), " "); s_cat(cmdline, sizeof(cmdline), argv[i]); }
+    (void)add_job(pid, 1, cmdline);
+    return 0;
+}
+
 /* 0 = not builtin; 1 = handled (keep loop); 2 = request to exit shell */
 static int try_builtins(char **argv){
     if (!argv[0]) return 1;
@@ -376,6 +1258,16 @@ static int try_builtins(char **argv){
 
     if (strcmp(argv[0], "jobs")==0){ builtin_jobs(); return 1; }
 
+    if (strcmp(argv[0], "export")==0){ builtin_export(argv); return 1; }
+
+    if (strcmp(argv[0], "unset")==0){ for (int i=1; argv[i]; i++) var_unset(argv[i]); return 1; }
+
+    if (strcmp(argv[0], "read")==0){ (void)builtin_read(argv); return 1; }
+
+    if (strcmp(argv[0], "echo")==0 && builtin_echo(argv)) return 1;
+
+    if (strcmp(argv[0], "coproc")==0){ (void)builtin_coproc(argv); return 1; }
+
     if (strcmp(argv[0], "bg")==0){
         job_t *j=NULL;
         if (argv[1]){
@@ -405,8 +1297,253 @@ static int try_builtins(char **argv){
     return 0;
 }
 
+/* --------------------- Pipe statistics --------------------- */
+/* With MYSH_PIPESTATS set (to anything but 0), the shell watches a
+   foreground pipeline while it runs instead of just waiting for it.  Every
+   PIPESTAT_MS it samples how full each pipe between stages is, with
+   FIONREAD on its own copy of the read end, and each stage's state, CPU
+   time and bytes written from /proc/PID/stat and /proc/PID/io.  For each
+   pipe that gives the throughput, the average fill, and the fraction of
+   samples in which the writer was asleep on a full pipe (blocked) or the
+   reader asleep on an empty one (starved).  A stage that the one before it
+   is blocked on and the one after it is starved by is the bottleneck.
+
+   The report goes to stderr when the pipeline finishes or stops, and with
+   MYSH_PIPESTATS=live also every PIPESTAT_LIVE_MS, for the interval since
+   the last one.  Bytes written count everything a stage writes (stderr
+   too), not only what goes into its pipe.
+
+   The shell's read end would keep a pipe open after its reader exits, so
+   it is closed as soon as the reader is reaped: the writer then gets
+   SIGPIPE as usual, at most one interval late. */
+#ifndef F_GETPIPE_SZ
+#define F_GETPIPE_SZ 1032           /* Linux: hidden by _POSIX_C_SOURCE */
+#endif
+
+typedef struct {
+    pid_t pid;
+    int   alive;
+    char  state;                    /* R, S, D, ... from /proc/PID/stat */
+    unsigned long long cpu_ticks;   /* utime + stime, with reaped children's */
+    unsigned long long wchar;       /* bytes written, to any file */
+} stage_stat_t;
+
+typedef struct {
+    int   fd, cap;                  /* the shell's read end (-1 once closed), capacity */
+    unsigned long long fill_sum;    /* FIONREAD, summed over samples */
+    unsigned long samples, blocked, starved;
+} pipe_stat_t;
+
+/* read a small /proc file; its length, or -1 */
+static ssize_t proc_read(pid_t pid, const char *what, char *buf, size_t n){
+    char path[64], num[16]; int i = 0;
+    unsigned v = (unsigned)pid;
+    do { num[i++] = (char)('0' + v%10); v /= 10; } while (v && i<15);
+    s_ncpy(path, "/proc/", sizeof(path));
+    size_t L = strlen(path);
+    while (i) path[L++] = num[--i];
+    path[L] = '\0';
+    s_cat(path, sizeof(path), what);
+
+    int fd = open(path, O_RDONLY);
+    if (fd<0) return -1;
+    ssize_t r = read(fd, buf, n-1);
+    close(fd);
+    if (r<0) return -1;
+    buf[r] = '\0';
+    return r;
+}
+
+static void stage_sample(stage_stat_t *st){
+    char buf[1024];
+    if (proc_read(st->pid, "/stat", buf, sizeof(buf)) > 0){
+        char *p = strrchr(buf, ')');      /* the command name may hold anything */
+        if (p && p[1]==' ' && p[2]){
+            st->state = p[2];
+            p += 3;
+            for (int f=4; f<14 && p; f++) p = strchr(p+1, ' ');   /* to utime, field 14 */
+            if (p){
+                char *end;
+                unsigned long long t = strtoull(p, &end, 10);
+                for (int f=15; f<=17; f++) t += strtoull(end, &end, 10);  /* stime, and the reaped children's: par's replicas */
+                st->cpu_ticks = t;
+            }
+        }
+    }
+    if (proc_read(st->pid, "/io", buf, sizeof(buf)) > 0){
+        char *w = strstr(buf, "wchar:");
+        if (w) st->wchar = strtoull(w + 6, NULL, 10);
+    }
+}
+
+static double elapsed_since(const struct timespec *t0){
+    struct timespec t; clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)(t.tv_sec - t0->tv_sec) + (double)(t.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* append v with dec decimals, right-aligned in width */
+static void cat_num(char *out, size_t n, double v, int dec, int width){
+    char digits[32], num[40]; int k = 0, len = 0;
+    double scale = 1; for (int i=0;i<dec;i++) scale *= 10;
+    unsigned long long x = v > 0 ? (unsigned long long)(v * scale + 0.5) : 0;
+    do { digits[k++] = (char)('0' + x%10); x /= 10; } while ((x || k <= dec) && k < 30);
+    while (k > 0){ if (k==dec) num[len++] = '.'; num[len++] = digits[--k]; }
+    num[len] = '\0';
+    while (len++ < width) s_cat(out, n, " ");
+    s_cat(out, n, num);
+}
+static void cat_pct(char *out, size_t n, unsigned long part, unsigned long whole, int width){
+    cat_num(out, n, whole ? 100.0 * (double)part / (double)whole : 0, 0, width-1);
+    s_cat(out, n, "%");
+}
+
+/* one line per pipe: throughput, fill, blocked and starved, from the
+   differences between now and before over secs seconds */
+static void pipestat_lines(const char *title, const pipe_stat_t *now, const pipe_stat_t *before,
+                           const unsigned long long *wnow, const unsigned long long *wbefore, int npipes, double secs){
+    char line[256];
+    line[0] = '\0';
+    s_cat(line, sizeof(line), title);
+    s_cat(line, sizeof(line), "   pipe      MB/s  avg fill  writer blocked  reader starved\n");
+    puterr(line);
+    for (int i=0;i<npipes;i++){
+        unsigned long samples = now[i].samples - before[i].samples;
+        double fill = samples ? (double)(now[i].fill_sum - before[i].fill_sum) / (double)samples : 0;
+        char pipe_name[16]; pipe_name[0] = '\0';
+        cat_num(pipe_name, sizeof(pipe_name), i+1, 0, 0); s_cat(pipe_name, sizeof(pipe_name), ">");
+        cat_num(pipe_name, sizeof(pipe_name), i+2, 0, 0);
+        line[0] = '\0';
+        for (size_t k=strlen(pipe_name); k<7; k++) s_cat(line, sizeof(line), " ");
+        s_cat(line, sizeof(line), pipe_name);
+        cat_num(line, sizeof(line), secs > 0 ? (double)(wnow[i] - wbefore[i]) / secs / 1e6 : 0, 1, 10);
+        cat_num(line, sizeof(line), now[i].cap ? 100.0 * fill / now[i].cap : 0, 0, 9); s_cat(line, sizeof(line), "%");
+        cat_pct(line, sizeof(line), now[i].blocked - before[i].blocked, samples, 16);
+        cat_pct(line, sizeof(line), now[i].starved - before[i].starved, samples, 16);
+        s_cat(line, sizeof(line), "\n");
+        puterr(line);
+    }
+}
+
+static void pipestat_report(const stage_stat_t *st, const pipe_stat_t *ps, char **stage_argv[], int nstages, double secs, int stopped){
+    char line[256];
+    long hz = sysconf(_SC_CLK_TCK);
+    unsigned long long w[MAX_CMDS], zero[MAX_CMDS];
+    pipe_stat_t none[MAX_CMDS];
+    memset(w, 0, sizeof(w)); memset(zero, 0, sizeof(zero)); memset(none, 0, sizeof(none));
+
+    line[0] = '\0';
+    s_cat(line, sizeof(line), "pipestats: ");
+    cat_num(line, sizeof(line), secs, 2, 0);
+    s_cat(line, sizeof(line), stopped ? " s (stopped)\n" : " s\n");
+    s_cat(line, sizeof(line), "  stage   cpu s   cpu%  command\n");
+    puterr(line);
+    for (int s=0;s<nstages;s++){
+        double cpu = hz > 0 ? (double)st[s].cpu_ticks / (double)hz : 0;
+        line[0] = '\0';
+        cat_num(line, sizeof(line), s+1, 0, 7);
+        cat_num(line, sizeof(line), cpu, 2, 8);
+        cat_num(line, sizeof(line), secs > 0 ? 100.0 * cpu / secs : 0, 0, 6); s_cat(line, sizeof(line), "%  ");
+        for (int k=0; stage_argv[s][k]; k++){ if (k) s_cat(line, sizeof(line), " "); s_cat(line, sizeof(line), stage_argv[s][k]); }
+        s_cat(line, sizeof(line), "\n");
+        puterr(line);
+    }
+    for (int i=0;i<nstages-1;i++) w[i] = st[i].wchar;
+    pipestat_lines("", ps, none, w, zero, nstages-1, secs);
+
+    /* the bottleneck: the stage whose writer waits on it and whose reader
+       waits for it, as a fraction of the samples (one side at the ends) */
+    int worst = -1; double worst_score = 0;
+    for (int s=0;s<nstages;s++){
+        double score = 0; int sides = 0;
+        if (s>0 && ps[s-1].samples){ score += (double)ps[s-1].blocked / (double)ps[s-1].samples; sides++; }
+        if (s<nstages-1 && ps[s].samples){ score += (double)ps[s].starved / (double)ps[s].samples; sides++; }
+        if (sides && score / sides > worst_score){ worst_score = score / sides; worst = s; }
+    }
+    line[0] = '\0';
+    if (ps[0].samples < 10){
+        s_cat(line, sizeof(line), "  too short to tell where the bottleneck is\n");
+    }else if (worst < 0 || worst_score < 0.5){
+        s_cat(line, sizeof(line), "  no stage holds the others back most of the time\n");
+    }else{
+        double cpu = hz > 0 ? (double)st[worst].cpu_ticks / (double)hz : 0;
+        s_cat(line, sizeof(line), "  bottleneck: stage ");
+        cat_num(line, sizeof(line), worst+1, 0, 0);
+        s_cat(line, sizeof(line), " (");
+        s_cat(line, sizeof(line), stage_argv[worst][0]);
+        s_cat(line, sizeof(line), secs > 0 && cpu / secs > 0.8 ? "), CPU-bound\n" : "), not CPU-bound: waiting on something else\n");
+    }
+    puterr(line);
+}
+
+/* wait for a foreground pipeline as launch_pipeline does, sampling it
+   meanwhile; rfd[] are the shell's read ends, which are closed here */
+static void pipestat_wait(pid_t pgid, const pid_t pids[], int rfd[], char **stage_argv[], int nstages, int live, int *stopped){
+    stage_stat_t st[MAX_CMDS];
+    pipe_stat_t ps[MAX_CMDS], ps_live[MAX_CMDS];
+    unsigned long long w_live[MAX_CMDS], w_now[MAX_CMDS];
+    int left = nstages, npipes = nstages - 1;
+    struct timespec t0, tick = { 0, PIPESTAT_MS * 1000000L };
+    double last_live = 0;
+
+    memset(st, 0, sizeof(st)); memset(ps, 0, sizeof(ps));
+    memset(w_live, 0, sizeof(w_live));
+    for (int s=0;s<nstages;s++){ st[s].pid = pids[s]; st[s].alive = 1; }
+    for (int i=0;i<npipes;i++){
+        ps[i].fd = rfd[i];
+        ps[i].cap = fcntl(rfd[i], F_GETPIPE_SZ);
+        if (ps[i].cap <= 0) ps[i].cap = 65536;
+    }
+    memcpy(ps_live, ps, sizeof(ps));
+
+    /* the SIGCHLD handler would reap stages from under us: take the signal here instead */
+    sigset_t chld, old;
+    sigemptyset(&chld); sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (left > 0 && !*stopped){
+        for (int s=0;s<nstages;s++) if (st[s].alive) stage_sample(&st[s]);
+        for (int i=0;i<npipes;i++){
+            int fill = 0;
+            if (ps[i].fd<0 || ioctl(ps[i].fd, FIONREAD, &fill)<0) continue;
+            ps[i].fill_sum += (unsigned)fill; ps[i].samples++;
+            if (st[i].alive && st[i].state=='S' && fill + PIPE_BUF > ps[i].cap) ps[i].blocked++;
+            if (st[i+1].alive && st[i+1].state=='S' && fill==0) ps[i].starved++;
+        }
+
+        /* reap what has finished, sampling each one last while it's a zombie */
+        for (;;){
+            siginfo_t si; int status, s;
+            memset(&si, 0, sizeof(si));
+            if (waitid(P_PGID, (id_t)pgid, &si, WEXITED|(interactive ? WSTOPPED : 0)|WNOHANG|WNOWAIT)<0 || si.si_pid==0) break;
+            for (s=0; s<nstages && pids[s]!=si.si_pid; s++) { /* find it */ }
+            if (si.si_code==CLD_STOPPED){ (void)waitpid(si.si_pid, &status, WUNTRACED); *stopped = 1; break; }
+            if (s<nstages){ stage_sample(&st[s]); st[s].alive = 0; left--; }
+            (void)waitpid(si.si_pid, &status, 0);
+            if (s>0 && s<nstages && ps[s-1].fd>=0){ close(ps[s-1].fd); ps[s-1].fd = -1; }
+        }
+
+        double now = elapsed_since(&t0);
+        if (live && left > 0 && now - last_live >= PIPESTAT_LIVE_MS / 1000.0){
+            char title[64]; title[0] = '\0';
+            s_cat(title, sizeof(title), "pipestats: at ");
+            cat_num(title, sizeof(title), now, 1, 0);
+            s_cat(title, sizeof(title), " s\n");
+            for (int i=0;i<npipes;i++) w_now[i] = st[i].wchar;
+            pipestat_lines(title, ps, ps_live, w_now, w_live, npipes, now - last_live);
+            memcpy(ps_live, ps, sizeof(ps)); memcpy(w_live, w_now, sizeof(w_now));
+            last_live = now;
+        }
+        if (left > 0 && !*stopped) (void)sigtimedwait(&chld, NULL, &tick);
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    for (int i=0;i<npipes;i++) if (ps[i].fd>=0) close(ps[i].fd);
+    pipestat_report(st, ps, stage_argv, nstages, elapsed_since(&t0), *stopped);
+}
+
 /* --------------------- Pipelines (n-stage) --------------------- */
-static pid_t launch_pipeline(char *stage_strs[], int nstages, const char *cmdline, int background, pid_t *out_pgid){
+static pid_t launch_pipeline(char **stage_argv[], int nstages, const char *cmdline, int background, pid_t *out_pgid){
     int pipes[MAX_CMDS-1][2];
     for (int i=0;i<nstages-1;i++){
         if (pipe(pipes[i])<0){
@@ -416,11 +1553,18 @@ static pid_t launch_pipeline(char *stage_strs[], int nstages, const char *cmdlin
         }
     }
 
-    pid_t pgid = 0; int started=0;
+    const char *stats = var_get("MYSH_PIPESTATS");
+    int sampled = !background && nstages > 1 && stats && *stats && strcmp(stats, "0")!=0;
+    pid_t pgid = 0, pids[MAX_CMDS]; int started=0;
+
+    /* a script's foreground pipeline stays in the shell's process group,
+       where it can read the terminal; background ones are tracked as jobs
+       by a group of their own */
+    int own_group = interactive || background;
+    if (!own_group) pgid = getpgrp();
 
     for (int s=0;s<nstages;s++){
-        char *argv[MAX_ARGS];
-        parse_argv(stage_strs[s], argv);
+        char **argv = stage_argv[s];
         if (!argv[0]){ puterr("mysh: empty command in pipeline\n"); break; }
 
         pid_t pid = fork();
@@ -428,7 +1572,8 @@ static pid_t launch_pipeline(char *stage_strs[], int nstages, const char *cmdlin
 
         if (pid==0){
             if (pgid==0) pgid=getpid();
-            setpgid(0, pgid);
+            if (own_group) setpgid(0, pgid);
+            if (!interactive && background && s==0) detach_stdin();
 
             if (s>0)           (void)dup2(pipes[s-1][0], STDIN_FILENO);
             if (s<nstages-1)   (void)dup2(pipes[s][1],   STDOUT_FILENO);
@@ -437,27 +1582,42 @@ static pid_t launch_pipeline(char *stage_strs[], int nstages, const char *cmdlin
             exec_simple(argv);
         }else{
             if (pgid==0) pgid=pid;
-            setpgid(pid, pgid);
-            started++;
+            if (own_group) setpgid(pid, pgid);
+            pids[started++] = pid;
         }
     }
 
-    for (int i=0;i<nstages-1;i++){ close(pipes[i][0]); close(pipes[i][1]); }
+    /* pipe statistics keep the read ends, to see how full each pipe is */
+    int rfd[MAX_CMDS];
+    for (int i=0;i<nstages-1;i++){
+        rfd[i] = pipes[i][0];
+        if (!sampled || started != nstages) close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
 
     if (started != nstages){
-        if (pgid>0) kill(-pgid, SIGTERM);
+        if (own_group && pgid>0) kill(-pgid, SIGTERM);
+        else for (int i=0;i<started;i++) kill(pids[i], SIGTERM);   /* not the shell's own group */
         return -1;
     }
 
-    if (!background){
+    if (sampled){
+        int stopped = 0;
         give_terminal_to(pgid);
-        int status; pid_t w;
-        do {
-            w = waitpid(-pgid, &status, WUNTRACED);
-            if (w==-1){ if (errno==EINTR) continue; if (errno==ECHILD) break; break; }
-        } while (!(WIFEXITED(status)||WIFSIGNALED(status)||WIFSTOPPED(status)));
+        pipestat_wait(pgid, pids, rfd, stage_argv, nstages, strcmp(stats, "live")==0, &stopped);
         give_terminal_to(shell_pgid);
-        if (WIFSTOPPED(status)) (void)add_job(pgid, 0, cmdline);
+        if (stopped) (void)add_job(pgid, 0, cmdline);
+    }else if (!background){
+        give_terminal_to(pgid);
+        int status = 0, left = started, stopped = 0; pid_t w;
+        while (left > 0 && !stopped){   /* every stage, not just the first to finish */
+            w = waitpid(-pgid, &status, fg_wait_flags());
+            if (w==-1){ if (errno==EINTR) continue; break; }
+            if (WIFSTOPPED(status)) stopped = 1;
+            else if (WIFEXITED(status)||WIFSIGNALED(status)) left--;
+        }
+        give_terminal_to(shell_pgid);
+        if (stopped) (void)add_job(pgid, 0, cmdline);
     }else{
         (void)add_job(pgid, 1, cmdline);
     }
@@ -466,8 +1626,356 @@ static pid_t launch_pipeline(char *stage_strs[], int nstages, const char *cmdlin
     return pgid;
 }
 
+/* --------------------- One command line --------------------- */
+/* run a parsed line: a builtin, a single command or a pipeline.
+   2 = exit requested, otherwise 0 */
+static int run_line(char **stage_argv[], int nstages, const char *cmdline, int background){
+    /* expand $VARs, then globs, into new argv vectors (the words may be in
+       a read-only script image); strings made here are in owned */
+    strvec_t words[MAX_CMDS], owned = { NULL, 0, 0 };
+    char **xstage[MAX_CMDS], *none[1] = { NULL };
+    int ok = 1;
+    memset(words, 0, sizeof(words));
+    glob_gen++;                         /* cached listings get checked again */
+
+    for (int s=0;s<nstages;s++){
+        for (int k=0; stage_argv[s][k] && ok; k++){
+            char *x = expand_word(stage_argv[s][k]);
+            if (x && sv_push(&owned, x)<0){ free(x); ok = 0; break; }
+            if (!x) x = stage_argv[s][k];
+
+            size_t before = words[s].n;
+            if (has_glob_meta(x)) glob_expand(x, &words[s], &owned);
+            if (words[s].n == before && sv_push(&words[s], x)<0) ok = 0;   /* no match: the word as is */
+        }
+        xstage[s] = words[s].v ? words[s].v : none;
+    }
+
+    int r = 0;
+    if (!ok) puterr("mysh: out of memory\n");
+    else {
+        (void)var_envp();   /* build it here, if it has changed, rather than in every child */
+        r = run_expanded(xstage, nstages, cmdline, background);
+    }
+
+    for (size_t i=0;i<owned.n;i++) free(owned.v[i]);
+    free(owned.v);
+    for (int s=0;s<nstages;s++) free(words[s].v);
+    return r;
+}
+
+static int run_expanded(char **stage_argv[], int nstages, const char *cmdline, int background){
+    if (nstages==1){
+        char **argv = stage_argv[0];
+        if (!argv[0]) return 0;
+
+        int k=0;
+        while (argv[k] && is_assignment(argv[k])) k++;
+        if (!argv[k]){                  /* only assignments: shell variables */
+            for (k=0; argv[k]; k++){ size_t n = var_name_len(argv[k]); (void)var_set(argv[k], n, argv[k]+n+1, 0); }
+            return 0;
+        }
+
+        int br = try_builtins(argv);
+        if (br == 1) return 0;   /* handled */
+        if (br == 2) return 2;   /* exit requested */
+
+        pid_t pid = fork();
+        if (pid<0){ puterr("mysh: fork failed\n"); return 0; }
+
+        /* as in launch_pipeline: only with job control, or in the background,
+           does a command get a process group of its own */
+        if (pid==0){
+            if (interactive || background) setpgid(0,0);
+            if (!interactive && background) detach_stdin();
+            if (!background) give_terminal_to(getpid());
+            exec_simple(argv);
+        }else{
+            if (interactive || background) setpgid(pid, pid);
+            if (!background){
+                give_terminal_to(pid);
+                int status; pid_t w;
+                do {
+                    w = waitpid(pid, &status, fg_wait_flags());
+                    if (w==-1){ if (errno==EINTR) continue; break; }
+                } while (!(WIFEXITED(status)||WIFSIGNALED(status)||WIFSTOPPED(status)));
+                give_terminal_to(shell_pgid);
+                if (w!=-1 && WIFSTOPPED(status)) (void)add_job(pid, 0, cmdline);
+            }else{
+                (void)add_job(pid, 1, cmdline);
+            }
+        }
+    }else{
+        (void)launch_pipeline(stage_argv, nstages, cmdline, background, NULL);
+    }
+    return 0;
+}
+
+/* --------------------- Scripts + AST cache --------------------- */
+/* "mysh script" runs the script's lines as if typed, without prompts or
+   terminal handling.  Parsing happens once: the script is compiled into a
+   flat image of its commands (argv strings already split) and the image is
+   cached in $MYSH_CACHE (default ~/.cache/mysh), keyed by the script's
+   path, device, inode, size and mtime.  A later run that finds a matching
+   cache file just maps it read-only and runs it.
+
+   Image layout (all offsets are 32-bit; cmd/stage/argv/string offsets are
+   relative to the data section):
+     ast_header_t | ast_cmd_t[ncmds] | data: stage tables, argv offset
+     tables, NUL-terminated strings | '\0'                              */
+#define AST_MAGIC   "myshast"
+#define AST_VERSION 1
+
+typedef struct {
+    char     magic[8];
+    uint32_t version, ncmds;
+    int64_t  dev, ino, size, mtime_sec, mtime_nsec;
+    uint32_t path;                  /* the script's absolute path, in data */
+    uint32_t cmds_off, data_off;    /* from the start of the image */
+    uint32_t data_len;
+} ast_header_t;
+typedef struct { uint32_t line, background, nstages, stages; } ast_cmd_t;
+typedef struct { uint32_t argc, argv; } ast_stage_t;   /* argv: uint32_t[argc] string offsets */
+
+typedef struct { char *buf; size_t len, cap; } blob_t;
+
+/* append n zeroed bytes at a 4-byte boundary; returns their offset */
+static uint32_t blob_reserve(blob_t *b, size_t n){
+    size_t off = (b->len + 3) & ~(size_t)3;
+    if (off + n > b->cap){
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < off + n) cap *= 2;
+        char *p = realloc(b->buf, cap);
+        if (!p || cap > UINT32_MAX){ puterr("mysh: script too large\n"); _exit(1); }
+        b->buf = p; b->cap = cap;
+    }
+    memset(b->buf + b->len, 0, off + n - b->len);
+    b->len = off + n;
+    return (uint32_t)off;
+}
+static uint32_t blob_str(blob_t *b, const char *str){
+    size_t n = strlen(str) + 1;
+    uint32_t off = blob_reserve(b, n);
+    memcpy(b->buf + off, str, n);
+    return off;
+}
+
+/* parse script text (modified in place) into cmds and data; returns the command count */
+static uint32_t ast_compile(char *text, blob_t *cmds, blob_t *data){
+    uint32_t n = 0;
+    char *line = text;
+    while (line){
+        char *nl = strchr(line, '\n'), *next = NULL;
+        if (nl){ *nl = '\0'; next = nl + 1; }
+        trim_trailing(line); skip_ws(&line);
+
+        ast_cmd_t cmd; memset(&cmd, 0, sizeof(cmd));
+        size_t L = strlen(line);
+        if (L>0 && line[L-1]=='&'){ cmd.background = 1; line[L-1]='\0'; trim_trailing(line); }
+        if (*line && *line!='#'){
+            uint32_t c = blob_reserve(cmds, sizeof(ast_cmd_t));
+            cmd.line = blob_str(data, line);
+
+            char *stages[MAX_CMDS];
+            int ns = split_pipeline(line, stages, MAX_CMDS);
+            cmd.nstages = (uint32_t)ns;
+            cmd.stages = blob_reserve(data, ns * sizeof(ast_stage_t));
+            for (int s=0;s<ns;s++){
+                char *argv[MAX_ARGS];
+                ast_stage_t st;
+                st.argc = (uint32_t)parse_argv(stages[s], argv);
+                st.argv = blob_reserve(data, st.argc * sizeof(uint32_t));
+                for (uint32_t k=0;k<st.argc;k++){
+                    uint32_t off = blob_str(data, argv[k]);
+                    memcpy(data->buf + st.argv + k*sizeof(uint32_t), &off, sizeof(off));
+                }
+                memcpy(data->buf + cmd.stages + s*sizeof(ast_stage_t), &st, sizeof(st));
+            }
+            memcpy(cmds->buf + c, &cmd, sizeof(cmd));
+            n++;
+        }
+        line = next;
+    }
+    return n;
+}
+
+/* cache file name for the script at abs; -1 if there's nowhere to put it */
+static int ast_cache_path(const char *abs, char *out, size_t n){
+    const char *dir = var_get("MYSH_CACHE");
+    out[0] = '\0';
+    if (dir){
+        s_cat(out, n, dir);
+    }else{
+        const char *home = var_get("HOME");
+        if (!home) return -1;
+        s_cat(out, n, home); s_cat(out, n, "/.cache");
+        (void)mkdir(out, 0700);
+        s_cat(out, n, "/mysh");
+    }
+    if (mkdir(out, 0700)<0 && errno!=EEXIST) return -1;
+
+    char hex[18]; uint64_t h = fnv1a(abs, strlen(abs));
+    hex[0] = '/';
+    for (int i=0;i<16;i++) hex[1+i] = "0123456789abcdef"[(h >> (60 - 4*i)) & 15];
+    hex[17] = '\0';
+    s_cat(out, n, hex);
+    return s_cat(out, n, ".ast") + 1 < n ? 0 : -1;
+}
+
+static void ast_key(ast_header_t *h, const struct stat *st){
+    h->dev = (int64_t)st->st_dev; h->ino = (int64_t)st->st_ino; h->size = (int64_t)st->st_size;
+    h->mtime_sec = (int64_t)st->st_mtim.tv_sec; h->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+}
+
+/* map a cached image if it's for this version of the script; NULL if not */
+static char *ast_map(const char *cache, const char *abs, const struct stat *st, size_t *len){
+    int fd = open(cache, O_RDONLY);
+    if (fd<0) return NULL;
+    struct stat cs;
+    if (fstat(fd, &cs)<0 || cs.st_size < (off_t)sizeof(ast_header_t)){ close(fd); return NULL; }
+    char *p = mmap(NULL, (size_t)cs.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+
+    ast_header_t h, want;
+    memcpy(&h, p, sizeof(h));
+    ast_key(&want, st);
+    if (memcmp(h.magic, AST_MAGIC, sizeof(h.magic))!=0 || h.version!=AST_VERSION
+        || h.dev!=want.dev || h.ino!=want.ino || h.size!=want.size
+        || h.mtime_sec!=want.mtime_sec || h.mtime_nsec!=want.mtime_nsec
+        || (uint64_t)h.data_off + h.data_len + 1 != (uint64_t)cs.st_size
+        || h.cmds_off + (uint64_t)h.ncmds*sizeof(ast_cmd_t) > h.data_off
+        || h.path >= h.data_len || strcmp(p + h.data_off + h.path, abs)!=0){
+        munmap(p, (size_t)cs.st_size);
+        return NULL;
+    }
+    *len = (size_t)cs.st_size;
+    return p;
+}
+
+/* write the image via a temporary file, so a reader never sees half of one */
+static void ast_store(const char *cache, const ast_header_t *h, const blob_t *cmds, const blob_t *data){
+    char tmp[1024], num[16]; int i=0;
+    unsigned v = (unsigned)getpid();
+    do { num[i++] = (char)('0' + v%10); v/=10; } while (v && i<15);
+    tmp[0] = '\0'; s_cat(tmp, sizeof(tmp), cache); s_cat(tmp, sizeof(tmp), ".");
+    size_t L = strlen(tmp);
+    while (i && L+1<sizeof(tmp)) tmp[L++] = num[--i];
+    tmp[L] = '\0';
+
+    int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+    if (fd<0) return;
+    int ok = write_all(fd, (const char *)h, sizeof(*h))==0
+          && write_all(fd, cmds->buf ? cmds->buf : "", cmds->len)==0
+          && write_all(fd, data->buf, data->len)==0
+          && write_all(fd, "", 1)==0;
+    if (close(fd)<0) ok = 0;
+    if (!ok || rename(tmp, cache)<0) unlink(tmp);
+}
+
+/* run a compiled image; 2 if the script asked to exit */
+static int ast_run(char *img){
+    ast_header_t h; memcpy(&h, img, sizeof(h));
+    const ast_cmd_t *cmds = (const ast_cmd_t *)(void *)(img + h.cmds_off);
+    char *data = img + h.data_off;
+
+    for (uint32_t i=0;i<h.ncmds;i++){
+        ast_cmd_t c = cmds[i];
+        char *argvs[MAX_CMDS][MAX_ARGS];
+        char **stage_argv[MAX_CMDS];
+
+        if (c.nstages<1 || c.nstages>MAX_CMDS || c.line>=h.data_len
+            || c.stages + (uint64_t)c.nstages*sizeof(ast_stage_t) > h.data_len) goto corrupt;
+        for (uint32_t s=0;s<c.nstages;s++){
+            ast_stage_t st; memcpy(&st, data + c.stages + s*sizeof(st), sizeof(st));
+            if (st.argc>=MAX_ARGS || st.argv + (uint64_t)st.argc*sizeof(uint32_t) > h.data_len) goto corrupt;
+            for (uint32_t k=0;k<st.argc;k++){
+                uint32_t off; memcpy(&off, data + st.argv + k*sizeof(off), sizeof(off));
+                if (off>=h.data_len) goto corrupt;
+                argvs[s][k] = data + off;
+            }
+            argvs[s][st.argc] = NULL;
+            stage_argv[s] = argvs[s];
+        }
+
+        reap_done_jobs();
+        if (run_line(stage_argv, (int)c.nstages, data + c.line, (int)c.background) == 2) return 2;
+    }
+    return 0;
+
+corrupt:
+    puterr("mysh: corrupt script cache\n");
+    return 2;
+}
+
+static int run_script(const char *path){
+    char abs[1024], cache[1024];
+    struct stat st;
+
+    abs[0] = '\0';
+    if (path[0]!='/' && getcwd(abs, sizeof(abs)-1)) s_cat(abs, sizeof(abs), "/");
+    s_cat(abs, sizeof(abs), path);
+    if (stat(path, &st)<0){
+        puterr("mysh: cannot open script: "); puterr(path); puterr("\n");
+        return 127;
+    }
+    int cached = ast_cache_path(abs, cache, sizeof(cache)) == 0;
+
+    size_t len;
+    char *img = cached ? ast_map(cache, abs, &st, &len) : NULL;
+    if (img){
+        (void)ast_run(img);
+        munmap(img, len);
+        return 0;
+    }
+
+    /* compile: read the whole script, parse it, cache the image, run it */
+    int fd = open(path, O_RDONLY);
+    if (fd<0 || fstat(fd, &st)<0){ puterr("mysh: cannot open script: "); puterr(path); puterr("\n"); return 127; }
+    char *text = malloc((size_t)st.st_size + 1);
+    size_t got = 0;
+    while (text && got < (size_t)st.st_size){
+        ssize_t n = read(fd, text + got, (size_t)st.st_size - got);
+        if (n<0 && errno==EINTR) continue;
+        if (n<=0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+    if (!text){ puterr("mysh: out of memory\n"); return 1; }
+    text[got] = '\0';
+
+    blob_t cmds = { NULL, 0, 0 }, data = { NULL, 0, 0 };
+    ast_header_t h; memset(&h, 0, sizeof(h));
+    memcpy(h.magic, AST_MAGIC, sizeof(h.magic));
+    h.version = AST_VERSION;
+    ast_key(&h, &st);
+    h.path = blob_str(&data, abs);
+    h.ncmds = ast_compile(text, &cmds, &data);
+    h.cmds_off = sizeof(h);
+    h.data_off = (uint32_t)(sizeof(h) + cmds.len);
+    h.data_len = (uint32_t)data.len;
+    free(text);
+
+    /* the image is run from memory here exactly as it will be from the cache */
+    char *mem = malloc(h.data_off + data.len + 1);
+    if (!mem){ puterr("mysh: out of memory\n"); return 1; }
+    memcpy(mem, &h, sizeof(h));
+    if (cmds.len) memcpy(mem + h.cmds_off, cmds.buf, cmds.len);
+    memcpy(mem + h.data_off, data.buf, data.len);
+    mem[h.data_off + data.len] = '\0';
+    if (cached && got == (size_t)st.st_size) ast_store(cache, &h, &cmds, &data);
+    free(cmds.buf); free(data.buf);
+
+    (void)ast_run(mem);
+    free(mem);
+    return 0;
+}
+
 /* --------------------- Main loop --------------------- */
-int main(void){
+int main(int argc, char **argv){
+    var_init();
+    if (argc > 1) return run_script(argv[1]);
+
     install_shell();
 
     char line[MAX_LINE];
@@ -494,40 +2002,11 @@ int main(void){
         char *stages[MAX_CMDS];
         int nstages = split_pipeline(line, stages, MAX_CMDS);
 
-        if (nstages==1){
-            char *argv[MAX_ARGS];
-            parse_argv(stages[0], argv);
-            if (!argv[0]) continue;
-
-            int br = try_builtins(argv);
-            if (br == 1) continue;   /* handled */
-            if (br == 2) break;      /* exit requested */
+        char *argvs[MAX_CMDS][MAX_ARGS];
+        char **stage_argv[MAX_CMDS];
+        for (int s=0;s<nstages;s++){ parse_argv(stages[s], argvs[s]); stage_argv[s] = argvs[s]; }
 
-            pid_t pid = fork();
-            if (pid<0){ puterr("mysh: fork failed\n"); continue; }
-
-            if (pid==0){
-                setpgid(0,0);
-                if (!background) give_terminal_to(getpid());
-                exec_simple(argv);
-            }else{
-                setpgid(pid, pid);
-                if (!background){
-                    give_terminal_to(pid);
-                    int status; pid_t w;
-                    do {
-                        w = waitpid(pid, &status, WUNTRACED);
-                        if (w==-1){ if (errno==EINTR) continue; break; }
-                    } while (!(WIFEXITED(status)||WIFSIGNALED(status)||WIFSTOPPED(status)));
-                    give_terminal_to(shell_pgid);
-                    if (WIFSTOPPED(status)) (void)add_job(pid, 0, cmdline_copy);
-                }else{
-                    (void)add_job(pid, 1, cmdline_copy);
-                }
-            }
-        }else{
-            (void)launch_pipeline(stages, nstages, cmdline_copy, background, NULL);
-        }
+        if (run_line(stage_argv, nstages, cmdline_copy, background) == 2) break;
     }
 
     /* terminate remaining bg jobs politely */
@@ -0,0 +1,434 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+
+#include "shm_ring.h"
+
+/* move the same message stream between two processes over several
+   transports and measure it:
+
+     pipe          anonymous pipe, write/read (as in ordinary_pipe/pipe_eg1.c)
+     vmsplice      anonymous pipe, sender maps its pages in with vmsplice
+     unix          UNIX domain stream socket (socketpair)
+     shm-futex     shared memory ring (posix_shared_memory/shm_ring.c), futex wakeups
+     shm-eventfd   the same ring, eventfd wakeups
+
+   For each message size, the parent first streams messages to the child
+   and times until the child acknowledges the last one (throughput), then
+   bounces a message of that size off the child repeatedly (round-trip
+   latency percentiles).  Every receiver copies each message into its own
+   buffer, so the transports do the same work.
+*/
+
+#define READ_END  0
+#define WRITE_END 1
+
+#define TO_CHILD 0      /* directions */
+#define TO_PARENT 1
+
+#define MAX_MSG (1 << 20)
+#define RING_BYTES (4 << 20)       /* holds a 1 MiB message (max record = half) */
+#define PIPE_BYTES (1 << 20)
+#define MAX_MSGS 2000000L
+#define MAX_ROUND_TRIPS 20000L
+#define MIN_ROUND_TRIPS 100L
+
+enum { PIPE, VMSPLICE, UNIX_SOCK, SHM_FUTEX, SHM_EVENTFD, NTRANSPORTS };
+
+const char *transport_names[NTRANSPORTS] = { "pipe", "vmsplice", "unix", "shm-futex", "shm-eventfd" };
+
+typedef struct
+{
+    int type;
+    int fd[2][2];               /* per direction: read end, write end */
+    Shm_Ring ring[2];           /* per direction (shm transports) */
+    void *shm;
+    int efd[2][2];              /* per direction: data, space eventfds */
+}
+    Channel;
+
+void channel_open(Channel *c, int type);
+void channel_close(Channel *c);
+void channel_send(Channel *c, int dir, const char *buf, size_t len);
+void channel_recv(Channel *c, int dir, char *buf, size_t len);
+void run_child(Channel *c, size_t *sizes, int nsizes, long total);
+void run_parent(Channel *c, size_t *sizes, int nsizes, long total, int csv);
+long stream_count(size_t size, long total);
+long round_trips(size_t size);
+int cmp_double(const void *a, const void *b);
+double now();
+
+
+int main(int argc, char **argv)
+{
+    size_t sizes[32];
+    int nsizes = 0, opt, csv = 0, t, status;
+    long total = 256L << 20;
+    char *only = 0, *tok;
+    Channel c;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "s:b:T:c")) != -1)
+    {
+	switch (opt)
+	{
+	case 's':     /* comma separated list, k/m suffixes allowed */
+	    for (tok = strtok(optarg, ","); tok && nsizes < 32; tok = strtok(0, ","))
+	    {
+		char *end;
+		size_t n = strtoul(tok, &end, 10);
+
+		if (*end == 'k' || *end == 'K') n <<= 10;
+		if (*end == 'm' || *end == 'M') n <<= 20;
+		if (n >= 8 && n <= MAX_MSG)
+		    sizes[nsizes++] = n;
+	    }
+	    break;
+	case 'b': total = atol(optarg) << 20; break;
+	case 'T': only = optarg; break;
+	case 'c': csv = 1; break;
+	default:
+	    fprintf(stderr, "usage: %s [-s size,size,...] [-b MiB-per-stream] [-T transport,...] [-c]\n"
+		    "  transports: pipe vmsplice unix shm-futex shm-eventfd (default: all)\n"
+		    "  sizes: 8 B to 1M (default: 8 64 512 4k 32k 256k 1M)\n"
+		    "  -c: CSV output\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    if (nsizes == 0)     /* 8 B, 64 B, ... 256k, then 1M */
+    {
+	for (sizes[0] = 8, nsizes = 1; sizes[nsizes - 1] * 8 <= MAX_MSG; nsizes++)
+	    sizes[nsizes] = sizes[nsizes - 1] * 8;
+	sizes[nsizes++] = MAX_MSG;
+    }
+
+    if (csv)
+	printf("transport,size,mb_per_s,msgs_per_s,rtt_p50_us,rtt_p90_us,rtt_p99_us,rtt_p999_us,rtt_max_us\n");
+    else
+	printf("%-12s %8s %10s %12s %9s %9s %9s %9s %9s\n", "transport", "size", "MB/s", "msgs/s",
+	       "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+
+    for (t = 0; t < NTRANSPORTS; t++)
+    {
+	if (only && !strstr(only, transport_names[t]))
+	    continue;
+
+	channel_open(&c, t);
+	fflush(stdout);
+
+	if ((pid = fork()) == -1)
+	{
+	    perror("fork failed");
+	    exit(EXIT_FAILURE);
+	}
+
+	if (pid == 0)
+	{
+	    run_child(&c, sizes, nsizes, total);
+	    _exit(0);
+	}
+
+	run_parent(&c, sizes, nsizes, total, csv);
+	waitpid(pid, &status, 0);
+	channel_close(&c);
+    }
+
+    return 0;
+}
+
+
+void run_parent(Channel *c, size_t *sizes, int nsizes, long total, int csv)
+{
+    char *buf = malloc(MAX_MSG), ack[8];
+    double *rtt = malloc(sizeof(double) * (MAX_ROUND_TRIPS + MIN_ROUND_TRIPS));
+    double start, elapsed;
+    long i, n, r, warm;
+    int s;
+
+    memset(buf, 'x', MAX_MSG);
+
+    for (s = 0; s < nsizes; s++)
+    {
+	n = stream_count(sizes[s], total);
+	r = round_trips(sizes[s]);
+	warm = r / 10;
+
+	start = now();     /* throughput: stream n messages, wait for the ack */
+	for (i = 0; i < n; i++)
+	    channel_send(c, TO_CHILD, buf, sizes[s]);
+	channel_recv(c, TO_PARENT, ack, sizeof(ack));
+	elapsed = now() - start;
+
+	for (i = 0; i < warm + r; i++)     /* latency: ping-pong, first warm trips not recorded */
+	{
+	    start = now();
+	    channel_send(c, TO_CHILD, buf, sizes[s]);
+	    channel_recv(c, TO_PARENT, buf, sizes[s]);
+	    if (i >= warm)
+		rtt[i - warm] = (now() - start) * 1e6;
+	}
+
+	qsort(rtt, r, sizeof(double), cmp_double);
+
+	printf(csv ? "%s,%zu,%.1f,%.0f,%.2f,%.2f,%.2f,%.2f,%.2f\n"
+	           : "%-12s %8zu %10.1f %12.0f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+	       transport_names[c->type], sizes[s], n * sizes[s] / elapsed / 1e6, n / elapsed,
+	       rtt[r / 2], rtt[r * 90 / 100], rtt[r * 99 / 100], rtt[r * 999 / 1000], rtt[r - 1]);
+	fflush(stdout);
+    }
+
+    free(buf);
+    free(rtt);
+}
+
+
+void run_child(Channel *c, size_t *sizes, int nsizes, long total)     /* mirrors run_parent */
+{
+    char *buf = malloc(MAX_MSG), ack[8] = "done";
+    long i, n, r;
+    int s;
+
+    for (s = 0; s < nsizes; s++)
+    {
+	n = stream_count(sizes[s], total);
+	r = round_trips(sizes[s]);
+
+	for (i = 0; i < n; i++)
+	    channel_recv(c, TO_CHILD, buf, sizes[s]);
+	channel_send(c, TO_PARENT, ack, sizeof(ack));
+
+	for (i = 0; i < r / 10 + r; i++)
+	{
+	    channel_recv(c, TO_CHILD, buf, sizes[s]);
+	    channel_send(c, TO_PARENT, buf, sizes[s]);
+	}
+    }
+
+    free(buf);
+}
+
+
+long stream_count(size_t size, long total)
+{
+    long n = total / (long)size;
+
+    return n > MAX_MSGS ? MAX_MSGS : n < MIN_ROUND_TRIPS ? MIN_ROUND_TRIPS : n;
+}
+
+
+long round_trips(size_t size)
+{
+    long r = (64L << 20) / (long)size;
+
+    return r > MAX_ROUND_TRIPS ? MAX_ROUND_TRIPS : r < MIN_ROUND_TRIPS ? MIN_ROUND_TRIPS : r;
+}
+
+
+/* ---- transports ---- */
+
+void channel_open(Channel *c, int type)
+{
+    int d, sv[2];
+    char *base;
+
+    memset(c, 0, sizeof(*c));
+    c->type = type;
+
+    switch (type)
+    {
+    case PIPE:
+    case VMSPLICE:
+	for (d = 0; d < 2; d++)
+	{
+	    if (pipe(c->fd[d]) == -1)
+	    {
+		perror("pipe failed");
+		exit(EXIT_FAILURE);
+	    }
+	    fcntl(c->fd[d][WRITE_END], F_SETPIPE_SZ, PIPE_BYTES);     /* best effort */
+	}
+	break;
+
+    case UNIX_SOCK:
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+	{
+	    perror("socketpair failed");
+	    exit(EXIT_FAILURE);
+	}
+	for (d = 0; d < 2; d++)
+	{
+	    int n = PIPE_BYTES;
+
+	    setsockopt(sv[d], SOL_SOCKET, SO_SNDBUF, &n, sizeof(n));
+	    setsockopt(sv[d], SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
+	}
+	c->fd[TO_CHILD][WRITE_END] = c->fd[TO_PARENT][READ_END] = sv[0];
+	c->fd[TO_CHILD][READ_END] = c->fd[TO_PARENT][WRITE_END] = sv[1];
+	break;
+
+    case SHM_FUTEX:
+    case SHM_EVENTFD:
+	/* one anonymous shared mapping inherited across fork: two ring
+	   headers (a page each), then the two data areas */
+	c->shm = mmap(0, 2 * 4096 + 2 * RING_BYTES, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (c->shm == MAP_FAILED)
+	{
+	    perror("mmap failed");
+	    exit(EXIT_FAILURE);
+	}
+	base = c->shm;
+	for (d = 0; d < 2; d++)
+	{
+	    shm_ring_init(&c->ring[d], (Shm_Ring_Header *)(base + d * 4096),
+			  base + 2 * 4096 + d * RING_BYTES, RING_BYTES);
+
+	    if (type == SHM_EVENTFD)
+	    {
+		c->efd[d][0] = eventfd(0, 0);
+		c->efd[d][1] = eventfd(0, 0);
+		shm_ring_use_eventfd(&c->ring[d], c->efd[d][0], c->efd[d][1]);
+	    }
+	}
+	break;
+    }
+}
+
+
+void channel_close(Channel *c)
+{
+    int d;
+
+    switch (c->type)
+    {
+    case PIPE:
+    case VMSPLICE:
+	for (d = 0; d < 2; d++)
+	{
+	    close(c->fd[d][READ_END]);
+	    close(c->fd[d][WRITE_END]);
+	}
+	break;
+    case UNIX_SOCK:
+	close(c->fd[TO_CHILD][READ_END]);
+	close(c->fd[TO_CHILD][WRITE_END]);
+	break;
+    case SHM_EVENTFD:
+	for (d = 0; d < 2; d++)
+	{
+	    close(c->efd[d][0]);
+	    close(c->efd[d][1]);
+	}
+	/* fall through */
+    case SHM_FUTEX:
+	munmap(c->shm, 2 * 4096 + 2 * RING_BYTES);
+	break;
+    }
+}
+
+
+void channel_send(Channel *c, int dir, const char *buf, size_t len)
+{
+    struct iovec iov;
+    ssize_t n;
+
+    switch (c->type)
+    {
+    case SHM_FUTEX:
+    case SHM_EVENTFD:
+	shm_ring_send(&c->ring[dir], buf, len);
+	return;
+
+    case VMSPLICE:
+	/* the pipe references our pages rather than copying them, so the
+	   sender mustn't change buf until it's read; the benchmark never
+	   does (its payload is constant) */
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+	while (iov.iov_len > 0)
+	{
+	    if ((n = vmsplice(c->fd[dir][WRITE_END], &iov, 1, 0)) == -1)
+	    {
+		if (errno == EINTR)
+		    continue;
+		perror("vmsplice failed");
+		exit(EXIT_FAILURE);
+	    }
+	    iov.iov_base = (char *)iov.iov_base + n;
+	    iov.iov_len -= n;
+	}
+	return;
+
+    default:
+	while (len > 0)
+	{
+	    if ((n = write(c->fd[dir][WRITE_END], buf, len)) == -1)
+	    {
+		if (errno == EINTR)
+		    continue;
+		perror("write failed");
+		exit(EXIT_FAILURE);
+	    }
+	    buf += n;
+	    len -= n;
+	}
+    }
+}
+
+
+void channel_recv(Channel *c, int dir, char *buf, size_t len)
+{
+    ssize_t n;
+
+    if (c->type == SHM_FUTEX || c->type == SHM_EVENTFD)
+    {
+	if (shm_ring_recv(&c->ring[dir], buf, len) != (ssize_t)len)
+	{
+	    perror("shm_ring_recv failed");
+	    exit(EXIT_FAILURE);
+	}
+	return;
+    }
+
+    while (len > 0)     /* byte streams: read exactly len */
+    {
+	if ((n = read(c->fd[dir][READ_END], buf, len)) <= 0)
+	{
+	    if (n == -1 && errno == EINTR)
+		continue;
+	    perror("read failed");
+	    exit(EXIT_FAILURE);
+	}
+	buf += n;
+	len -= n;
+    }
+}
+
+
+int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
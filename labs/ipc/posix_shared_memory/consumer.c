@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/mman.h>
 #include <fcntl.h>
@@ -7,39 +9,136 @@
 #include <sys/types.h>
 
 #include "shared.h"
+#include "shm_segment.h"
+#include "evlog.h"
 
 void consume_item(Item item);
+uint64_t checksum(const char *p, size_t len);
+size_t walk_record(Shared_Data *shared_data, shm_off_t off, Item *item, uint64_t *sum);
+Shared_Data *attach(int seg_flags, size_t *size);
+double now();
 
-int main()
+int main(int argc, char **argv)
 {
-    Item item;
-    int fd;
+    Item item, expected = 0;
     Shared_Data *shared_data;
+    Shm_Ring ring;
+    const char *msg;
+    char *payload;
+    uint32_t len;
+    uint64_t sum = 0;
+    size_t size, max, bytes = 0;
+    long errors = 0;
+    int opt, seg_flags = 0, copy = 0, work = 0, verbose = 0, ev_consume;
+    double start;
+
+    while ((opt = getopt(argc, argv, "HPLcwv")) != -1)
+    {
+	switch (opt)
+	{
+	case 'H': seg_flags |= SHM_SEG_HUGE; break;
+	case 'P': seg_flags |= SHM_SEG_POPULATE; break;
+	case 'L': seg_flags |= SHM_SEG_LOCK; break;
+	case 'c': copy = 1; break;
+	case 'w': work = 1; break;
+	case 'v': verbose = 1; break;
+	default:
+	    fprintf(stderr, "usage: %s [-H] [-P] [-L] [-c] [-w] [-v]   (see producer for meanings)\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
 
     srandom(time(NULL));     /* seed random number generator */
 
-    /* (1) open pre-exiting shared member object (created by producer)
-       (2) map it into this process's addrss space starting at address "shared_data"
+    evlog_init(STDOUT_FILENO, 100);     /* log from the loop without stdio */
+    evlog_thread_start("consumer");
+    ev_consume = evlog_event("consuming item");
+
+    /* (1) open the shared memory object created by the producer
+       (2) map it into this process's address space starting at address "shared_data"
+       (3) attach to the ring once the producer has initialized it
     */
 
-    fd = shm_open("prodcon", O_RDWR, 0666);
-    shared_data = mmap(0, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    shared_data = attach(seg_flags, &size);
+    shm_ring_attach(&ring, &shared_data->ring, (char *)shared_data + shared_data->ring_off);
+
+    max = shm_ring_max_record(&ring);
+    payload = malloc(max);
+
+    start = now();
 
-    while (1)     /* repeatedly (forever) dequeue and consume items from the bounded buffer */
+    while (1)     /* dequeue until the producer closes the ring */
     {
-	while (shared_data->in == shared_data->out)
-	    ;     /* do nothing - busy wait if buffer empty */
+	if (copy)
+	{
+	    ssize_t n = shm_ring_recv(&ring, payload, max);     /* copy out, slot freed at once */
+
+	    if (n == -1)
+		break;
+	    msg = payload;
+	    len = n;
+	}
+	else if ((msg = shm_ring_acquire(&ring, &len)) == 0)     /* read in place */
+	    break;
+
+	if (shared_data->mode == MODE_RECORDS)     /* the message is just the record's offset */
+	{
+	    shm_off_t off;
+
+	    memcpy(&off, msg, sizeof(off));
+	    len = walk_record(shared_data, off, &item, &sum);
+	}
+	else
+	{
+	    memcpy(&item, msg, sizeof(item));
+	    sum += checksum(msg, len);
+	}
+
+	if (item != expected)
+	    errors++;
+	expected = item + 1;
+	bytes += len;
+
+	if (verbose)
+	    evlog(ev_consume, item);
+
+	if (work)
+	    consume_item(item);
 
-	item = shared_data->buffer[shared_data->out];                /* dequeue */
-	shared_data->out = (shared_data->out + 1) % BUFFER_SIZE;
+	if (!copy)
+	    shm_ring_release(&ring, msg);     /* only now may the producer reuse the space */
+    }
+
+    evlog_shutdown();
+
+    printf("consumed %lu items, %zu bytes in %.3f s (%.1f MB/s), %ld sequence errors, checksum %lx\n",
+	   (unsigned long)expected, bytes, now() - start, bytes / (now() - start) / 1e6, errors,
+	   (unsigned long)sum);
 
-	printf("consuming item %d\n", item);
+    shm_segment_unmap(shared_data, size);
+    shm_segment_unlink(SHARED_MEMORY_NAME, seg_flags);
+    return errors != 0;
+}
+
+Shared_Data *attach(int seg_flags, size_t *size)     /* wait for the producer to publish the segment */
+{
+    Shared_Data *shared_data;
+    struct timespec t = { 0, 10000000L };
 
-	consume_item(item);
+    while ((shared_data = shm_segment_open(SHARED_MEMORY_NAME, size, seg_flags)) == 0)
+    {
+	if (errno != ENOENT && errno != EAGAIN)
+	{
+	    perror("shm_segment_open");
+	    exit(EXIT_FAILURE);
+	}
+	nanosleep(&t, 0);
     }
-    
-    /* not reached */
-    return 0;
+
+    while (atomic_load_explicit(&shared_data->magic, memory_order_acquire) != SHARED_MAGIC)
+	nanosleep(&t, 0);
+
+    return shared_data;
 }
 
 void consume_item(Item item)
@@ -49,5 +148,72 @@ void consume_item(Item item)
     /* simulate some time-consuming, variable-time item consumption process */
 
     for (i = 0L; i < upper; i++)
-	;
+	__asm__ volatile ("");
+}
+
+/* read a record built by the producer in the arena, in place, then free
+   it; returns the bytes of field values it held
+*/
+
+size_t walk_record(Shared_Data *shared_data, shm_off_t off, Item *item, uint64_t *sum)
+{
+    Shm_Record *rec = SHM_PTR(shared_data, off);
+    Shm_Field *field;
+    shm_off_t next;
+    size_t len, bytes = 0;
+    char *s;
+
+    *item = rec->item;
+
+    for (next = rec->fields; next != SHM_NULL; next = field->next)
+    {
+	field = SHM_PTR(shared_data, next);
+
+	s = SHM_PTR(shared_data, field->key);
+	*sum += checksum(s, strlen(s));
+
+	s = SHM_PTR(shared_data, field->value);
+	len = strlen(s);
+	*sum += checksum(s, len);
+	bytes += len;
+    }
+
+    for (next = rec->fields; next != SHM_NULL; )
+    {
+	field = SHM_PTR(shared_data, next);
+	shm_arena_free(&shared_data->arena, shared_data, field->key);
+	shm_arena_free(&shared_data->arena, shared_data, field->value);
+	off = next;
+	next = field->next;
+	shm_arena_free(&shared_data->arena, shared_data, off);
+    }
+
+    shm_arena_free(&shared_data->arena, shared_data, rec->name);
+    shm_arena_free(&shared_data->arena, shared_data, SHM_OFF(shared_data, rec));
+    return bytes;
+}
+
+uint64_t checksum(const char *p, size_t len)     /* stands in for processing the payload */
+{
+    uint64_t sum = 0, w;
+    size_t i;
+
+    for (i = 0; i + sizeof(w) <= len; i += sizeof(w))
+    {
+	memcpy(&w, p + i, sizeof(w));
+	sum += w;
+    }
+
+    for (; i < len; i++)
+	sum += (unsigned char)p[i];
+
+    return sum;
+}
+
+double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
 }
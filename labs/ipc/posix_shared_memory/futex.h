@@ -0,0 +1,40 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* process-shared futex wait/wake on a 32-bit word that lives in shared
+   memory (no FUTEX_PRIVATE_FLAG, so the kernel keys the wait queue on the
+   underlying page rather than on this process's address space)
+*/
+
+static inline void futex_wait(_Atomic uint32_t *word, uint32_t expected)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, 0, 0, 0);     /* returns at once if *word != expected */
+}
+
+static inline int futex_wait_ms(_Atomic uint32_t *word, uint32_t expected, long ms)     /* -1 on timeout */
+{
+    struct timespec t = { ms / 1000, (ms % 1000) * 1000000L };
+
+    return (int)syscall(SYS_futex, word, FUTEX_WAIT, expected, &t, 0, 0);
+}
+
+static inline void futex_wake(_Atomic uint32_t *word, int nwaiters)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, nwaiters, 0, 0, 0);
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+#endif
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "shared.h"
+#include "shm_segment.h"
+
+/* poll the producer's stats block and print it.  Any number of monitors
+   can run at once; they only read the segment, so the producer never
+   waits for them.
+*/
+
+int main(int argc, char **argv)
+{
+    Shared_Data *shared_data;
+    Shm_Stats s;
+    size_t size;
+    unsigned retries = 0;
+    long interval_ms = 1000;
+    int opt, seg_flags = 0, header = 0;
+    struct timespec t = { 0, 10000000L };
+
+    while ((opt = getopt(argc, argv, "i:H")) != -1)
+    {
+	switch (opt)
+	{
+	case 'i': interval_ms = atol(optarg); break;
+	case 'H': seg_flags |= SHM_SEG_HUGE; break;
+	default:
+	    fprintf(stderr, "usage: %s [-i interval-ms] [-H]\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    while ((shared_data = shm_segment_open(SHARED_MEMORY_NAME, &size, seg_flags)) == 0)
+    {
+	if (errno != ENOENT && errno != EAGAIN)
+	{
+	    perror("shm_segment_open");
+	    exit(EXIT_FAILURE);
+	}
+	nanosleep(&t, 0);
+    }
+
+    while (atomic_load_explicit(&shared_data->magic, memory_order_acquire) != SHARED_MAGIC)
+	nanosleep(&t, 0);
+
+    t.tv_sec = interval_ms / 1000;
+    t.tv_nsec = (interval_ms % 1000) * 1000000L;
+
+    do
+    {
+	retries += seqlock_read(&shared_data->stats.lock, &s, &shared_data->stats.stats, sizeof(s));
+
+	if (!header++)
+	    printf("producer: %s mode, sizes %lu-%lu, ring %lu bytes, arena %lu bytes, updated every %u ms\n",
+		   s.mode == MODE_RECORDS ? "records" : "bytes", (unsigned long)s.min_size,
+		   (unsigned long)s.max_size, (unsigned long)s.ring_capacity,
+		   (unsigned long)s.arena_size, s.interval_ms);
+
+	printf("%10.3f s  %12lu items %10.0f items/s %10.1f MB/s  ring %5.1f%% full  %8lu arena blocks  (%u torn reads retried)\n",
+	       s.updated_ns / 1e9, (unsigned long)s.items, s.items_per_sec, s.bytes_per_sec / 1e6,
+	       s.ring_capacity ? 100.0 * s.ring_used / s.ring_capacity : 0.0,
+	       (unsigned long)s.arena_blocks, retries);
+	fflush(stdout);
+
+	if (s.running)
+	    nanosleep(&t, 0);
+    }
+    while (s.running);
+
+    shm_segment_unmap(shared_data, size);
+    return 0;
+}
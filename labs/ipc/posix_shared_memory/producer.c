@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/mman.h>
 #include <fcntl.h>
@@ -7,57 +9,333 @@
 #include <sys/types.h>
 
 #include "shared.h"
+#include "shm_segment.h"
+#include "evlog.h"
 
-Item produce_item();
+void produce_item();
+void build_message(char *p, Item item, size_t size);
+shm_off_t build_record(Shared_Data *shared_data, Item item, size_t size);
+shm_off_t alloc_wait(Shared_Data *shared_data, size_t size);
+void publish_stats(Shared_Data *shared_data, Shm_Ring *ring, Shm_Stats *stats, int running);
+size_t parse_size(const char *s);
+double now();
 
-int main()
+void usage(const char *prog)
 {
-    Item item;
-    int fd;
+    fprintf(stderr, "usage: %s [-s size | -s min-max] [-n count] [-m ring-bytes] [-H] [-P] [-L] [-c] [-A] [-a arena-bytes] [-w] [-v]\n"
+	    "  -s  payload bytes per message, fixed or random in min-max (default 64)\n"
+	    "  -n  messages to send, then close the ring (default 0: forever)\n"
+	    "  -m  ring data size, rounded up to a power of 2 (default 16M)\n"
+	    "  -H  huge pages   -P  prefault (MAP_POPULATE)   -L  mlock\n"
+	    "  -c  build each message in private memory and copy it in (default: in place)\n"
+	    "  -A  build each item as a linked record in the shared arena and send its offset\n"
+	    "      (-s then sets the size of each field value)\n"
+	    "  -a  arena size (default 64M with -A, otherwise none)\n"
+	    "  -w  simulate slow item production   -v  log every item\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    Item item = 0;
     Shared_Data *shared_data;
+    Shm_Ring ring;
+    char *payload;
+    size_t min_size = 64, max_size = 64, ring_size = DEFAULT_RING_SIZE, arena_size = 0, size, bytes = 0;
+    long count = 0;
+    int opt, seg_flags = 0, copy = 0, records = 0, work = 0, verbose = 0, ev_produce;
+    shm_off_t off;
+    Shm_Stats stats;
+    double start;
+
+    while ((opt = getopt(argc, argv, "s:n:m:a:HPLcAwv")) != -1)
+    {
+	switch (opt)
+	{
+	case 's':
+	    min_size = max_size = parse_size(optarg);
+	    if (strchr(optarg, '-'))
+		max_size = parse_size(strchr(optarg, '-') + 1);
+	    break;
+	case 'n': count = atol(optarg); break;
+	case 'm': ring_size = parse_size(optarg); break;
+	case 'H': seg_flags |= SHM_SEG_HUGE; break;
+	case 'P': seg_flags |= SHM_SEG_POPULATE; break;
+	case 'L': seg_flags |= SHM_SEG_LOCK; break;
+	case 'c': copy = 1; break;
+	case 'A': records = 1; break;
+	case 'a': arena_size = parse_size(optarg); break;
+	case 'w': work = 1; break;
+	case 'v': verbose = 1; break;
+	default: usage(argv[0]);
+	}
+    }
+
+    if (min_size < sizeof(Item) || max_size < min_size)
+	usage(argv[0]);
+
+    for (size = 64; size < ring_size; size *= 2)
+	;
+    ring_size = size;
+
+    if (records && arena_size == 0)
+	arena_size = DEFAULT_ARENA_SIZE;
+    arena_size &= ~(size_t)(ARENA_BLOCK_HEADER - 1);
+
+    /* a whole record is allocated before the consumer can free any of it,
+       so the arena must hold the biggest one at once or the wait is forever */
+    if (records)
+    {
+	size_t field = shm_arena_block_size(sizeof(Shm_Field)) + shm_arena_block_size(16)
+	    + shm_arena_block_size(max_size + 1);
+	size_t need = shm_arena_block_size(sizeof(Shm_Record)) + shm_arena_block_size(32) + RECORD_FIELDS * field;
+
+	if (shm_arena_block_size(max_size + 1) == 0 || need > arena_size)
+	{
+	    fprintf(stderr, "%s: a record with %zu-byte fields needs an arena of at least %zu bytes (-a)\n",
+		    argv[0], max_size, need);
+	    exit(EXIT_FAILURE);
+	}
+    }
 
     srandom(time(NULL));     /* seed random number generator */
 
-    /* (1) create shared memory object
-       (2) set its size to 4k
-       (3) map it into this process's addrss space starting at address "shared_data"
+    evlog_init(STDOUT_FILENO, 100);     /* log from the loop without stdio */
+    evlog_thread_start("producer");
+    ev_produce = evlog_event("producing item");
+
+    /* (1) create the shared memory object (removing any stale one)
+       (2) size it to hold the header, the ring data and the arena
+       (3) map it into this process's address space starting at address "shared_data"
     */
 
-    fd = shm_open("prodcon", O_CREAT | O_RDWR, 0666);
-    ftruncate(fd, SHARED_MEMORY_SIZE);
-    shared_data = mmap(0, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    shm_segment_unlink(SHARED_MEMORY_NAME, seg_flags);
+    shared_data = shm_segment_create(SHARED_MEMORY_NAME, RING_DATA_OFFSET + ring_size + arena_size, seg_flags);
+
+    if (shared_data == 0)
+    {
+	perror("shm_segment_create");
+	exit(EXIT_FAILURE);
+    }
+
+    /* from here on, treat the start of the region as an instance of the Shared_Data struct */
 
-    /* from here on, treat the shared memory region as an instance of the Shared_Data struct */
-    
-    shared_data->in = 0;      /* initialize the shared data structure (a bounded buffer) */
-    shared_data->out = 0;
+    shared_data->size = RING_DATA_OFFSET + ring_size + arena_size;
+    shared_data->ring_off = RING_DATA_OFFSET;
+    shared_data->mode = records ? MODE_RECORDS : MODE_BYTES;
+    shm_ring_init(&ring, &shared_data->ring, (char *)shared_data + RING_DATA_OFFSET, ring_size);
+    shm_arena_init(&shared_data->arena, RING_DATA_OFFSET + ring_size, arena_size);
 
-    while (1)     /* repeatedly (forever) produce and enqueue items in the bounded buffer */
+    if (max_size > shm_ring_max_record(&ring))
     {
-	item = produce_item();
+	fprintf(stderr, "%s: messages of %zu bytes don't fit a %zu byte ring\n", argv[0], max_size, ring_size);
+	exit(EXIT_FAILURE);
+    }
+
+    payload = malloc(max_size);
+
+    memset(&stats, 0, sizeof(stats));     /* configuration for monitors; counters start at 0 */
+    stats.mode = shared_data->mode;
+    stats.interval_ms = STATS_INTERVAL_MS;
+    stats.min_size = min_size;
+    stats.max_size = max_size;
+    stats.ring_capacity = ring_size;
+    stats.arena_size = arena_size;
+    publish_stats(shared_data, &ring, &stats, 1);
+
+    /* only now may consumers and monitors attach: a monitor finding the
+       stats still zero would take the producer for one that has stopped */
+    atomic_store_explicit(&shared_data->magic, SHARED_MAGIC, memory_order_release);
+
+    start = now();
 
-	while (((shared_data->in + 1) % BUFFER_SIZE) == shared_data->out)
-	    ;     /* do nothing - busy wait if buffer full */
+    while (count == 0 || (long)item < count)     /* produce and enqueue items in the ring */
+    {
+	if (work)
+	    produce_item();
+
+	size = min_size;
+	if (max_size > min_size)
+	    size += random() % (max_size - min_size + 1);
+
+	if (verbose)
+	    evlog(ev_produce, item);
 
-	printf("producing item %d\n", item);
+	if (records)
+	{
+	    off = build_record(shared_data, item, size);     /* only the offset goes through the ring */
+	    shm_ring_send(&ring, &off, sizeof(off));
+	    size *= RECORD_FIELDS;
+	}
+	else if (copy)
+	{
+	    build_message(payload, item, size);
+	    shm_ring_send(&ring, payload, size);     /* blocks (futex) while the ring is full */
+	}
+	else
+	{
+	    build_message(shm_ring_claim(&ring, size), item, size);     /* straight into shared memory */
+	    shm_ring_commit(&ring, size);
+	}
 
-	shared_data->buffer[shared_data->in] = item;               /* enqueue */
-	shared_data->in = (shared_data->in + 1) % BUFFER_SIZE;
+	bytes += size;
+	item++;
+
+	if ((item & 255) == 0)     /* don't read the clock for every item */
+	{
+	    stats.items = item;
+	    stats.bytes = bytes;
+	    publish_stats(shared_data, &ring, &stats, 1);
+	}
     }
-    
-    /* not reached */
+
+    stats.items = item;
+    stats.bytes = bytes;
+    publish_stats(shared_data, &ring, &stats, 0);
+
+    shm_ring_close(&ring);
+    evlog_shutdown();
+
+    printf("produced %lu items, %zu bytes in %.3f s (%.1f MB/s)\n",
+	   (unsigned long)item, bytes, now() - start, bytes / (now() - start) / 1e6);
     return 0;
 }
 
-Item produce_item()
+void produce_item()
 {
-    static int item = 0;
     long i, upper = random() % 100000000L + 2000000L;
 
     /* simulate some time-consuming, variable-time item generation process */
 
     for (i = 0L; i < upper; i++)
-	;
+	__asm__ volatile ("");
+}
+
+void build_message(char *p, Item item, size_t size)
+{
+    memcpy(p, &item, sizeof(item));     /* sequence number, checked by the consumer */
+    memset(p + sizeof(item), (int)(item & 0xff), size - sizeof(item));
+}
+
+/* publish the counters in stats (with rates since the last publication)
+   if STATS_INTERVAL_MS has passed, or unconditionally when stopping.
+   Monitors read them under the seqlock without ever blocking us.
+*/
+
+void publish_stats(Shared_Data *shared_data, Shm_Ring *ring, Shm_Stats *stats, int running)
+{
+    static uint64_t last_ns, last_items, last_bytes;
+    uint64_t now_ns = (uint64_t)(now() * 1e9);
+    double dt;
+
+    if (running && stats->updated_ns != 0 && now_ns - last_ns < STATS_INTERVAL_MS * 1000000ULL)
+	return;
+
+    if (last_ns != 0 && now_ns > last_ns)
+    {
+	dt = (now_ns - last_ns) / 1e9;
+	stats->items_per_sec = (stats->items - last_items) / dt;
+	stats->bytes_per_sec = (stats->bytes - last_bytes) / dt;
+    }
+
+    stats->updated_ns = now_ns;
+    stats->running = running;
+    stats->ring_used = ring->head - atomic_load(&shared_data->ring.tail);
+    stats->arena_blocks = atomic_load(&shared_data->arena.allocs) - atomic_load(&shared_data->arena.frees);
+
+    seqlock_write(&shared_data->stats.lock, &shared_data->stats.stats, stats, sizeof(*stats));
+
+    last_ns = now_ns;
+    last_items = stats->items;
+    last_bytes = stats->bytes;
+}
+
+/* build an item as a record with a name and a small map of fields, all
+   allocated in the arena and linked by offsets.  The consumer frees it.
+*/
+
+shm_off_t build_record(Shared_Data *shared_data, Item item, size_t size)
+{
+    char name[32], key[16], *value;
+    shm_off_t off, field_off;
+    Shm_Record *rec;
+    Shm_Field *field;
+    int i;
+
+    off = alloc_wait(shared_data, sizeof(Shm_Record));
+    rec = SHM_PTR(shared_data, off);
+    rec->item = item;
+    rec->fields = SHM_NULL;
+    rec->nfields = RECORD_FIELDS;
+
+    snprintf(name, sizeof(name), "item-%lu", (unsigned long)item);
+    rec->name = alloc_wait(shared_data, strlen(name) + 1);
+    strcpy(SHM_PTR(shared_data, rec->name), name);
+
+    for (i = RECORD_FIELDS - 1; i >= 0; i--)
+    {
+	field_off = alloc_wait(shared_data, sizeof(Shm_Field));
+	field = SHM_PTR(shared_data, field_off);
+
+	snprintf(key, sizeof(key), "field%d", i);
+	field->key = alloc_wait(shared_data, strlen(key) + 1);
+	strcpy(SHM_PTR(shared_data, field->key), key);
+
+	field->value = alloc_wait(shared_data, size + 1);
+	value = SHM_PTR(shared_data, field->value);
+	memset(value, 'a' + (int)((item + i) % 26), size);
+	value[size] = '\0';
+
+	field->next = rec->fields;
+	rec->fields = field_off;
+    }
+
+    return off;
+}
+
+shm_off_t alloc_wait(Shared_Data *shared_data, size_t size)     /* wait for the consumer to free space */
+{
+    struct timespec t = { 0, 50000L };
+    shm_off_t off;
+
+    while ((off = shm_arena_alloc(&shared_data->arena, shared_data, size)) == SHM_NULL)
+    {
+	if (errno == E2BIG)
+	{
+	    fprintf(stderr, "producer: %zu bytes can never fit in the arena\n", size);
+	    exit(EXIT_FAILURE);
+	}
+	if (errno == ENOSPC)     /* smaller sizes took the whole arena: try a bigger -a */
+	{
+	    fprintf(stderr, "producer: the arena is used up by smaller blocks, and no %zu-byte one will ever be free\n",
+		    size);
+	    exit(EXIT_FAILURE);
+	}
+	nanosleep(&t, 0);
+    }
+
+    return off;
+}
+
+size_t parse_size(const char *s)     /* e.g. "4096", "64k", "1M", "2G" */
+{
+    char *end;
+    size_t n = strtoul(s, &end, 10);
+
+    switch (*end)
+    {
+    case 'g': case 'G': n <<= 10;     /* fall through */
+    case 'm': case 'M': n <<= 10;     /* fall through */
+    case 'k': case 'K': n <<= 10;
+    }
+
+    return n;
+}
+
+double now()
+{
+    struct timespec t;
 
-    return item++;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
 }
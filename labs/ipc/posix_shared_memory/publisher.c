@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "shared.h"
+#include "shm_segment.h"
+
+volatile sig_atomic_t stop;     /* ^C or kill: close the stream and clean up */
+
+size_t parse_size(const char *s);
+double now();
+void on_signal(int sig);
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-s size | -s min-max] [-n count] [-N slots] [-W subscribers] [-H] [-P] [-L]\n"
+	    "  -s  payload bytes per record, fixed or random in min-max (default 64)\n"
+	    "  -n  records to publish, then close the stream (default 0: forever)\n"
+	    "  -N  slots in the stream, rounded up to a power of 2 (default %d)\n"
+	    "  -W  wait for this many subscribers before publishing (default 0)\n"
+	    "  -H  huge pages   -P  prefault (MAP_POPULATE)   -L  mlock\n", prog, DEFAULT_BCAST_SLOTS);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    Bcast_Shared_Data *shared_data;
+    Bcast stream;
+    char *p;
+    size_t min_size = 64, max_size = 64, nslots = DEFAULT_BCAST_SLOTS, n, size, slot_size, bytes = 0;
+    long count = 0, published = 0;
+    int opt, i, subscribers, wait_for = 0, seg_flags = 0;
+    double start;
+
+    while ((opt = getopt(argc, argv, "s:n:N:W:HPL")) != -1)
+    {
+	switch (opt)
+	{
+	case 's':
+	    min_size = max_size = parse_size(optarg);
+	    if (strchr(optarg, '-'))
+		max_size = parse_size(strchr(optarg, '-') + 1);
+	    break;
+	case 'n': count = atol(optarg); break;
+	case 'N': nslots = parse_size(optarg); break;
+	case 'W': wait_for = atoi(optarg); break;
+	case 'H': seg_flags |= SHM_SEG_HUGE; break;
+	case 'P': seg_flags |= SHM_SEG_POPULATE; break;
+	case 'L': seg_flags |= SHM_SEG_LOCK; break;
+	default: usage(argv[0]);
+	}
+    }
+
+    if (max_size < min_size || wait_for > BCAST_MAX_CONSUMERS)
+	usage(argv[0]);
+
+    for (n = 2; n < nslots; n *= 2)
+	;
+    nslots = n;
+    slot_size = (max_size + BCAST_SLOT_HEADER + 63) & ~(size_t)63;     /* whole cache lines */
+
+    srandom(time(NULL));
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    shm_segment_unlink(BCAST_MEMORY_NAME, seg_flags);     /* one left by a publisher that was killed */
+    shared_data = shm_segment_create(BCAST_MEMORY_NAME, BCAST_DATA_OFFSET + nslots * slot_size, seg_flags);
+
+    if (shared_data == 0)
+    {
+	perror("shm_segment_create");
+	exit(EXIT_FAILURE);
+    }
+
+    shared_data->size = BCAST_DATA_OFFSET + nslots * slot_size;
+    shared_data->slots_off = BCAST_DATA_OFFSET;
+    bcast_init(&stream, &shared_data->bcast, (char *)shared_data + BCAST_DATA_OFFSET, nslots, slot_size);
+    atomic_store_explicit(&shared_data->magic, BCAST_MAGIC, memory_order_release);
+
+    do     /* optionally hold the stream until enough subscribers have joined */
+    {
+	struct timespec t = { 0, 10000000L };
+
+	for (i = subscribers = 0; i < BCAST_MAX_CONSUMERS; i++)
+	    subscribers += atomic_load(&shared_data->bcast.cursors[i].active) == 1;
+
+	if (subscribers < wait_for)
+	    nanosleep(&t, 0);
+    }
+    while (subscribers < wait_for && !stop);
+
+    start = now();
+
+    while ((count == 0 || published < count) && !stop)
+    {
+	size = min_size;
+	if (max_size > min_size)
+	    size += random() % (max_size - min_size + 1);
+
+	if ((p = bcast_claim(&stream, &stop)) == 0)     /* waits for the slowest subscriber */
+	    break;     /* stopped while waiting */
+	memset(p, (int)(published & 0xff), size);
+	bcast_publish(&stream, size);
+
+	bytes += size;
+	published++;
+    }
+
+    bcast_close(&stream);
+
+    printf("published %ld records, %zu bytes in %.3f s (%.1f MB/s)\n",
+	   published, bytes, now() - start, bytes / (now() - start) / 1e6);
+
+    /* subscribers already attached keep their mapping and read to the end;
+       one started from now on waits for the next publisher's segment
+       instead of attaching to this closed one */
+    shm_segment_unmap(shared_data, shm_segment_size(shared_data->size, seg_flags));
+    shm_segment_unlink(BCAST_MEMORY_NAME, seg_flags);
+    return 0;
+}
+
+
+void on_signal(int sig)
+{
+    stop = 1;
+}
+
+size_t parse_size(const char *s)     /* e.g. "4096", "64k", "1M", "2G" */
+{
+    char *end;
+    size_t n = strtoul(s, &end, 10);
+
+    switch (*end)
+    {
+    case 'g': case 'G': n <<= 10;     /* fall through */
+    case 'm': case 'M': n <<= 10;     /* fall through */
+    case 'k': case 'K': n <<= 10;
+    }
+
+    return n;
+}
+
+double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
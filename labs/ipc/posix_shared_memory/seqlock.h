@@ -0,0 +1,66 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "futex.h"
+
+/* a sequence lock for data with one writer and any number of readers,
+   possibly in other processes.
+
+   The writer makes the sequence number odd, updates the data, then makes
+   it even again; it never waits for readers.  A reader copies the data
+   between two reads of the sequence number and retries if the number was
+   odd (write in progress) or changed (the copy may be torn).  Readers
+   never write to the shared cache line, so any number of them can poll
+   without slowing the writer down.
+
+   Only use this for plain data: the reader's copy may be inconsistent
+   until the retry check passes, so it mustn't follow pointers in it.
+*/
+
+typedef struct
+{
+    _Atomic uint32_t seq;     /* odd while a write is in progress */
+}
+    Seqlock;
+
+static inline void seqlock_write(Seqlock *l, void *shared, const void *data, size_t len)
+{
+    uint32_t seq = atomic_load_explicit(&l->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&l->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);     /* odd seq is visible before any data */
+
+    memcpy(shared, data, len);
+
+    atomic_store_explicit(&l->seq, seq + 2, memory_order_release);     /* data is visible before even seq */
+}
+
+static inline unsigned seqlock_read(Seqlock *l, void *copy, const void *shared, size_t len)     /* returns retries */
+{
+    uint32_t before, after;
+    unsigned retries = 0;
+
+    while (1)
+    {
+	before = atomic_load_explicit(&l->seq, memory_order_acquire);
+
+	if ((before & 1) == 0)
+	{
+	    memcpy(copy, shared, len);
+	    atomic_thread_fence(memory_order_acquire);     /* copy completes before the re-check */
+	    after = atomic_load_explicit(&l->seq, memory_order_relaxed);
+
+	    if (after == before)
+		return retries;
+	}
+
+	retries++;
+	cpu_relax();
+    }
+}
+
+#endif
@@ -1,25 +1,131 @@
 #ifndef SHARED_H
 #define SHARED_H
 
-#define BUFFER_SIZE 4               /* size of bounded buffer */
-#define SHARED_MEMORY_SIZE 4096
+#include <stdint.h>
+#include <stdatomic.h>
 
-typedef int Item;     /* some item type - doesn't matter what it is */
+#include "shm_ring.h"
+#include "shm_bcast.h"
+#include "shm_arena.h"
+#include "seqlock.h"
 
-/* the producer and consumer will share a data structure of the following
-   type (it will resize in a shared memory segment).
+#define SHARED_MEMORY_NAME "prodcon"
+#define SHARED_MAGIC 0x316e6f63646f7270ULL     /* "prodcon1" */
 
-   The bounded buffer can hold between 0 and BUFFER_SIZE-1 (3) Items
-   (in == out) will indicate buffer empty
-   (((in + 1) % BUFFER_SIZE) == out) will indicate buffer full
+#define DEFAULT_RING_SIZE (16UL << 20)          /* bytes of ring data (power of 2) */
+#define RING_DATA_OFFSET 4096                   /* ring data starts on its own page */
+#define DEFAULT_ARENA_SIZE (64UL << 20)
+#define RECORD_FIELDS 4                         /* fields in each MODE_RECORDS record */
+#define STATS_INTERVAL_MS 250                   /* how often the producer publishes stats */
+
+typedef uint64_t Item;     /* sequence number carried at the start of every payload */
+
+/* the producer and consumer share a segment laid out as follows:
+
+       0                  Shared_Data (segment header + ring and arena control blocks)
+       ring_off           ring data (ring.capacity bytes)
+       arena.start        arena region (optional, arena.end - arena.start bytes)
+
+   The producer creates and sizes the segment, initializes everything and
+   stores magic last (release); the consumer waits until it sees magic
+   (acquire) before attaching to the ring.  Payloads are variable length
+   records (see shm_ring.h), so the segment size is set on the producer's
+   command line rather than fixed here.
+
+   In MODE_RECORDS, the producer builds each item as a linked Shm_Record
+   in the arena and sends only its offset through the ring; the consumer
+   walks it in place and frees it (see shm_arena.h).
+
+   The producer also publishes its configuration and running counters in
+   the stats block, under a seqlock, for monitor processes to poll.
 */
 
+enum { MODE_BYTES = 0, MODE_RECORDS = 1 };
+
+typedef struct
+{
+    /* configuration, fixed when the producer starts */
+    uint32_t mode;
+    uint32_t interval_ms;         /* how often this block is updated */
+    uint64_t min_size;
+    uint64_t max_size;
+    uint64_t ring_capacity;
+    uint64_t arena_size;
+
+    /* counters */
+    uint64_t updated_ns;          /* CLOCK_MONOTONIC time of this update */
+    uint64_t items;
+    uint64_t bytes;
+    double items_per_sec;         /* over the last interval */
+    double bytes_per_sec;
+    uint64_t ring_used;           /* bytes in the ring not yet released */
+    uint64_t arena_blocks;        /* arena blocks allocated and not freed */
+    uint32_t running;             /* 0 once the producer has finished */
+}
+    Shm_Stats;
+
 typedef struct
 {
-    Item buffer[BUFFER_SIZE];     /* the bounded buffer */
-    int in;                       /* index of next enqueue */
-    int out;                      /* index of next dequeue */
+    Seqlock lock;
+    char pad[64 - sizeof(Seqlock)];
+    Shm_Stats stats;
+}
+    Shm_Stats_Block;
+
+typedef struct
+{
+    _Atomic uint64_t magic;
+    uint64_t size;                /* bytes in the whole segment */
+    uint64_t ring_off;            /* offset of the ring data area */
+    uint32_t mode;                /* what the ring carries: MODE_BYTES or MODE_RECORDS */
+    char pad[64 - 3 * sizeof(uint64_t) - sizeof(uint32_t)];
+
+    Shm_Ring_Header ring;         /* the ring's control block */
+    Shm_Arena arena;              /* allocator for the arena region */
+    Shm_Stats_Block stats;        /* producer's config and counters (seqlock) */
 }
     Shared_Data;
 
+typedef struct     /* one key/value entry of a record's small map */
+{
+    shm_off_t key;                /* NUL-terminated strings in the arena */
+    shm_off_t value;
+    shm_off_t next;               /* next Shm_Field, or SHM_NULL */
+}
+    Shm_Field;
+
+typedef struct
+{
+    Item item;
+    shm_off_t name;               /* string */
+    shm_off_t fields;             /* list of Shm_Field */
+    uint32_t nfields;
+}
+    Shm_Record;
+
+_Static_assert(sizeof(Shared_Data) <= RING_DATA_OFFSET, "Shared_Data overlaps ring data");
+
+
+/* the broadcast stream (publisher/subscriber) lives in a segment of its
+   own, laid out the same way: header first, slots from BCAST_DATA_OFFSET
+*/
+
+#define BCAST_MEMORY_NAME "prodcon_bcast"
+#define BCAST_MAGIC 0x316e6f6364616362ULL      /* "bcadcon1" */
+#define BCAST_DATA_OFFSET 4096
+#define DEFAULT_BCAST_SLOTS 4096
+
+typedef struct
+{
+    _Atomic uint64_t magic;
+    uint64_t size;
+    uint64_t slots_off;
+    char pad[64 - 3 * sizeof(uint64_t)];
+
+    Bcast_Header bcast;
+}
+    Bcast_Shared_Data;
+
+_Static_assert(sizeof(Bcast_Shared_Data) <= BCAST_DATA_OFFSET, "Bcast_Shared_Data overlaps slots");
+
 #endif
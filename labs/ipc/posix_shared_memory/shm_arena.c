@@ -0,0 +1,190 @@
+#include <string.h>
+#include <errno.h>
+
+#include "shm_arena.h"
+
+#define BLOCK_MAGIC 0x61726e61u     /* "arna" */
+
+#define TAG_SHIFT 40
+#define OFF_MASK ((1ULL << TAG_SHIFT) - 1)
+#define PACK(off, tag) (((uint64_t)(tag) << TAG_SHIFT) | ((off) >> ARENA_MIN_SHIFT))
+#define UNPACK_OFF(head) (((head) & OFF_MASK) << ARENA_MIN_SHIFT)
+#define UNPACK_TAG(head) ((head) >> TAG_SHIFT)
+
+typedef struct
+{
+    uint32_t size_class;
+    uint32_t magic;
+    _Atomic shm_off_t next;     /* free list link while the block is free */
+}
+    Block;
+
+_Static_assert(sizeof(Block) == ARENA_BLOCK_HEADER, "block header size");
+
+static int size_class(size_t size);
+static shm_off_t pop(Shm_Arena *a, void *base, int c);
+static void push(Shm_Arena *a, void *base, int c, shm_off_t block);
+static shm_off_t carve(Shm_Arena *a, int c);
+
+
+int shm_arena_init(Shm_Arena *a, uint64_t start, uint64_t size)
+{
+    if (start == 0 || start % ARENA_BLOCK_HEADER != 0 || start + size >= (OFF_MASK << ARENA_MIN_SHIFT))
+    {
+	errno = EINVAL;
+	return -1;
+    }
+
+    memset(a, 0, sizeof(*a));
+    a->start = start;
+    a->end = start + size;
+    atomic_store(&a->brk, start);
+    return 0;
+}
+
+
+shm_off_t shm_arena_alloc(Shm_Arena *a, void *base, size_t size)
+{
+    int c = size_class(size);
+    shm_off_t block;
+    Block *b;
+
+    if (c == -1 || ((uint64_t)1 << (c + ARENA_MIN_SHIFT)) > a->end - a->start)
+    {
+	errno = E2BIG;     /* bigger than the whole region: no amount of freeing helps */
+	return SHM_NULL;
+    }
+
+    if ((block = pop(a, base, c)) == SHM_NULL && (block = carve(a, c)) == SHM_NULL)
+    {
+	/* region exhausted: a retry after frees may succeed only if there
+	   are blocks of this class to free */
+	errno = atomic_load_explicit(&a->free[c].carved, memory_order_relaxed) ? ENOMEM : ENOSPC;
+	return SHM_NULL;
+    }
+
+    b = SHM_PTR(base, block);
+    b->size_class = c;
+    b->magic = BLOCK_MAGIC;
+
+    atomic_fetch_add_explicit(&a->allocs, 1, memory_order_relaxed);
+    return block + ARENA_BLOCK_HEADER;
+}
+
+
+void shm_arena_free(Shm_Arena *a, void *base, shm_off_t off)
+{
+    Block *b;
+
+    if (off == SHM_NULL)
+	return;
+
+    b = SHM_PTR(base, off - ARENA_BLOCK_HEADER);
+
+    if (b->magic != BLOCK_MAGIC || b->size_class >= ARENA_CLASSES)
+	return;     /* not an arena block (or freed twice) - ignore it */
+
+    b->magic = 0;
+    push(a, base, b->size_class, off - ARENA_BLOCK_HEADER);
+    atomic_fetch_add_explicit(&a->frees, 1, memory_order_relaxed);
+}
+
+
+shm_off_t shm_arena_strdup(Shm_Arena *a, void *base, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    shm_off_t off = shm_arena_alloc(a, base, len);
+
+    if (off != SHM_NULL)
+	memcpy(SHM_PTR(base, off), s, len);
+
+    return off;
+}
+
+
+size_t shm_arena_block_size(size_t size)     /* region bytes an allocation of size takes; 0: too big */
+{
+    int c = size_class(size);
+
+    return c == -1 ? 0 : (size_t)1 << (c + ARENA_MIN_SHIFT);
+}
+
+
+size_t shm_arena_usable(Shm_Arena *a, void *base, shm_off_t off)     /* bytes usable at off */
+{
+    Block *b = SHM_PTR(base, off - ARENA_BLOCK_HEADER);
+
+    return ((size_t)1 << (b->size_class + ARENA_MIN_SHIFT)) - ARENA_BLOCK_HEADER;
+}
+
+
+static int size_class(size_t size)     /* smallest class whose blocks hold size bytes */
+{
+    int c = 0;
+
+    size += ARENA_BLOCK_HEADER;
+
+    while (c < ARENA_CLASSES && ((size_t)1 << (c + ARENA_MIN_SHIFT)) < size)
+	c++;
+
+    return c < ARENA_CLASSES ? c : -1;
+}
+
+
+static shm_off_t pop(Shm_Arena *a, void *base, int c)
+{
+    uint64_t head, next;
+    shm_off_t block;
+    Block *b;
+
+    head = atomic_load_explicit(&a->free[c].head, memory_order_acquire);
+
+    do
+    {
+	if ((block = UNPACK_OFF(head)) == SHM_NULL)
+	    return SHM_NULL;
+
+	b = SHM_PTR(base, block);     /* may be stale by now; the tag catches that */
+	next = PACK(atomic_load_explicit(&b->next, memory_order_relaxed), UNPACK_TAG(head) + 1);
+    }
+    while (!atomic_compare_exchange_weak_explicit(&a->free[c].head, &head, next,
+						  memory_order_acquire, memory_order_acquire));
+
+    atomic_fetch_sub_explicit(&a->free[c].count, 1, memory_order_relaxed);
+    return block;
+}
+
+
+static void push(Shm_Arena *a, void *base, int c, shm_off_t block)
+{
+    uint64_t head;
+    Block *b = SHM_PTR(base, block);
+
+    head = atomic_load_explicit(&a->free[c].head, memory_order_relaxed);
+
+    do
+	atomic_store_explicit(&b->next, UNPACK_OFF(head), memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&a->free[c].head, &head,
+						  PACK(block, UNPACK_TAG(head) + 1),
+						  memory_order_release, memory_order_relaxed));
+
+    atomic_fetch_add_explicit(&a->free[c].count, 1, memory_order_relaxed);
+}
+
+
+static shm_off_t carve(Shm_Arena *a, int c)     /* a fresh block from the end of the region */
+{
+    uint64_t size = (uint64_t)1 << (c + ARENA_MIN_SHIFT);
+    uint64_t brk = atomic_load_explicit(&a->brk, memory_order_relaxed);
+
+    do
+    {
+	if (a->end - brk < size)
+	    return SHM_NULL;
+    }
+    while (!atomic_compare_exchange_weak_explicit(&a->brk, &brk, brk + size,
+						  memory_order_relaxed, memory_order_relaxed));
+
+    atomic_fetch_add_explicit(&a->free[c].carved, 1, memory_order_relaxed);
+    return brk;
+}
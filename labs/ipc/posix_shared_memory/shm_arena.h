@@ -0,0 +1,75 @@
+#ifndef SHM_ARENA_H
+#define SHM_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* a memory allocator for a region of a shared memory segment, usable
+   concurrently from every process that maps the segment.
+
+   Processes generally map a segment at different addresses, so nothing
+   stored in the segment may contain a pointer.  Instead, allocations are
+   named by shm_off_t offsets from the start of the segment, and each
+   process converts them with SHM_PTR/SHM_OFF using its own mapping base.
+   Offset 0 is the segment header, so it doubles as the null offset (check
+   for SHM_NULL before converting an offset that may be null).
+
+   Blocks come in power-of-2 size classes (16 bytes up to 2^(4+31)), each
+   with a 16-byte header recording its class.  Freed blocks go on a
+   lock-free LIFO free list per class; a list head packs a block offset
+   (in 16-byte units) with a 24-bit tag that changes on every update, so a
+   compare-and-swap can't succeed on a head that was popped and pushed
+   back in between (the ABA problem).  A class with an empty free list is
+   refilled from the untouched end of the region.  Memory is never returned
+   to the region, so a block's header stays readable even after another
+   process has popped it, which is what makes the pop safe.
+
+   shm_arena_alloc returns SHM_NULL with errno ENOMEM when the region is
+   used up but blocks of the class are out (a retry after they're freed
+   may succeed), ENOSPC when the region is used up and the class has never
+   had a block - the region went to other classes, and since blocks never
+   change class no free will ever make one - and E2BIG when the block
+   would be bigger than the whole region (no retry can).
+*/
+
+typedef uint64_t shm_off_t;
+
+#define SHM_NULL ((shm_off_t)0)
+#define SHM_PTR(base, off) ((void *)((char *)(base) + (off)))
+#define SHM_OFF(base, ptr) ((ptr) ? (shm_off_t)((char *)(ptr) - (char *)(base)) : SHM_NULL)
+
+#define ARENA_MIN_SHIFT 4               /* smallest block: 16 bytes */
+#define ARENA_CLASSES 32
+#define ARENA_BLOCK_HEADER 16
+
+typedef struct
+{
+    _Atomic uint64_t head;              /* tagged offset of the first free block */
+    _Atomic uint64_t count;             /* blocks on the list (statistics only) */
+    _Atomic uint64_t carved;            /* blocks of the class ever taken from the region */
+    char pad[64 - 24];
+}
+    Arena_Free_List;
+
+typedef struct
+{
+    uint64_t start;                     /* region: [start, end) as segment offsets */
+    uint64_t end;
+    _Atomic uint64_t brk;               /* start of the never-allocated part */
+    _Atomic uint64_t allocs;
+    _Atomic uint64_t frees;
+    char pad[64 - 40];
+
+    Arena_Free_List free[ARENA_CLASSES];
+}
+    Shm_Arena;
+
+int shm_arena_init(Shm_Arena *a, uint64_t start, uint64_t size);
+shm_off_t shm_arena_alloc(Shm_Arena *a, void *base, size_t size);
+void shm_arena_free(Shm_Arena *a, void *base, shm_off_t off);
+shm_off_t shm_arena_strdup(Shm_Arena *a, void *base, const char *s);
+size_t shm_arena_block_size(size_t size);
+size_t shm_arena_usable(Shm_Arena *a, void *base, shm_off_t off);
+
+#endif
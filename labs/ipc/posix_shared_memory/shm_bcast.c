@@ -0,0 +1,303 @@
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "shm_bcast.h"
+#include "futex.h"
+
+#define EVICT_CHECK_MS 100     /* how long the producer sleeps before checking for dead consumers */
+
+typedef struct
+{
+    uint32_t len;
+    uint32_t reserved;
+    uint64_t seq;
+}
+    Bcast_Slot;
+
+_Static_assert(sizeof(Bcast_Slot) == BCAST_SLOT_HEADER, "slot header size");
+
+#define SLOT(b, s) ((Bcast_Slot *)((b)->slots + ((s) & (b)->mask) * (b)->hdr->slot_size))
+
+static uint64_t gate(Bcast *b);
+static void evict_dead(Bcast *b);
+static void store_cursor(Bcast *b);
+
+
+int bcast_init(Bcast *b, Bcast_Header *hdr, void *slots, uint64_t nslots, uint32_t slot_size)
+{
+    if (nslots < 2 || (nslots & (nslots - 1)) != 0 ||
+	slot_size <= BCAST_SLOT_HEADER || slot_size % 8 != 0)
+    {
+	errno = EINVAL;
+	return -1;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->nslots = nslots;
+    hdr->slot_size = slot_size;
+
+    bcast_attach(b, hdr, slots);
+    return 0;
+}
+
+
+void bcast_attach(Bcast *b, Bcast_Header *hdr, void *slots)
+{
+    b->hdr = hdr;
+    b->slots = slots;
+    b->mask = hdr->nslots - 1;
+    b->next = b->limit = b->stored = atomic_load(&hdr->published);
+    b->id = -1;
+}
+
+
+uint32_t bcast_max_record(const Bcast *b)
+{
+    return b->hdr->slot_size - BCAST_SLOT_HEADER;
+}
+
+
+/* producer: return the payload area of the next slot, waiting until the
+   slowest consumer has finished with the record that used it last - or
+   0 if *stop (when stop isn't 0) is set while waiting, since a stalled
+   consumer could keep the producer here for ever
+*/
+
+void *bcast_claim(Bcast *b, const volatile sig_atomic_t *stop)
+{
+    Bcast_Header *h = b->hdr;
+    uint32_t s;
+    int i;
+
+    if (b->next >= b->limit)
+    {
+	for (i = 0; i < BCAST_SPIN && (b->limit = gate(b)) <= b->next; i++)
+	    cpu_relax();
+
+	while (b->limit <= b->next)
+	{
+	    if (stop && *stop)
+	    {
+		atomic_store(&h->producer_waiting, 0);
+		return 0;
+	    }
+
+	    s = atomic_load(&h->gate_seq);
+	    atomic_store(&h->producer_waiting, 1);
+	    atomic_thread_fence(memory_order_seq_cst);
+
+	    if ((b->limit = gate(b)) > b->next)
+		break;
+
+	    if (futex_wait_ms(&h->gate_seq, s, EVICT_CHECK_MS) == -1 && errno == ETIMEDOUT)
+		evict_dead(b);
+	}
+
+	atomic_store(&h->producer_waiting, 0);
+    }
+
+    return SLOT(b, b->next) + 1;
+}
+
+
+void bcast_publish(Bcast *b, uint32_t len)
+{
+    Bcast_Slot *slot = SLOT(b, b->next);
+
+    slot->len = len;
+    slot->seq = b->next;
+    b->next++;
+
+    atomic_store_explicit(&b->hdr->published, b->next, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&b->hdr->consumers_waiting, memory_order_relaxed))
+    {
+	atomic_fetch_add(&b->hdr->data_seq, 1);
+	futex_wake(&b->hdr->data_seq, INT_MAX);
+    }
+}
+
+
+void bcast_close(Bcast *b)
+{
+    atomic_store(&b->hdr->closed, 1);
+    atomic_fetch_add(&b->hdr->data_seq, 1);
+    futex_wake(&b->hdr->data_seq, INT_MAX);
+}
+
+
+/* consumer: take a free cursor and start it at the current head.  The
+   head is read again after the cursor becomes active: any gate the
+   producer computed before then was based on a head no later than that,
+   so it can't let the producer lap the new cursor.
+*/
+
+int bcast_subscribe(Bcast *b)
+{
+    Bcast_Header *h = b->hdr;
+    uint32_t expected;
+    int i;
+
+    for (i = 0; i < BCAST_MAX_CONSUMERS; i++)
+    {
+	expected = 0;
+
+	if (atomic_compare_exchange_strong(&h->cursors[i].active, &expected, 2))     /* 2 = joining */
+	{
+	    atomic_store(&h->cursors[i].cursor, atomic_load(&h->published));
+	    atomic_store(&h->cursors[i].pid, getpid());
+	    atomic_store(&h->cursors[i].active, 1);
+
+	    b->next = b->limit = b->stored = atomic_load(&h->published);
+	    atomic_store(&h->cursors[i].cursor, b->next);
+	    b->id = i;
+	    return i;
+	}
+    }
+
+    errno = EBUSY;
+    return -1;
+}
+
+
+/* consumer: the next record, read in place.  It stays valid (the producer
+   can't reuse its slot) until bcast_release.  Returns 0 at the end of the
+   stream.
+*/
+
+const void *bcast_next(Bcast *b, uint32_t *len, uint64_t *seq)
+{
+    Bcast_Header *h = b->hdr;
+    Bcast_Slot *slot;
+    uint32_t s;
+    int i;
+
+    if (b->next == b->limit)
+    {
+	for (i = 0; i < BCAST_SPIN; i++)
+	{
+	    if ((b->limit = atomic_load_explicit(&h->published, memory_order_acquire)) != b->next)
+		break;
+	    cpu_relax();
+	}
+
+	if (b->limit == b->next)
+	{
+	    store_cursor(b);     /* the producer may be waiting on us */
+	    atomic_fetch_add(&h->consumers_waiting, 1);
+
+	    while (1)
+	    {
+		s = atomic_load(&h->data_seq);
+
+		if ((b->limit = atomic_load_explicit(&h->published, memory_order_acquire)) != b->next ||
+		    atomic_load(&h->closed))
+		    break;
+
+		futex_wait(&h->data_seq, s);
+	    }
+
+	    atomic_fetch_sub(&h->consumers_waiting, 1);
+	    b->limit = atomic_load_explicit(&h->published, memory_order_acquire);
+
+	    if (b->limit == b->next)
+	    {
+		errno = EPIPE;     /* closed and drained */
+		return 0;
+	    }
+	}
+    }
+
+    slot = SLOT(b, b->next);
+    *len = slot->len;
+    if (seq)
+	*seq = slot->seq;
+    return slot + 1;
+}
+
+
+void bcast_release(Bcast *b)
+{
+    b->next++;
+
+    if (b->next - b->stored >= BCAST_CURSOR_BATCH)
+	store_cursor(b);
+}
+
+
+void bcast_unsubscribe(Bcast *b)
+{
+    Bcast_Header *h = b->hdr;
+
+    if (b->id == -1)
+	return;
+
+    atomic_store(&h->cursors[b->id].active, 0);
+    b->id = -1;
+
+    atomic_fetch_add(&h->gate_seq, 1);
+    futex_wake(&h->gate_seq, 1);
+}
+
+
+/* first sequence the producer may not write: nslots past the slowest
+   active cursor (or past its own position if nobody is subscribed)
+*/
+
+static uint64_t gate(Bcast *b)
+{
+    Bcast_Header *h = b->hdr;
+    uint64_t min = b->next, c;
+    int i;
+
+    for (i = 0; i < BCAST_MAX_CONSUMERS; i++)
+    {
+	if (atomic_load(&h->cursors[i].active) == 1)
+	{
+	    c = atomic_load_explicit(&h->cursors[i].cursor, memory_order_acquire);
+	    if (c < min)
+		min = c;
+	}
+    }
+
+    return min + h->nslots;
+}
+
+
+static void evict_dead(Bcast *b)     /* consumers that exited without unsubscribing */
+{
+    Bcast_Header *h = b->hdr;
+    int i;
+    pid_t pid;
+
+    for (i = 0; i < BCAST_MAX_CONSUMERS; i++)
+    {
+	pid = atomic_load(&h->cursors[i].pid);
+
+	if (atomic_load(&h->cursors[i].active) == 1 && kill(pid, 0) == -1 && errno == ESRCH)
+	    atomic_store(&h->cursors[i].active, 0);
+    }
+}
+
+
+static void store_cursor(Bcast *b)
+{
+    Bcast_Header *h = b->hdr;
+
+    if (b->id == -1 || b->stored == b->next)
+	return;
+
+    atomic_store_explicit(&h->cursors[b->id].cursor, b->next, memory_order_release);
+    b->stored = b->next;
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&h->producer_waiting, memory_order_relaxed))
+    {
+	atomic_fetch_add(&h->gate_seq, 1);
+	futex_wake(&h->gate_seq, 1);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef SHM_BCAST_H
+#define SHM_BCAST_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <sys/types.h>
+
+/* a one-producer, many-consumer broadcast stream in shared memory
+   (disruptor style): every consumer sees every record published after it
+   subscribed, and the records are written to shared memory once no
+   matter how many consumers read them.
+
+   The stream is a ring of nslots fixed-size slots indexed by a free-running
+   sequence number.  The producer publishes sequence s by storing
+   published = s + 1; each consumer owns a cursor (the next sequence it
+   will read) in its own cache line.  The producer may only reuse slot
+   s % nslots once every active cursor has passed s - nslots + 1, so it
+   is gated by the slowest consumer; with no consumers it runs free.
+
+   A consumer subscribes by taking a free cursor and starting it at the
+   current head, so late joiners see only new records.  Consumers read
+   records in place and store their cursor lazily (every
+   BCAST_CURSOR_BATCH records, and always before sleeping), which keeps
+   cache-line traffic to the producer down.
+
+   Consumers sleep on a futex bumped by every publish that finds sleepers;
+   the producer sleeps on another one that consumers bump when they move
+   their cursor while it's waiting.  A consumer that dies without
+   unsubscribing is evicted once the producer finds its pid gone.
+*/
+
+#define BCAST_MAX_CONSUMERS 16
+#define BCAST_CURSOR_BATCH 64
+#define BCAST_SPIN 256
+#define BCAST_SLOT_HEADER 16
+
+typedef struct
+{
+    _Atomic uint64_t cursor;        /* next sequence this consumer will read */
+    _Atomic uint32_t active;
+    _Atomic int32_t pid;
+    char pad[64 - 16];
+}
+    Bcast_Cursor;
+
+typedef struct
+{
+    /* written by the producer */
+    _Atomic uint64_t published;             /* sequences below this are readable */
+    _Atomic uint32_t data_seq;              /* futex word consumers sleep on */
+    _Atomic uint32_t closed;
+    char pad1[64 - 16];
+
+    /* written by consumers */
+    _Atomic uint32_t consumers_waiting;
+    _Atomic uint32_t gate_seq;              /* futex word the producer sleeps on */
+    _Atomic uint32_t producer_waiting;
+    char pad2[64 - 12];
+
+    /* fixed at initialization */
+    uint64_t nslots;                        /* power of 2 */
+    uint32_t slot_size;                     /* bytes per slot, header included */
+    char pad3[64 - 12];
+
+    Bcast_Cursor cursors[BCAST_MAX_CONSUMERS];
+}
+    Bcast_Header;
+
+typedef struct     /* per-process handle */
+{
+    Bcast_Header *hdr;
+    char *slots;
+    uint64_t mask;
+    uint64_t next;          /* producer: sequence being written; consumer: next to read */
+    uint64_t limit;         /* producer: first sequence it may not write yet;
+			       consumer: published as last seen */
+    uint64_t stored;        /* consumer: cursor value last stored to shared memory */
+    int id;                 /* consumer: cursor index, -1 if not subscribed */
+}
+    Bcast;
+
+int bcast_init(Bcast *b, Bcast_Header *hdr, void *slots, uint64_t nslots, uint32_t slot_size);
+void bcast_attach(Bcast *b, Bcast_Header *hdr, void *slots);
+uint32_t bcast_max_record(const Bcast *b);
+
+/* producer */
+void *bcast_claim(Bcast *b, const volatile sig_atomic_t *stop);     /* 0 once *stop is set */
+void bcast_publish(Bcast *b, uint32_t len);
+void bcast_close(Bcast *b);
+
+/* consumers */
+int bcast_subscribe(Bcast *b);
+const void *bcast_next(Bcast *b, uint32_t *len, uint64_t *seq);
+void bcast_release(Bcast *b);
+void bcast_unsubscribe(Bcast *b);
+
+#endif
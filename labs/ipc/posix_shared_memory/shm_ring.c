@@ -0,0 +1,379 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "shm_ring.h"
+#include "futex.h"
+
+#define REC_SIZE(len) ((sizeof(Shm_Ring_Record) + (uint64_t)(len) + 7) & ~(uint64_t)7)
+
+static void *ring_reserve(Shm_Ring *r, uint32_t len);
+static void ring_commit(Shm_Ring *r, uint32_t len);
+static Shm_Ring_Record *ring_peek(Shm_Ring *r);
+static void ring_release(Shm_Ring *r, uint64_t tail);
+
+static int space_ready(Shm_Ring *r, uint64_t need);
+static int data_ready(Shm_Ring *r, uint64_t unused);
+static void sleep_until(Shm_Ring *r, int (*ready)(Shm_Ring *, uint64_t), uint64_t arg,
+			_Atomic uint32_t *seq, _Atomic uint32_t *waiting, int efd);
+static void wake_peer(_Atomic uint32_t *seq, _Atomic uint32_t *waiting, int efd);
+
+
+int shm_ring_init(Shm_Ring *r, Shm_Ring_Header *hdr, void *data, uint64_t capacity)
+{
+    if (capacity < 64 || (capacity & (capacity - 1)) != 0)
+    {
+	errno = EINVAL;
+	return -1;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->capacity = capacity;
+
+    shm_ring_attach(r, hdr, data);
+    return 0;
+}
+
+
+void shm_ring_attach(Shm_Ring *r, Shm_Ring_Header *hdr, void *data)
+{
+    r->hdr = hdr;
+    r->data = data;
+    r->mask = hdr->capacity - 1;
+    r->head = atomic_load(&hdr->head);
+    r->tail = r->read = atomic_load(&hdr->tail);
+    r->peer_cache = r->tail;     /* a valid (stale) view for either side */
+    r->claimed = 0;
+    r->held_first = r->held_count = 0;
+    r->data_efd = r->space_efd = -1;
+}
+
+
+/* sleep and wake with eventfds rather than futexes: data_efd is signalled
+   when records are published (or the ring is closed), space_efd when
+   space is released.  Both processes must use the same pair.
+*/
+
+void shm_ring_use_eventfd(Shm_Ring *r, int data_efd, int space_efd)
+{
+    r->data_efd = data_efd;
+    r->space_efd = space_efd;
+}
+
+
+uint32_t shm_ring_max_record(const Shm_Ring *r)     /* guarantees a record always fits */
+{
+    uint64_t max = r->hdr->capacity / 2 - sizeof(Shm_Ring_Record);
+
+    return max > UINT32_MAX ? UINT32_MAX : (uint32_t)max;
+}
+
+
+void *shm_ring_claim(Shm_Ring *r, uint32_t len)     /* reserve len bytes to write in place */
+{
+    if (r->claimed)
+    {
+	errno = EBUSY;     /* one claim at a time */
+	return 0;
+    }
+
+    return ring_reserve(r, len);
+}
+
+
+int shm_ring_commit(Shm_Ring *r, uint32_t len)     /* publish the claim (len may shrink) */
+{
+    if (r->claimed == 0 || len > r->claimed->len)
+    {
+	errno = EINVAL;
+	return -1;
+    }
+
+    r->claimed->len = len;
+    r->claimed = 0;
+    ring_commit(r, len);
+    return 0;
+}
+
+
+const void *shm_ring_acquire(Shm_Ring *r, uint32_t *len)     /* next record, in place */
+{
+    Shm_Ring_Record *rec;
+    unsigned i;
+
+    if (r->held_count == SHM_RING_MAX_HELD)
+    {
+	errno = EBUSY;     /* release something first */
+	return 0;
+    }
+
+    rec = ring_peek(r);
+
+    if (rec == 0)
+    {
+	errno = EPIPE;     /* producer closed the ring and it's drained */
+	return 0;
+    }
+
+    r->read += REC_SIZE(rec->len);
+
+    i = (r->held_first + r->held_count++) % SHM_RING_MAX_HELD;
+    r->held[i].end = r->read;
+    r->held[i].rec = rec;
+    r->held[i].released = 0;
+
+    *len = rec->len;
+    return rec + 1;
+}
+
+
+/* mark an acquired record as done.  Space is handed back to the producer
+   only up to the oldest record still held, so records can be released in
+   any order without the producer overwriting one that's still in use.
+*/
+
+int shm_ring_release(Shm_Ring *r, const void *payload)
+{
+    const Shm_Ring_Record *rec = (const Shm_Ring_Record *)payload - 1;
+    uint64_t tail = r->tail;
+    unsigned i, n;
+
+    for (n = 0; n < r->held_count; n++)
+    {
+	i = (r->held_first + n) % SHM_RING_MAX_HELD;
+
+	if (r->held[i].rec == rec && !r->held[i].released)
+	    break;
+    }
+
+    if (n == r->held_count)
+    {
+	errno = EINVAL;     /* not a record we hold */
+	return -1;
+    }
+
+    r->held[i].released = 1;
+
+    while (r->held_count > 0 && r->held[r->held_first].released)
+    {
+	tail = r->held[r->held_first].end;
+	r->held_first = (r->held_first + 1) % SHM_RING_MAX_HELD;
+	r->held_count--;
+    }
+
+    if (tail != r->tail)
+	ring_release(r, tail);
+
+    return 0;
+}
+
+
+int shm_ring_send(Shm_Ring *r, const void *buf, uint32_t len)
+{
+    void *p = shm_ring_claim(r, len);
+
+    if (p == 0)
+	return -1;
+
+    memcpy(p, buf, len);
+    return shm_ring_commit(r, len);
+}
+
+
+ssize_t shm_ring_recv(Shm_Ring *r, void *buf, size_t max)
+{
+    const void *p;
+    uint32_t len;
+
+    if ((p = shm_ring_acquire(r, &len)) == 0)
+	return -1;
+
+    if (len > max)     /* un-acquire: the record is left in the ring */
+    {
+	r->held_count--;
+	r->read -= REC_SIZE(len);
+	errno = EMSGSIZE;
+	return -1;
+    }
+
+    memcpy(buf, p, len);
+    shm_ring_release(r, p);
+    return len;
+}
+
+
+void shm_ring_close(Shm_Ring *r)
+{
+    uint64_t one = 1;
+
+    atomic_store(&r->hdr->closed, 1);
+    atomic_fetch_add(&r->hdr->data_seq, 1);
+
+    if (r->data_efd != -1)
+	(void)!write(r->data_efd, &one, sizeof(one));
+    else
+	futex_wake(&r->hdr->data_seq, 1);
+}
+
+
+/* producer side: wait for room for a record of len bytes (plus a PAD
+   record if it has to wrap) and return where its payload goes.  Nothing
+   is visible to the consumer until ring_commit.
+*/
+
+static void *ring_reserve(Shm_Ring *r, uint32_t len)
+{
+    uint64_t need = REC_SIZE(len);
+    uint64_t room = r->hdr->capacity - (r->head & r->mask);     /* bytes before the wrap */
+    Shm_Ring_Record *rec;
+
+    if (len > shm_ring_max_record(r))
+    {
+	errno = EMSGSIZE;
+	return 0;
+    }
+
+    sleep_until(r, space_ready, need > room ? need + room : need,
+		&r->hdr->space_seq, &r->hdr->producer_waiting, r->space_efd);
+
+    if (need > room)     /* skip to the start of the data area */
+    {
+	rec = (Shm_Ring_Record *)(r->data + (r->head & r->mask));
+	rec->len = room - sizeof(Shm_Ring_Record);
+	rec->type = SHM_REC_PAD;
+	r->head += room;
+    }
+
+    rec = (Shm_Ring_Record *)(r->data + (r->head & r->mask));
+    rec->len = len;
+    rec->type = SHM_REC_DATA;
+    r->claimed = rec;
+    return rec + 1;
+}
+
+
+static void ring_commit(Shm_Ring *r, uint32_t len)
+{
+    r->head += REC_SIZE(len);
+    atomic_store_explicit(&r->hdr->head, r->head, memory_order_release);
+    wake_peer(&r->hdr->data_seq, &r->hdr->consumer_waiting, r->data_efd);
+}
+
+
+/* consumer side: wait for the next unread DATA record (skipping PAD
+   records) and return it in place.  Returns 0 once the producer has closed the ring and
+   everything it wrote has been read.
+*/
+
+static Shm_Ring_Record *ring_peek(Shm_Ring *r)
+{
+    Shm_Ring_Record *rec;
+
+    while (1)
+    {
+	if (r->peer_cache == r->read)
+	{
+	    sleep_until(r, data_ready, 0, &r->hdr->data_seq, &r->hdr->consumer_waiting, r->data_efd);
+
+	    if (r->peer_cache == r->read)     /* woken by close - recheck head */
+	    {
+		r->peer_cache = atomic_load_explicit(&r->hdr->head, memory_order_acquire);
+
+		if (r->peer_cache == r->read)
+		    return 0;
+	    }
+	}
+
+	rec = (Shm_Ring_Record *)(r->data + (r->read & r->mask));
+
+	if (rec->type == SHM_REC_DATA)
+	    return rec;
+
+	r->read += sizeof(Shm_Ring_Record) + rec->len;     /* PAD - released with the next record */
+    }
+}
+
+
+static void ring_release(Shm_Ring *r, uint64_t tail)
+{
+    r->tail = tail;
+    atomic_store_explicit(&r->hdr->tail, r->tail, memory_order_release);
+    wake_peer(&r->hdr->space_seq, &r->hdr->producer_waiting, r->space_efd);
+}
+
+
+static int space_ready(Shm_Ring *r, uint64_t need)
+{
+    if (r->hdr->capacity - (r->head - r->peer_cache) >= need)
+	return 1;
+
+    r->peer_cache = atomic_load_explicit(&r->hdr->tail, memory_order_acquire);
+    return r->hdr->capacity - (r->head - r->peer_cache) >= need;
+}
+
+
+static int data_ready(Shm_Ring *r, uint64_t unused)
+{
+    r->peer_cache = atomic_load_explicit(&r->hdr->head, memory_order_acquire);
+    return r->peer_cache != r->read || atomic_load(&r->hdr->closed);
+}
+
+
+/* spin for a while, then sleep on the futex.  The waiting flag is set
+   before the final readiness check, and the peer tests it after publishing
+   (both with full fences), so either we see the peer's update or the peer
+   sees the flag and wakes us.  Snapshotting seq first means a wake that
+   lands between the check and futex_wait makes the wait return at once.
+   (An eventfd keeps a count, so a wake is never lost there either; a
+   stale count just costs one extra trip round the loop.)
+*/
+
+static void sleep_until(Shm_Ring *r, int (*ready)(Shm_Ring *, uint64_t), uint64_t arg,
+			_Atomic uint32_t *seq, _Atomic uint32_t *waiting, int efd)
+{
+    uint64_t count;
+    uint32_t s;
+    int i;
+
+    for (i = 0; i < SHM_RING_SPIN; i++)
+    {
+	if (ready(r, arg))
+	    return;
+	cpu_relax();
+    }
+
+    while (1)
+    {
+	s = atomic_load(seq);
+	atomic_store(waiting, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (ready(r, arg))
+	    break;
+
+	if (efd != -1)
+	    (void)!read(efd, &count, sizeof(count));
+	else
+	    futex_wait(seq, s);
+    }
+
+    atomic_store(waiting, 0);
+}
+
+
+static void wake_peer(_Atomic uint32_t *seq, _Atomic uint32_t *waiting, int efd)
+{
+    uint64_t one = 1;
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(waiting, memory_order_relaxed))
+    {
+	atomic_fetch_add(seq, 1);
+
+	if (efd != -1)
+	    (void)!write(efd, &one, sizeof(one));
+	else
+	    futex_wake(seq, 1);
+    }
+}
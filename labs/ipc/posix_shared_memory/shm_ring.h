@@ -0,0 +1,110 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+/* a single-producer/single-consumer ring of variable-length records that
+   lives in shared memory, for moving arbitrary payloads between two
+   processes.
+
+   head and tail are free-running byte counts (they never wrap; the data
+   offset is count & (capacity - 1)), so the ring is empty when head ==
+   tail and holds head - tail bytes.  Each record is an 8-byte header
+   (length, type) followed by the payload, padded to a multiple of 8.  A
+   record that doesn't fit before the end of the data area is preceded by
+   a PAD record that fills the rest of it, so every payload is contiguous.
+
+   The producer publishes a record by storing head with release ordering
+   after writing the payload; the consumer reads head with acquire
+   ordering before reading the payload (and the same in the other
+   direction for tail, which frees space).
+
+   Large payloads needn't be copied at all: the producer can claim space
+   for a record, build it directly in shared memory and commit it, and the
+   consumer can acquire records and read them in place.  The consumer may
+   hold up to SHM_RING_MAX_HELD records at once and release them in any
+   order; tail only advances past records that have been released, so a
+   slow consumer makes the producer wait instead of having its data
+   overwritten.  A side that finds nothing to do
+   spins briefly, then sleeps on a futex in the shared header; the other
+   side only makes the futex_wake system call if the waiting flag is set.
+   Related processes can use a pair of eventfds for the wakeups instead
+   (shm_ring_use_eventfd), e.g. to make the ring pollable.
+*/
+
+#define SHM_RING_SPIN 256           /* polls before sleeping on the futex */
+#define SHM_RING_MAX_HELD 64        /* records a consumer may hold at once */
+
+#define SHM_REC_DATA 1
+#define SHM_REC_PAD  2
+
+typedef struct
+{
+    uint32_t len;       /* payload bytes */
+    uint32_t type;      /* SHM_REC_DATA or SHM_REC_PAD */
+}
+    Shm_Ring_Record;
+
+typedef struct
+{
+    /* written by the producer */
+    _Atomic uint64_t head;              /* bytes published */
+    _Atomic uint32_t data_seq;          /* futex word the consumer sleeps on */
+    _Atomic uint32_t producer_waiting;
+    _Atomic uint32_t closed;            /* producer is done */
+    char pad1[64 - 20];
+
+    /* written by the consumer */
+    _Atomic uint64_t tail;              /* bytes released */
+    _Atomic uint32_t space_seq;         /* futex word the producer sleeps on */
+    _Atomic uint32_t consumer_waiting;
+    char pad2[64 - 16];
+
+    /* fixed at initialization */
+    uint64_t capacity;                  /* bytes in the data area (power of 2) */
+}
+    Shm_Ring_Header;
+
+typedef struct     /* per-process handle on a ring */
+{
+    Shm_Ring_Header *hdr;
+    char *data;
+    uint64_t mask;
+    uint64_t head;          /* producer: next byte to write */
+    uint64_t tail;          /* consumer: first byte not yet released */
+    uint64_t read;          /* consumer: next byte to acquire */
+    uint64_t peer_cache;    /* last value seen of the other side's counter */
+    Shm_Ring_Record *claimed;     /* producer: record claimed but not committed */
+    int data_efd;           /* eventfds for wakeups, or -1 to use the futexes */
+    int space_efd;
+
+    struct                  /* consumer: acquired records, oldest first */
+    {
+	uint64_t end;       /* ring position just past the record */
+	Shm_Ring_Record *rec;
+	int released;
+    }
+	held[SHM_RING_MAX_HELD];
+    unsigned held_first, held_count;
+}
+    Shm_Ring;
+
+int shm_ring_init(Shm_Ring *r, Shm_Ring_Header *hdr, void *data, uint64_t capacity);
+void shm_ring_attach(Shm_Ring *r, Shm_Ring_Header *hdr, void *data);
+uint32_t shm_ring_max_record(const Shm_Ring *r);
+void shm_ring_use_eventfd(Shm_Ring *r, int data_efd, int space_efd);
+
+/* zero-copy interface */
+void *shm_ring_claim(Shm_Ring *r, uint32_t len);
+int shm_ring_commit(Shm_Ring *r, uint32_t len);
+const void *shm_ring_acquire(Shm_Ring *r, uint32_t *len);
+int shm_ring_release(Shm_Ring *r, const void *payload);
+
+/* copying interface (built on the above) */
+int shm_ring_send(Shm_Ring *r, const void *buf, uint32_t len);
+ssize_t shm_ring_recv(Shm_Ring *r, void *buf, size_t max);
+void shm_ring_close(Shm_Ring *r);
+
+#endif
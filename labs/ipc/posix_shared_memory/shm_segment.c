@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "shm_segment.h"
+
+#define HUGETLBFS_MAGIC 0x958458f6
+
+static int open_segment(const char *name, int oflag, int flags, int *on_hugetlbfs);
+static void *map_segment(int fd, size_t size, int flags, int on_hugetlbfs);
+
+
+void *shm_segment_create(const char *name, size_t size, int flags)
+{
+    int fd, on_hugetlbfs;
+    void *base;
+
+    fd = open_segment(name, O_CREAT | O_RDWR, flags, &on_hugetlbfs);
+
+    if (fd == -1)
+	return 0;
+
+    size = shm_segment_size(size, flags);
+
+    if (ftruncate(fd, size) == -1)
+    {
+	close(fd);
+	return 0;
+    }
+
+    base = map_segment(fd, size, flags, on_hugetlbfs);
+    close(fd);     /* the mapping keeps the segment alive */
+    return base;
+}
+
+
+void *shm_segment_open(const char *name, size_t *size, int flags)
+{
+    int fd, on_hugetlbfs;
+    struct stat st;
+    void *base;
+
+    fd = open_segment(name, O_RDWR, flags, &on_hugetlbfs);
+
+    if (fd == -1)
+	return 0;
+
+    if (fstat(fd, &st) == -1)
+    {
+	close(fd);
+	return 0;
+    }
+
+    if (st.st_size == 0)
+    {
+	close(fd);
+	errno = EAGAIN;     /* creator hasn't sized it yet */
+	return 0;
+    }
+
+    *size = st.st_size;
+    base = map_segment(fd, *size, flags, on_hugetlbfs);
+    close(fd);
+    return base;
+}
+
+
+size_t shm_segment_size(size_t size, int flags)     /* huge pages: rounded up to whole ones */
+{
+    if (flags & SHM_SEG_HUGE)
+	size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    return size;
+}
+
+
+void shm_segment_unmap(void *base, size_t size)
+{
+    munmap(base, size);
+}
+
+
+int shm_segment_unlink(const char *name, int flags)
+{
+    char path[256];
+
+    if (flags & SHM_SEG_HUGE)
+    {
+	snprintf(path, sizeof(path), "%s/%s", HUGETLBFS_DIR, name);
+
+	if (unlink(path) == 0)
+	    return 0;
+    }
+
+    return shm_unlink(name);
+}
+
+
+/* a hugetlbfs file if huge pages were asked for and the mount exists,
+   otherwise an ordinary shm_open object (in /dev/shm)
+*/
+
+static int open_segment(const char *name, int oflag, int flags, int *on_hugetlbfs)
+{
+    char path[256];
+    struct statfs fs;
+
+    *on_hugetlbfs = 0;
+
+    if ((flags & SHM_SEG_HUGE) &&
+	statfs(HUGETLBFS_DIR, &fs) == 0 && fs.f_type == HUGETLBFS_MAGIC)
+    {
+	snprintf(path, sizeof(path), "%s/%s", HUGETLBFS_DIR, name);
+	*on_hugetlbfs = 1;
+	return open(path, oflag, 0666);
+    }
+
+    return shm_open(name, oflag, 0666);
+}
+
+
+static void *map_segment(int fd, size_t size, int flags, int on_hugetlbfs)
+{
+    void *base;
+    int mflags = MAP_SHARED;
+
+    if (flags & SHM_SEG_POPULATE)
+	mflags |= MAP_POPULATE;
+
+    base = mmap(0, size, PROT_READ | PROT_WRITE, mflags, fd, 0);
+
+    if (base == MAP_FAILED)
+	return 0;
+
+    if ((flags & SHM_SEG_HUGE) && !on_hugetlbfs)
+	madvise(base, size, MADV_HUGEPAGE);     /* best effort (tmpfs THP) */
+
+    if ((flags & SHM_SEG_LOCK) && mlock(base, size) == -1)
+	perror("shm_segment: mlock (continuing unlocked)");
+
+    return base;
+}
@@ -0,0 +1,34 @@
+#ifndef SHM_SEGMENT_H
+#define SHM_SEGMENT_H
+
+#include <stddef.h>
+
+/* create or open a named POSIX shared memory segment and map it.
+
+   flags:
+     SHM_SEG_HUGE      back the segment with huge pages: a file on a hugetlbfs
+                       mount (/dev/hugepages) if there is one, otherwise ask
+                       for transparent huge pages with madvise
+     SHM_SEG_POPULATE  prefault the whole mapping (MAP_POPULATE) so the first
+                       pass over the segment does not take page faults
+     SHM_SEG_LOCK      mlock the mapping so it can't be paged out (failure,
+                       e.g. from RLIMIT_MEMLOCK, is reported but not fatal)
+
+   The opener must pass the same SHM_SEG_HUGE setting as the creator, since
+   it decides where the segment lives.
+*/
+
+#define SHM_SEG_HUGE     0x1
+#define SHM_SEG_POPULATE 0x2
+#define SHM_SEG_LOCK     0x4
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+#define HUGETLBFS_DIR "/dev/hugepages"
+
+void *shm_segment_create(const char *name, size_t size, int flags);
+size_t shm_segment_size(size_t size, int flags);     /* what create maps for size: unmap that much */
+void *shm_segment_open(const char *name, size_t *size, int flags);
+void shm_segment_unmap(void *base, size_t size);
+int shm_segment_unlink(const char *name, int flags);
+
+#endif
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "shared.h"
+#include "shm_segment.h"
+
+void consume_record(uint64_t seq);
+uint64_t checksum(const char *p, size_t len);
+double now();
+
+int main(int argc, char **argv)
+{
+    Bcast_Shared_Data *shared_data;
+    Bcast stream;
+    const char *p;
+    uint32_t len;
+    uint64_t seq, first = 0, expected = 0, received = 0, sum = 0;
+    size_t size, bytes = 0;
+    long gaps = 0;
+    int opt, seg_flags = 0, work = 0;
+    struct timespec t = { 0, 10000000L };
+    double start;
+
+    while ((opt = getopt(argc, argv, "HPLw")) != -1)
+    {
+	switch (opt)
+	{
+	case 'H': seg_flags |= SHM_SEG_HUGE; break;
+	case 'P': seg_flags |= SHM_SEG_POPULATE; break;
+	case 'L': seg_flags |= SHM_SEG_LOCK; break;
+	case 'w': work = 1; break;
+	default:
+	    fprintf(stderr, "usage: %s [-H] [-P] [-L] [-w]   (-w: simulate slow processing)\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    srandom(time(NULL) ^ getpid());
+
+    while ((shared_data = shm_segment_open(BCAST_MEMORY_NAME, &size, seg_flags)) == 0)
+    {
+	if (errno != ENOENT && errno != EAGAIN)
+	{
+	    perror("shm_segment_open");
+	    exit(EXIT_FAILURE);
+	}
+	nanosleep(&t, 0);
+    }
+
+    while (atomic_load_explicit(&shared_data->magic, memory_order_acquire) != BCAST_MAGIC)
+	nanosleep(&t, 0);
+
+    bcast_attach(&stream, &shared_data->bcast, (char *)shared_data + shared_data->slots_off);
+
+    if (bcast_subscribe(&stream) == -1)     /* joins at the current head */
+    {
+	fprintf(stderr, "%s: all %d subscriber slots are taken\n", argv[0], BCAST_MAX_CONSUMERS);
+	exit(EXIT_FAILURE);
+    }
+
+    start = now();
+
+    while ((p = bcast_next(&stream, &len, &seq)) != 0)     /* read in place until the stream closes */
+    {
+	if (received == 0)
+	    first = expected = seq;
+	if (seq != expected)
+	    gaps++;
+	expected = seq + 1;
+
+	sum += checksum(p, len);
+	bytes += len;
+	received++;
+
+	if (work)
+	    consume_record(seq);
+
+	bcast_release(&stream);
+    }
+
+    bcast_unsubscribe(&stream);
+
+    printf("subscriber %d: %lu records from #%lu, %zu bytes in %.3f s (%.1f MB/s), %ld gaps, checksum %lx\n",
+	   (int)getpid(), (unsigned long)received, (unsigned long)first, bytes,
+	   now() - start, bytes / (now() - start) / 1e6, gaps, (unsigned long)sum);
+
+    shm_segment_unmap(shared_data, size);
+    return gaps != 0;
+}
+
+void consume_record(uint64_t seq)
+{
+    long i, upper = random() % 1000000L;
+
+    /* simulate some variable-time record processing */
+
+    for (i = 0L; i < upper; i++)
+	__asm__ volatile ("");
+}
+
+uint64_t checksum(const char *p, size_t len)     /* stands in for processing the payload */
+{
+    uint64_t sum = 0, w;
+    size_t i;
+
+    for (i = 0; i + sizeof(w) <= len; i += sizeof(w))
+    {
+	memcpy(&w, p + i, sizeof(w));
+	sum += w;
+    }
+
+    for (; i < len; i++)
+	sum += (unsigned char)p[i];
+
+    return sum;
+}
+
+double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -1,10 +1,233 @@
+#define _GNU_SOURCE
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+/* a fast cat: concatenate files (or standard input, for no files or "-")
+   to standard output.
+
+   Rather than copying every byte into a user buffer and back out, it asks
+   the kernel to move the data directly, by whichever call suits the
+   output:
+
+     regular file   copy_file_range (the filesystem may even share blocks)
+     pipe           splice (page references are moved into the pipe)
+     socket         sendfile
+     anything else  read/write with a large page-aligned buffer
+
+   If the kernel can't do the fast path for a pair of files (different
+   filesystems on older kernels, an O_APPEND output, a pipe as input to
+   copy_file_range...) it falls back to read/write from where it got to.
+
+   An input that is the output file itself (mycat f >> f) is skipped with
+   an error, as cat does: copying it would chase its own end for ever.
+
+   gcc -O2 mycat.c -o mycat        (mycat_bench.sh compares it with cat)
+*/
+
+#define CHUNK (1 << 20)            /* bytes per system call */
+#define BUFFER_ALIGN 4096
+
+enum { COPY_FILE_RANGE, SPLICE, SENDFILE, READ_WRITE };
+
+const char *method_names[] = { "copy_file_range", "splice", "sendfile", "read/write" };
+
+char *buffer;
+
+int output_method(int out);
+int is_output(int in, const struct stat *out_st);
+int cat_fd(int in, int out, int method);
+ssize_t fast_copy(int in, int out, int method);
+int copy_read_write(int in, int out);
+
 
 int main(int argc, char *argv[])
 {
-	if (argc != 2){
-		printf("Invlaid Argument")
-		return -1
+    int i, fd, method, status = 0, verbose = 0, err = 0;
+    struct stat out_st;
+    char *name;
+
+    if (argc > 1 && strcmp(argv[1], "-v") == 0)     /* report the method used on stderr */
+    {
+	verbose = 1;
+	argv++;
+	argc--;
+    }
+
+    if (posix_memalign((void **)&buffer, BUFFER_ALIGN, CHUNK) != 0)
+    {
+	perror("mycat: posix_memalign failed");
+	exit(EXIT_FAILURE);
+    }
+
+    method = output_method(STDOUT_FILENO);
+    if (fstat(STDOUT_FILENO, &out_st) == -1)
+	out_st.st_mode = 0;     /* not a regular file: no input can be it */
+    if (verbose)
+	fprintf(stderr, "mycat: output by %s\n", method_names[method]);
+
+    for (i = 1; i < argc || (argc == 1 && i == 1); i++)
+    {
+	name = argc == 1 ? "-" : argv[i];
+
+	if (strcmp(name, "-") == 0)
+	    fd = STDIN_FILENO;
+	else if ((fd = open(name, O_RDONLY)) == -1)
+	{
+	    fprintf(stderr, "mycat: %s: %s\n", name, strerror(errno));
+	    status = 1;
+	    continue;
+	}
+
+	if (is_output(fd, &out_st))
+	{
+	    fprintf(stderr, "mycat: %s: input file is output file\n", name);
+	    status = 1;
+	    if (fd != STDIN_FILENO)
+		close(fd);
+	    continue;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);     /* aggressive read-ahead */
+
+	if (cat_fd(fd, STDOUT_FILENO, method) == -1)
+	{
+	    err = errno;
+	    fprintf(stderr, "mycat: %s: %s\n", name, strerror(err));
+	    status = 1;
 	}
-	int fd = open(argv[1],
 
+	if (fd != STDIN_FILENO)
+	    close(fd);
+
+	if (err == EPIPE)     /* nobody is reading the output any more */
+	    break;
+    }
+
+    free(buffer);
+    return status;
+}
+
+
+int output_method(int out)
+{
+    struct stat st;
+
+    if (fstat(out, &st) == -1)
+	return READ_WRITE;
+
+    if (S_ISREG(st.st_mode))
+	return COPY_FILE_RANGE;
+    if (S_ISFIFO(st.st_mode))
+	return SPLICE;
+    if (S_ISSOCK(st.st_mode))
+	return SENDFILE;
+    return READ_WRITE;
+}
+
+
+/* in is the regular file being written to, and copying it would reach
+   what has been written to it: the output appends, or it already goes on
+   past where in reads from (an empty output, as after > f, is fine)
+*/
+
+int is_output(int in, const struct stat *out_st)
+{
+    struct stat st;
+    off_t pos;
+    int flags;
+
+    if (!S_ISREG(out_st->st_mode) || fstat(in, &st) == -1 || !S_ISREG(st.st_mode)
+	|| st.st_dev != out_st->st_dev || st.st_ino != out_st->st_ino)
+	return 0;
+
+    if ((flags = fcntl(STDOUT_FILENO, F_GETFL)) != -1 && (flags & O_APPEND))
+	return 1;
+    pos = lseek(in, 0, SEEK_CUR);
+    return fstat(STDOUT_FILENO, &st) == 0 && (pos == -1 ? 0 : pos) < st.st_size;
+}
+
+
+int cat_fd(int in, int out, int method)
+{
+    ssize_t n;
+
+    if (method != READ_WRITE)
+    {
+	while ((n = fast_copy(in, out, method)) > 0)
+	    ;
+
+	if (n == 0)
+	    return 0;
+
+	if (errno != EINVAL && errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF)
+	    return -1;
+
+	/* not possible for this pair: nothing was lost, since the failed
+	   call didn't move any data, so carry on from the current offset */
+    }
+
+    return copy_read_write(in, out);
+}
+
+
+ssize_t fast_copy(int in, int out, int method)     /* bytes moved, 0 at end of input, -1 on error */
+{
+    ssize_t n;
+
+    do
+    {
+	switch (method)
+	{
+	case COPY_FILE_RANGE:
+	    n = copy_file_range(in, 0, out, 0, CHUNK, 0);
+	    break;
+	case SPLICE:
+	    n = splice(in, 0, out, 0, CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+	    break;
+	default:
+	    n = sendfile(out, in, 0, CHUNK);
+	    break;
+	}
+    }
+    while (n == -1 && errno == EINTR);
+
+    return n;
+}
+
+
+int copy_read_write(int in, int out)
+{
+    ssize_t n, m, done;
+
+    while (1)
+    {
+	if ((n = read(in, buffer, CHUNK)) == -1)
+	{
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+
+	if (n == 0)
+	    return 0;
+
+	for (done = 0; done < n; done += m)
+	{
+	    if ((m = write(out, buffer + done, n - done)) == -1)
+	    {
+		if (errno == EINTR)
+		{
+		    m = 0;
+		    continue;
+		}
+		return -1;
+	    }
+	}
+    }
+}
@@ -0,0 +1,49 @@
+#!/bin/sh
+# compare mycat with coreutils cat on a large file, for each kind of output:
+#   mycat_bench.sh [GiB] [directory for the test files]
+#
+# The input is read from the page cache (it's read once before timing);
+# as root, set DROP_CACHES=1 to time cold reads instead.
+
+GIB=${1:-2}
+DIR=${2:-${TMPDIR:-/tmp}}
+IN=$DIR/mycat_bench.in
+OUT=$DIR/mycat_bench.out
+
+cd "$(dirname "$0")" || exit 1
+gcc -O2 -Wall mycat.c -o mycat || exit 1
+
+echo "creating a $GIB GiB input file in $DIR"
+head -c $((GIB * 1024 * 1024 * 1024)) /dev/urandom > "$IN" || exit 1
+cat "$IN" > /dev/null
+
+run() {     # run name command...: print the elapsed time and throughput
+    name=$1
+    shift
+    [ "$DROP_CACHES" = 1 ] && sync && echo 3 > /proc/sys/vm/drop_caches
+    rm -f "$OUT"
+    start=$(date +%s.%N)
+    "$@"
+    end=$(date +%s.%N)
+    echo "$name $start $end ${SIZE:-$GIB}" | awk '{ t = $3 - $2; printf "  %-8s %7.3f s %8.2f GiB/s\n", $1, t, $4 / t }'
+}
+
+echo "to a regular file:"
+run cat   sh -c "cat '$IN' > '$OUT'"
+run mycat sh -c "./mycat '$IN' > '$OUT'"
+cmp -s "$IN" "$OUT" || echo "  mycat output differs!"
+
+echo "to a pipe:"
+run cat   sh -c "cat '$IN' | dd of=/dev/null bs=1M status=none"
+run mycat sh -c "./mycat '$IN' | dd of=/dev/null bs=1M status=none"
+
+echo "to /dev/null (read/write):"
+run cat   sh -c "cat '$IN' > /dev/null"
+run mycat sh -c "./mycat '$IN' > /dev/null"
+
+echo "two copies concatenated, to a regular file:"
+SIZE=$((GIB * 2))
+run cat   sh -c "cat '$IN' '$IN' > '$OUT'"
+run mycat sh -c "./mycat '$IN' '$IN' > '$OUT'"
+
+rm -f "$IN" "$OUT" mycat
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+
+/* how long it takes to start a program, as ex6.c does, by each of the
+   ways a process can be created:
+
+     fork          copies the parent's page tables (the pages themselves
+                   are shared copy-on-write), so it costs more the bigger
+                   the parent
+     vfork         shares the parent's memory, and suspends the parent
+                   until the child has exec'd or exited
+     posix_spawn   glibc's, which is built on clone(CLONE_VM | CLONE_VFORK)
+     clone3        fork-like: a new address space (but straight to the
+                   kernel, so glibc's fork handlers don't run)
+     clone3-vfork  clone3 with CLONE_VM | CLONE_VFORK, running the child on
+                   its own small stack
+
+   and, for each, as a function of the parent's size (a private mapping
+   with every page touched) and of how many other threads it has (idle):
+
+     spawnbench [-n runs] [-r MiB,...] [-t threads,...] [-o csv] [-x program]
+
+   Each run times two things: spawn to exec, when the child's copy of a
+   close-on-exec pipe closes; and spawn to exit, when waitpid returns.
+   The exec'd program is /bin/true unless -x says otherwise.  Every run
+   goes in the CSV (spawnbench.csv by default); the summary on standard
+   output gives the median for each method.  Sizes of several GiB need
+   the memory to match: -r 1,256,4096 for instance.
+
+   gcc -O2 -pthread spawnbench.c -o spawnbench
+*/
+
+#define MAX_LIST 16
+#define CHILD_STACK (64 << 10)
+
+enum { FORK, VFORK, POSIX_SPAWN, CLONE3, CLONE3_VFORK, METHODS };
+
+const char *method_names[] = { "fork", "vfork", "posix_spawn", "clone3", "clone3-vfork" };
+
+char *program = "/bin/true";
+char *child_argv[2];
+extern char **environ;
+
+pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+int stop_idlers;
+
+int parse_list(char *s, long *list);
+pid_t spawn(int method);
+int child_exec(void *arg);
+pid_t clone3_run(struct clone_args *args, int (*fn)(void *), void *arg);
+void *idler(void *arg);
+int compare(const void *a, const void *b);
+double now();
+
+
+int main(int argc, char **argv)
+{
+    long sizes[MAX_LIST] = { 1, 64, 1024 }, threads[MAX_LIST] = { 0, 16 };
+    int n_sizes = 3, n_threads = 2, runs = 200, opt, s, t, m, i, status, pipe_fd[2];
+    char *csv_name = "spawnbench.csv", *memory, c;
+    double start, *exec_us, *exit_us, exec_median[METHODS], exit_median[METHODS];
+    pthread_t *ids;
+    FILE *csv;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "n:r:t:o:x:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'n': runs = atoi(optarg); break;
+	case 'r': n_sizes = parse_list(optarg, sizes); break;
+	case 't': n_threads = parse_list(optarg, threads); break;
+	case 'o': csv_name = optarg; break;
+	case 'x': program = optarg; break;
+	default:
+	    fprintf(stderr, "usage: %s [-n runs] [-r MiB,...] [-t threads,...] [-o csv] [-x program]\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    child_argv[0] = program;
+    exec_us = malloc(runs * sizeof(double));
+    exit_us = malloc(runs * sizeof(double));
+    if (runs < 1 || n_sizes < 1 || n_threads < 1 || !exec_us || !exit_us || (csv = fopen(csv_name, "w")) == 0)
+    {
+	fprintf(stderr, "spawnbench: bad arguments, or can't create %s\n", csv_name);
+	exit(EXIT_FAILURE);
+    }
+
+    fprintf(csv, "method,rss_mib,threads,run,exec_us,exit_us\n");
+    printf("median spawn-to-exec / spawn-to-exit, us, %d runs of %s\n\n%8s %8s", runs, program, "MiB", "threads");
+    for (m = 0; m < METHODS; m++)
+	printf(" %17s", method_names[m]);
+    printf("\n");
+
+    for (s = 0; s < n_sizes; s++)
+    {
+	memory = mmap(0, sizes[s] << 20, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+	    fprintf(stderr, "spawnbench: can't map %ld MiB\n", sizes[s]);
+	    continue;
+	}
+	memset(memory, 1, sizes[s] << 20);     /* make it all resident */
+
+	for (t = 0; t < n_threads; t++)
+	{
+	    ids = malloc((threads[t] + 1) * sizeof(pthread_t));
+	    stop_idlers = 0;
+	    for (i = 0; i < threads[t]; i++)
+		pthread_create(&ids[i], 0, idler, 0);
+
+	    for (m = 0; m < METHODS; m++)
+	    {
+		for (i = 0; i < runs; i++)
+		{
+		    if (pipe2(pipe_fd, O_CLOEXEC) == -1)
+		    {
+			perror("spawnbench: pipe2 failed");
+			exit(EXIT_FAILURE);
+		    }
+
+		    start = now();
+		    if ((pid = spawn(m)) == -1)
+		    {
+			fprintf(stderr, "spawnbench: %s failed: %s\n", method_names[m], strerror(errno));
+			exit(EXIT_FAILURE);
+		    }
+		    close(pipe_fd[1]);
+		    while (read(pipe_fd[0], &c, 1) == -1 && errno == EINTR)     /* end of file: the child has exec'd */
+			;
+		    exec_us[i] = (now() - start) * 1e6;
+		    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+			;
+		    exit_us[i] = (now() - start) * 1e6;
+		    close(pipe_fd[0]);
+
+		    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		    {
+			fprintf(stderr, "spawnbench: %s didn't run (%s)\n", program, method_names[m]);
+			exit(EXIT_FAILURE);
+		    }
+
+		    fprintf(csv, "%s,%ld,%ld,%d,%.1f,%.1f\n", method_names[m], sizes[s], threads[t],
+			    i, exec_us[i], exit_us[i]);
+		}
+
+		qsort(exec_us, runs, sizeof(double), compare);
+		qsort(exit_us, runs, sizeof(double), compare);
+		exec_median[m] = exec_us[runs / 2];
+		exit_median[m] = exit_us[runs / 2];
+	    }
+
+	    printf("%8ld %8ld", sizes[s], threads[t]);
+	    for (m = 0; m < METHODS; m++)
+		printf(" %8.0f/%-8.0f", exec_median[m], exit_median[m]);
+	    printf("\n");
+	    fflush(stdout);
+
+	    pthread_mutex_lock(&idle_lock);
+	    stop_idlers = 1;
+	    pthread_cond_broadcast(&idle_cond);
+	    pthread_mutex_unlock(&idle_lock);
+	    for (i = 0; i < threads[t]; i++)
+		pthread_join(ids[i], 0);
+	    free(ids);
+	}
+
+	munmap(memory, sizes[s] << 20);
+    }
+
+    fclose(csv);
+    printf("\nevery run is in %s\n", csv_name);
+    return 0;
+}
+
+
+int parse_list(char *s, long *list)     /* comma-separated numbers: how many */
+{
+    int n = 0;
+
+    for (s = strtok(s, ","); s && n < MAX_LIST; s = strtok(0, ","))
+	list[n++] = atol(s);
+    return n;
+}
+
+
+pid_t spawn(int method)     /* start the program by method: the child's pid, or -1 */
+{
+    static char *stack;
+    struct clone_args args;
+    pid_t pid;
+
+    switch (method)
+    {
+    case FORK:
+	if ((pid = fork()) == 0)
+	    _exit(child_exec(0));
+	return pid;
+
+    case VFORK:
+	/* the child may only exec or _exit: it's running in our memory, on our stack */
+	if ((pid = vfork()) == 0)
+	{
+	    execve(program, child_argv, environ);
+	    _exit(127);
+	}
+	return pid;
+
+    case POSIX_SPAWN:
+	if ((errno = posix_spawn(&pid, program, 0, 0, child_argv, environ)) != 0)
+	    return -1;
+	return pid;
+
+    default:
+	if (stack == 0 && (stack = aligned_alloc(16, CHILD_STACK)) == 0)
+	    return -1;
+	memset(&args, 0, sizeof(args));
+	args.flags = method == CLONE3_VFORK ? CLONE_VM | CLONE_VFORK : 0;
+	args.exit_signal = SIGCHLD;
+	args.stack = (unsigned long)stack;
+	args.stack_size = CHILD_STACK;
+	return clone3_run(&args, child_exec, 0);
+    }
+}
+
+
+int child_exec(void *arg)
+{
+    execve(program, child_argv, environ);
+    return 127;
+}
+
+
+/* clone3, with the child calling fn(arg) on the stack in args and exiting
+   with its result.  The raw system call returns in the child with the new
+   stack pointer, so the child can't return from any function - it's all
+   done here, in the same asm: fn and arg are in callee-saved registers,
+   which the child inherits. */
+pid_t clone3_run(struct clone_args *args, int (*fn)(void *), void *arg)
+{
+    register void *r12 __asm__("r12") = fn;
+    register void *r13 __asm__("r13") = arg;
+    long ret;
+
+    __asm__ volatile ("syscall\n\t"
+		      "testq %%rax, %%rax\n\t"
+		      "jnz 1f\n\t"
+		      "xorl %%ebp, %%ebp\n\t"     /* the child */
+		      "movq %%r13, %%rdi\n\t"
+		      "callq *%%r12\n\t"
+		      "movl %%eax, %%edi\n\t"
+		      "movl %[exit], %%eax\n\t"
+		      "syscall\n"
+		      "1:"
+		      : "=a" (ret)
+		      : "a" (SYS_clone3), "D" (args), "S" (sizeof(*args)), "r" (r12), "r" (r13),
+			[exit] "i" (SYS_exit_group)
+		      : "rcx", "r11", "memory");
+
+    if (ret < 0)
+    {
+	errno = -ret;
+	return -1;
+    }
+    return ret;
+}
+
+
+void *idler(void *arg)     /* a thread that just exists, until told to stop */
+{
+    pthread_mutex_lock(&idle_lock);
+    while (!stop_idlers)
+	pthread_cond_wait(&idle_cond, &idle_lock);
+    pthread_mutex_unlock(&idle_lock);
+    return 0;
+}
+
+
+int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
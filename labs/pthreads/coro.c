@@ -0,0 +1,459 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "coro.h"
+
+#define GUARD_SIZE 4096
+#define FAIRNESS 61     /* look at the shared queue first every this many runs */
+
+typedef struct Coro_Worker
+{
+    void *sp;                           /* the scheduler's stack while a coroutine runs */
+    pthread_t thread;
+    Coro *current;
+    Coro *run_head, *run_tail;          /* this worker's run queue (only it touches it) */
+    Coro *wheel[CORO_WHEEL_SLOTS];      /* sleepers, by wake tick */
+    int nsleeping;
+    uint64_t tick;                      /* wheel has been advanced up to here */
+    unsigned long runs;
+}
+    Coro_Worker;
+
+static struct
+{
+    Coro_Worker *workers;
+    int nworkers;
+    int stop;
+
+    pthread_mutex_t lock;               /* protects the spawn queue and stop */
+    pthread_cond_t work;
+    Coro *head, *tail;                  /* spawned, not yet picked up by a worker */
+
+    _Atomic long live;                  /* spawned and not yet returned */
+    pthread_cond_t all_done;
+
+    pthread_mutex_t pool_lock;
+    Coro *pool;                         /* coroutines (with their stacks) for reuse */
+
+    struct timespec epoch;
+}
+    rt = { 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0,
+	   PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 0 };
+
+static _Thread_local Coro_Worker *self;
+
+extern void coro_start(void);     /* coro_switch.s */
+
+static void *worker(void *arg);
+static void run(Coro_Worker *w, Coro *c);
+static Coro *current(void);
+static void coro_main(Coro *c);
+static Coro *take_spawned(int wait, Coro_Worker *w);
+static void push_local(Coro_Worker *w, Coro *c);
+static Coro *pop_local(Coro_Worker *w);
+static void wheel_add(Coro_Worker *w, Coro *c);
+static void wheel_advance(Coro_Worker *w);
+static uint64_t now_tick(void);
+static Coro *alloc_coro(void);
+static void free_coro(Coro *c);
+
+
+int coro_init(int nworkers)
+{
+    pthread_condattr_t attr;
+    int i, rc;
+
+    if (rt.workers)
+	return 0;
+
+    if (nworkers <= 0)
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers > CORO_MAX_WORKERS)
+	nworkers = CORO_MAX_WORKERS;
+
+    if ((rt.workers = calloc(nworkers, sizeof(Coro_Worker))) == 0)
+	return -1;
+
+    pthread_condattr_init(&attr);     /* idle workers with sleepers wait with a timeout */
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&rt.work, &attr);
+    pthread_condattr_destroy(&attr);
+
+    clock_gettime(CLOCK_MONOTONIC, &rt.epoch);
+    rt.stop = 0;
+    rt.nworkers = nworkers;
+
+    for (i = 0; i < nworkers; i++)
+    {
+	rt.workers[i].tick = now_tick();
+
+	if ((rc = pthread_create(&rt.workers[i].thread, 0, worker, &rt.workers[i])) != 0)
+	{
+	    rt.nworkers = i;
+	    coro_shutdown();
+	    errno = rc;
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+Coro *coro_spawn(void (*fn)(void *), void *arg)
+{
+    Coro *c;
+
+    if ((c = alloc_coro()) == 0)
+	return 0;
+
+    c->fn = fn;
+    c->arg = arg;
+    c->state = CORO_READY;
+    c->next = 0;
+    atomic_fetch_add(&rt.live, 1);
+
+    pthread_mutex_lock(&rt.lock);
+    if (rt.tail)
+	rt.tail->next = c;
+    else
+	rt.head = c;
+    rt.tail = c;
+    pthread_cond_signal(&rt.work);
+    pthread_mutex_unlock(&rt.lock);
+
+    return c;
+}
+
+
+void coro_yield(void)
+{
+    Coro *c = current();
+
+    if (c == 0)
+    {
+	sched_yield();     /* called from an ordinary thread */
+	return;
+    }
+
+    c->state = CORO_READY;
+    coro_switch(&c->sp, c->worker->sp);
+}
+
+
+void coro_sleep_ms(unsigned ms)
+{
+    Coro *c = current();
+    struct timespec t;
+
+    if (c == 0)
+    {
+	t.tv_sec = ms / 1000;
+	t.tv_nsec = (ms % 1000) * 1000000L;
+	nanosleep(&t, 0);
+	return;
+    }
+
+    c->wake_tick = now_tick() + (ms > 0 ? ms : 1);
+    c->state = CORO_SLEEPING;
+    coro_switch(&c->sp, c->worker->sp);
+}
+
+
+void coro_wait_all(void)
+{
+    pthread_mutex_lock(&rt.lock);
+    while (atomic_load(&rt.live) > 0)
+	pthread_cond_wait(&rt.all_done, &rt.lock);
+    pthread_mutex_unlock(&rt.lock);
+}
+
+
+void coro_shutdown(void)     /* after coro_wait_all: coroutines still running are abandoned */
+{
+    Coro *c;
+    int i;
+
+    if (rt.workers == 0)
+	return;
+
+    pthread_mutex_lock(&rt.lock);
+    rt.stop = 1;
+    pthread_cond_broadcast(&rt.work);
+    pthread_mutex_unlock(&rt.lock);
+
+    for (i = 0; i < rt.nworkers; i++)
+	pthread_join(rt.workers[i].thread, 0);
+
+    free(rt.workers);
+    rt.workers = 0;
+    rt.nworkers = 0;
+
+    while ((c = rt.pool) != 0)
+    {
+	rt.pool = c->next;
+	munmap(c->stack, CORO_STACK_SIZE);
+    }
+}
+
+
+/* ---- workers ---- */
+
+static void *worker(void *arg)
+{
+    Coro_Worker *w = (Coro_Worker *)arg;
+    Coro *c;
+
+    self = w;
+
+    while (1)
+    {
+	wheel_advance(w);
+
+	if (++w->runs % FAIRNESS == 0 && (c = take_spawned(0, w)) != 0)
+	    run(w, c);
+	else if ((c = pop_local(w)) != 0 || (c = take_spawned(0, w)) != 0)
+	    run(w, c);
+	else if ((c = take_spawned(1, w)) != 0)     /* nothing to do: wait */
+	    run(w, c);
+	else if (rt.stop)
+	    return 0;
+    }
+}
+
+
+static void run(Coro_Worker *w, Coro *c)
+{
+    w->current = c;
+    c->worker = w;
+
+    coro_switch(&w->sp, c->sp);     /* until it yields, sleeps or returns */
+
+    w->current = 0;
+
+    switch (c->state)
+    {
+    case CORO_READY:
+	push_local(w, c);
+	break;
+
+    case CORO_SLEEPING:
+	wheel_add(w, c);
+	break;
+
+    case CORO_DONE:     /* we're off its stack now, so it can be reused */
+	free_coro(c);
+	if (atomic_fetch_sub(&rt.live, 1) == 1)
+	{
+	    pthread_mutex_lock(&rt.lock);
+	    pthread_cond_broadcast(&rt.all_done);
+	    pthread_mutex_unlock(&rt.lock);
+	}
+	break;
+    }
+}
+
+
+static Coro *current(void)     /* the running coroutine, or 0 outside one */
+{
+    return self ? self->current : 0;
+}
+
+
+static void coro_main(Coro *c)     /* bottom of every coroutine's stack (via coro_start) */
+{
+    c->fn(c->arg);
+    c->state = CORO_DONE;
+    coro_switch(&c->sp, c->worker->sp);     /* never resumed */
+}
+
+
+/* one spawned coroutine, or 0.  With wait set, an idle worker blocks until
+   one is spawned, the runtime stops, or (if it has sleepers) the next
+   timer tick.
+*/
+
+static Coro *take_spawned(int wait, Coro_Worker *w)
+{
+    struct timespec t;
+    Coro *c;
+
+    pthread_mutex_lock(&rt.lock);
+
+    if (wait && rt.head == 0 && !rt.stop)
+    {
+	if (w->nsleeping > 0)
+	{
+	    clock_gettime(CLOCK_MONOTONIC, &t);
+	    if ((t.tv_nsec += 1000000) >= 1000000000)
+	    {
+		t.tv_sec++;
+		t.tv_nsec -= 1000000000;
+	    }
+	    pthread_cond_timedwait(&rt.work, &rt.lock, &t);
+	}
+	else
+	    pthread_cond_wait(&rt.work, &rt.lock);
+    }
+
+    if ((c = rt.head) != 0)
+    {
+	if ((rt.head = c->next) == 0)
+	    rt.tail = 0;
+	c->next = 0;
+    }
+
+    pthread_mutex_unlock(&rt.lock);
+    return c;
+}
+
+
+static void push_local(Coro_Worker *w, Coro *c)
+{
+    c->next = 0;
+    if (w->run_tail)
+	w->run_tail->next = c;
+    else
+	w->run_head = c;
+    w->run_tail = c;
+}
+
+
+static Coro *pop_local(Coro_Worker *w)
+{
+    Coro *c = w->run_head;
+
+    if (c && (w->run_head = c->next) == 0)
+	w->run_tail = 0;
+
+    return c;
+}
+
+
+/* ---- the timer wheel ---- */
+
+static void wheel_add(Coro_Worker *w, Coro *c)
+{
+    Coro **slot;
+
+    if (c->wake_tick <= w->tick)
+    {
+	push_local(w, c);
+	return;
+    }
+
+    slot = &w->wheel[c->wake_tick & (CORO_WHEEL_SLOTS - 1)];
+    c->next = *slot;
+    *slot = c;
+    w->nsleeping++;
+}
+
+
+/* wake everything due by now.  Each tick since the last call has its own
+   slot; a slot holds sleepers for that tick of every lap, so ones due on a
+   later lap stay put.  One lap covers every slot, however long it's been.
+*/
+
+static void wheel_advance(Coro_Worker *w)
+{
+    uint64_t now = now_tick(), t, end;
+    Coro **p, *c;
+
+    if (w->nsleeping == 0)
+    {
+	w->tick = now;
+	return;
+    }
+
+    end = now - w->tick > CORO_WHEEL_SLOTS ? w->tick + CORO_WHEEL_SLOTS : now;
+
+    for (t = w->tick + 1; t <= end; t++)
+    {
+	p = &w->wheel[t & (CORO_WHEEL_SLOTS - 1)];
+
+	while ((c = *p) != 0)
+	{
+	    if (c->wake_tick <= now)
+	    {
+		*p = c->next;
+		w->nsleeping--;
+		push_local(w, c);
+	    }
+	    else
+		p = &c->next;
+	}
+    }
+
+    w->tick = now;
+}
+
+
+static uint64_t now_tick(void)     /* milliseconds since coro_init */
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)(t.tv_sec - rt.epoch.tv_sec) * 1000 + (t.tv_nsec - rt.epoch.tv_nsec) / 1000000;
+}
+
+
+/* ---- stacks ---- */
+
+/* a coroutine lives at the top of its own stack mapping: the Coro, then
+   the stack growing down from below it to the guard page.  A new one's
+   stack starts with a frame for coro_switch to "return" through: the
+   control words, r15 .. rbp, and coro_start as the return address, which
+   calls coro_main(c) on a 16-byte aligned stack.
+*/
+
+static Coro *alloc_coro(void)
+{
+    Coro *c;
+    char *stack;
+    uint64_t *frame;
+
+    pthread_mutex_lock(&rt.pool_lock);
+    if ((c = rt.pool) != 0)
+	rt.pool = c->next;
+    pthread_mutex_unlock(&rt.pool_lock);
+
+    if (c == 0)
+    {
+	stack = mmap(0, CORO_STACK_SIZE, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (stack == MAP_FAILED)
+	    return 0;
+	mprotect(stack, GUARD_SIZE, PROT_NONE);
+
+	c = (Coro *)(stack + CORO_STACK_SIZE - ((sizeof(Coro) + 63) & ~63UL));
+	c->stack = stack;
+    }
+
+    frame = (uint64_t *)((uintptr_t)c & ~15UL) - 8;
+    frame[0] = 0x1f80 | (0x037fULL << 32);     /* default mxcsr, x87 control word */
+    frame[1] = 0;                              /* r15 */
+    frame[2] = 0;                              /* r14 */
+    frame[3] = (uint64_t)c;                    /* r13: argument */
+    frame[4] = (uint64_t)coro_main;            /* r12: function */
+    frame[5] = 0;                              /* rbx */
+    frame[6] = 0;                              /* rbp */
+    frame[7] = (uint64_t)coro_start;           /* return address */
+    c->sp = frame;
+
+    return c;
+}
+
+
+static void free_coro(Coro *c)
+{
+    pthread_mutex_lock(&rt.pool_lock);
+    c->next = rt.pool;
+    rt.pool = c;
+    pthread_mutex_unlock(&rt.pool_lock);
+}
@@ -0,0 +1,75 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* stackful coroutines run M:N on a few worker threads.
+
+   A coroutine is a function with its own small stack.  Switching between
+   coroutines (coro_switch.s) saves the callee-saved registers on the old
+   stack and loads them from the new one - no system call, no kernel
+   scheduler - so a blocked coroutine costs a stack and a few words
+   instead of a kernel thread.
+
+   Stacks come from a pool: CORO_STACK_SIZE bytes of mmap'd memory each,
+   with an inaccessible guard page at the bottom so an overflow faults
+   instead of overwriting a neighbour.  Only the pages a coroutine actually
+   touches take up memory.
+
+   Each worker thread runs coroutines from its own run queue (coroutines
+   that yielded or woke up there) and takes newly spawned ones from a
+   shared queue.  coro_sleep_ms parks the coroutine on the worker's timer
+   wheel: CORO_WHEEL_SLOTS lists, one per millisecond tick, so putting a
+   sleeper on the wheel and waking it are both O(1); deadlines further
+   away than one turn of the wheel wait for the right lap.
+
+   Usage:
+       coro_init(4);                            4 worker threads (0: one per core)
+       coro_spawn(fn, arg);                     any number of times, from anywhere
+       coro_wait_all();                         until every coroutine has returned
+       coro_shutdown();
+
+       inside a coroutine: coro_yield(), coro_sleep_ms(ms), coro_spawn(...)
+
+   A coroutine stays on the worker that first picked it up: it is requeued
+   there after each yield or sleep, and idle workers don't steal from busy
+   ones, so a worker with many long-lived coroutines can be loaded while
+   another sits idle.  It mustn't hold a pthread mutex across a yield or
+   sleep (another coroutine on the same worker could block on it for ever),
+   and coroutines must not block their worker in the kernel for long (e.g.
+   nanosleep instead of coro_sleep_ms).
+*/
+
+#define CORO_STACK_SIZE (64 * 1024)     /* including the guard page */
+#define CORO_WHEEL_SLOTS 256            /* 1 ms ticks (a power of two) */
+#define CORO_MAX_WORKERS 64
+
+typedef struct Coro Coro;
+
+struct Coro
+{
+    void *sp;                   /* saved stack pointer while not running */
+    char *stack;                /* lowest address of the mapping (the guard page) */
+    void (*fn)(void *);
+    void *arg;
+    int state;                  /* CORO_READY, CORO_SLEEPING, CORO_DONE */
+    uint64_t wake_tick;         /* sleeping: tick to wake at */
+    Coro *next;                 /* run queue / timer wheel / stack pool link */
+    struct Coro_Worker *worker; /* the worker running it (while running) */
+};
+
+enum { CORO_READY, CORO_SLEEPING, CORO_DONE };
+
+int coro_init(int nworkers);
+Coro *coro_spawn(void (*fn)(void *), void *arg);
+void coro_yield(void);
+void coro_sleep_ms(unsigned ms);
+void coro_wait_all(void);
+void coro_shutdown(void);
+
+void coro_switch(void **save_sp, void *load_sp);     /* coro_switch.s */
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "coro.h"
+
+/* coroutines (coro.h) against a kernel thread per task, as in intro.c:
+
+     create     spawn and finish tasks that do nothing: cost per task
+     switch     hand control back and forth: a coroutine yielding to its
+                worker, against two threads taking turns on a condition
+                variable - cost per switch
+     sleepers   many tasks that repeatedly sleep, as intro.c's threads do:
+                wall time and resident memory per task
+*/
+
+#define SLEEP_MS 10
+#define SLEEPS 10
+#define THREAD_BATCH 1000
+
+long switches = 1000000;
+int turn;
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+void nothing(void *arg);
+void *thread_nothing(void *arg);
+void yielder(void *arg);
+void *thread_pingpong(void *arg);
+void sleeper(void *arg);
+void *thread_sleeper(void *arg);
+long rss_kb();
+double now();
+
+
+int main(int argc, char **argv)
+{
+    int opt, workers = 4, i, j, n;
+    long tasks = 10000, threads = 1000, rss, coro_rss, thread_rss;
+    pthread_t *ids, a, b;
+    double t, coro_ms;
+
+    while ((opt = getopt(argc, argv, "n:p:w:s:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'n': tasks = atol(optarg); break;
+	case 'p': threads = atol(optarg); break;
+	case 'w': workers = atoi(optarg); break;
+	case 's': switches = atol(optarg); break;
+	default:
+	    fprintf(stderr, "usage: %s [-n coroutines] [-p threads] [-w workers] [-s switches]\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    if (coro_init(workers) == -1 || (ids = malloc(sizeof(pthread_t) * THREAD_BATCH)) == 0)
+    {
+	perror("setup failed");
+	exit(EXIT_FAILURE);
+    }
+
+    printf("%d workers\n\n%-10s %14s %14s\n", workers, "", "coroutines", "pthreads");
+
+    /* create */
+    t = now();
+    for (i = 0; i < tasks; i++)
+	coro_spawn(nothing, 0);
+    coro_wait_all();
+    printf("%-10s %11.3f us", "create", (now() - t) / tasks * 1e6);
+
+    t = now();
+    for (i = 0; i < threads; i += n)
+    {
+	n = threads - i < THREAD_BATCH ? threads - i : THREAD_BATCH;
+	for (j = 0; j < n; j++)
+	    pthread_create(&ids[j], 0, thread_nothing, 0);
+	for (j = 0; j < n; j++)
+	    pthread_join(ids[j], 0);
+    }
+    printf(" %11.3f us\n", (now() - t) / threads * 1e6);
+
+    /* switch */
+    t = now();
+    coro_spawn(yielder, 0);
+    coro_wait_all();
+    printf("%-10s %11.1f ns", "switch", (now() - t) / (2.0 * switches) * 1e9);
+
+    t = now();
+    pthread_create(&a, 0, thread_pingpong, (void *)0);
+    pthread_create(&b, 0, thread_pingpong, (void *)1);
+    pthread_join(a, 0);
+    pthread_join(b, 0);
+    printf(" %11.1f ns\n", (now() - t) / (2.0 * switches) * 1e9);
+
+    /* sleepers */
+    printf("\n%ld coroutines / %ld threads sleeping %d x %d ms:\n", tasks, threads, SLEEPS, SLEEP_MS);
+
+    rss = rss_kb();
+    t = now();
+    for (i = 0; i < tasks; i++)
+	coro_spawn(sleeper, 0);
+    coro_wait_all();
+    coro_ms = (now() - t) * 1e3;
+    coro_rss = rss_kb() - rss;     /* the pooled stacks are still resident */
+
+    free(ids);
+    if ((ids = malloc(sizeof(pthread_t) * threads)) == 0)
+	exit(EXIT_FAILURE);
+
+    rss = rss_kb();
+    t = now();
+    for (i = 0; i < threads; i++)
+	if (pthread_create(&ids[i], 0, thread_sleeper, 0) != 0)
+	{
+	    fprintf(stderr, "pthread_create failed after %d threads\n", i);
+	    threads = i;
+	}
+    thread_rss = rss_kb() - rss;     /* while they're all alive */
+    for (i = 0; i < threads; i++)
+	pthread_join(ids[i], 0);
+
+    printf("%-10s %11.1f ms %11.1f ms\n", "wall time", coro_ms, (now() - t) * 1e3);
+    printf("%-10s %11.1f kB %11.1f kB\n", "rss/task", (double)coro_rss / tasks, (double)thread_rss / threads);
+
+    free(ids);
+    coro_shutdown();
+    return 0;
+}
+
+
+void nothing(void *arg)
+{
+}
+
+
+void *thread_nothing(void *arg)
+{
+    return 0;
+}
+
+
+void yielder(void *arg)
+{
+    long i;
+
+    for (i = 0; i < switches; i++)
+	coro_yield();
+}
+
+
+void *thread_pingpong(void *arg)     /* take turns with the other thread */
+{
+    int me = (int)(long)arg;
+    long i;
+
+    for (i = 0; i < switches; i++)
+    {
+	pthread_mutex_lock(&lock);
+	while (turn != me)
+	    pthread_cond_wait(&cond, &lock);
+	turn = !me;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+    }
+
+    return 0;
+}
+
+
+void sleeper(void *arg)
+{
+    int i;
+
+    for (i = 0; i < SLEEPS; i++)
+	coro_sleep_ms(SLEEP_MS);
+}
+
+
+void *thread_sleeper(void *arg)
+{
+    struct timespec t = { 0, SLEEP_MS * 1000000L };
+    int i;
+
+    for (i = 0; i < SLEEPS; i++)
+	nanosleep(&t, 0);
+
+    return 0;
+}
+
+
+long rss_kb()     /* resident set size, from /proc/self/status */
+{
+    char line[128];
+    long kb = 0;
+    FILE *f;
+
+    if ((f = fopen("/proc/self/status", "r")) == 0)
+	return 0;
+
+    while (fgets(line, sizeof(line), f))
+	if (strncmp(line, "VmRSS:", 6) == 0)
+	    kb = atol(line + 6);
+
+    fclose(f);
+    return kb;
+}
+
+
+double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,51 @@
+/* context switch for coro.c (x86-64 System V).
+
+   void coro_switch(void **save_sp, void *load_sp)
+
+   Pushes the callee-saved registers (and the SSE and x87 control words)
+   onto the current stack, stores the stack pointer in *save_sp, switches
+   to load_sp and pops the same frame from there.  The caller-saved
+   registers don't need saving: the C compiler already assumes a call
+   clobbers them.  The final ret returns into whichever coroutine (or
+   scheduler) saved load_sp.
+
+   A new coroutine's stack is set up by coro.c to look like a saved frame
+   whose return address is coro_start, with the function to call in r12
+   and its argument in r13.
+*/
+
+	.global	coro_switch
+	.global	coro_start
+
+	.text
+coro_switch:
+	pushq	%rbp
+	pushq	%rbx
+	pushq	%r12
+	pushq	%r13
+	pushq	%r14
+	pushq	%r15
+	subq	$8, %rsp
+	stmxcsr	(%rsp)		/* SSE rounding mode etc. */
+	fnstcw	4(%rsp)		/* x87 control word */
+
+	movq	%rsp, (%rdi)	/* *save_sp = rsp */
+	movq	%rsi, %rsp	/* rsp = load_sp */
+
+	ldmxcsr	(%rsp)
+	fldcw	4(%rsp)
+	addq	$8, %rsp
+	popq	%r15
+	popq	%r14
+	popq	%r13
+	popq	%r12
+	popq	%rbx
+	popq	%rbp
+	ret
+
+coro_start:
+	movq	%r13, %rdi	/* r12(r13): the stack is 16-byte aligned here */
+	callq	*%r12		/* doesn't return */
+	ud2
+
+	.section	.note.GNU-stack,"",@progbits
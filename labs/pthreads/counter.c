@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "counter.h"
+
+#define SPINS_BEFORE_YIELD 64
+
+static _Atomic int next_slot;
+static _Thread_local int my_slot = -1;
+
+static int slot(void);
+static void combine(Counter *c);
+
+
+Counter *counter_create(Counter_Kind kind)
+{
+    Counter *c = aligned_alloc(64, sizeof(Counter));
+
+    if (c == 0)
+	return 0;
+
+    memset(c, 0, sizeof(*c));
+    c->kind = kind;
+    pthread_mutex_init(&c->lock, 0);
+    return c;
+}
+
+
+void counter_add(Counter *c, long n)
+{
+    Counter_Slot *s;
+    int spins = 0;
+
+    switch (c->kind)
+    {
+    case COUNTER_MUTEX:
+	pthread_mutex_lock(&c->lock);
+	c->value += n;
+	pthread_mutex_unlock(&c->lock);
+	break;
+
+    case COUNTER_ATOMIC:
+	atomic_fetch_add_explicit(&c->total, n, memory_order_relaxed);
+	break;
+
+    case COUNTER_SHARDED:     /* the slot is normally ours alone, so the add is uncontended */
+	atomic_fetch_add_explicit(&c->slots[slot()].value, n, memory_order_relaxed);
+	break;
+
+    case COUNTER_COMBINING:
+	if (n == 0)
+	    return;
+
+	s = &c->slots[slot()];
+	atomic_fetch_add_explicit(&s->value, n, memory_order_release);
+
+	while (atomic_load_explicit(&s->value, memory_order_acquire) != 0)     /* not yet applied */
+	{
+	    if (pthread_mutex_trylock(&c->lock) == 0)
+	    {
+		combine(c);
+		pthread_mutex_unlock(&c->lock);
+	    }
+	    else if (++spins < SPINS_BEFORE_YIELD)
+		__builtin_ia32_pause();
+	    else
+		sched_yield();     /* let the combiner (or whoever has the lock) run */
+	}
+	break;
+
+    default:
+	break;
+    }
+}
+
+
+long counter_read(Counter *c)
+{
+    long sum = 0;
+    int i;
+
+    switch (c->kind)
+    {
+    case COUNTER_MUTEX:
+	pthread_mutex_lock(&c->lock);
+	sum = c->value;
+	pthread_mutex_unlock(&c->lock);
+	break;
+
+    case COUNTER_ATOMIC:
+    case COUNTER_COMBINING:     /* every add is in the total by the time it returns */
+	sum = atomic_load_explicit(&c->total, memory_order_acquire);
+	break;
+
+    case COUNTER_SHARDED:
+	for (i = 0; i < COUNTER_SLOTS; i++)
+	    sum += atomic_load_explicit(&c->slots[i].value, memory_order_relaxed);
+	break;
+
+    default:
+	break;
+    }
+
+    return sum;
+}
+
+
+void counter_destroy(Counter *c)
+{
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+
+const char *counter_kind_name(Counter_Kind kind)
+{
+    static const char *names[] = { "mutex", "atomic", "sharded", "combining" };
+
+    return kind < COUNTER_KINDS ? names[kind] : "?";
+}
+
+
+static int slot(void)
+{
+    if (my_slot == -1)
+	my_slot = atomic_fetch_add(&next_slot, 1) % COUNTER_SLOTS;
+
+    return my_slot;
+}
+
+
+static void combine(Counter *c)     /* holding the combiner lock */
+{
+    long posted[COUNTER_SLOTS], sum = 0;
+    int i, any = 0;
+
+    for (i = 0; i < COUNTER_SLOTS; i++)
+    {
+	sum += posted[i] = atomic_load_explicit(&c->slots[i].value, memory_order_acquire);
+	any |= posted[i] != 0;
+    }
+
+    /* whether anything was posted, not whether it adds up to anything:
+       +5 and -5 in two slots sum to 0, and both posters still wait */
+    if (!any)
+	return;
+
+    if (sum != 0)
+	atomic_store_explicit(&c->total, atomic_load_explicit(&c->total, memory_order_relaxed) + sum,
+			      memory_order_release);
+
+    /* only now let the posters return: a slot reads 0 once its increment
+       is in the total (anything posted since stays for the next pass) */
+    for (i = 0; i < COUNTER_SLOTS; i++)
+	if (posted[i] != 0)
+	    atomic_fetch_sub_explicit(&c->slots[i].value, posted[i], memory_order_release);
+}
@@ -0,0 +1,54 @@
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* a shared event counter (the n of race.c, done properly), with a choice
+   of synchronization:
+
+     mutex       a lock around a plain long
+     atomic      one atomic fetch-and-add per increment - every
+                 increment moves the counter's cache line to the caller
+     sharded     one counter per thread, each on its own cache line;
+                 increments touch only the caller's line, and a read sums
+                 all of them (so reads get slower as writes get faster)
+     combining   each thread posts its increment in its own slot; whoever
+                 gets the combiner lock applies everybody's posted
+                 increments in one pass while the others wait for theirs
+                 to be picked up (flat combining)
+
+   Threads are given slots (shards) on first use, round robin; with more
+   than COUNTER_SLOTS threads, some share a slot, which is still correct
+   but contended.
+*/
+
+#define COUNTER_SLOTS 64
+
+typedef enum { COUNTER_MUTEX, COUNTER_ATOMIC, COUNTER_SHARDED, COUNTER_COMBINING, COUNTER_KINDS } Counter_Kind;
+
+typedef struct
+{
+    _Alignas(64) _Atomic long value;     /* sharded: this slot's count; combining: its posted increment */
+}
+    Counter_Slot;
+
+typedef struct
+{
+    Counter_Kind kind;
+    pthread_mutex_t lock;                /* mutex: protects value; combining: the combiner lock */
+    long value;                          /* mutex */
+
+    _Alignas(64) _Atomic long total;     /* atomic; combining (written by the combiner only) */
+
+    Counter_Slot slots[COUNTER_SLOTS];
+}
+    Counter;
+
+Counter *counter_create(Counter_Kind kind);
+void counter_add(Counter *c, long n);
+long counter_read(Counter *c);
+void counter_destroy(Counter *c);
+const char *counter_kind_name(Counter_Kind kind);
+
+#endif
@@ -0,0 +1,371 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#include "evlog.h"
+
+/* the flusher formats each record as three iovecs: a prefix (timestamp and
+   thread) and a suffix (item) formatted into a scratch buffer, and the
+   event name, which is passed straight from the event table without
+   being copied.
+*/
+
+#define IOVS_PER_RECORD 3
+#define BATCH_RECORDS 256
+#define PREFIX_MAX 96
+#define SUFFIX_MAX 32
+
+_Thread_local Evlog_Buffer *evlog_self;
+uint64_t evlog_epoch_ns;
+
+static struct
+{
+    int fd;
+    unsigned flush_ms;
+    int stop;
+    int running;
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    const char *events[EVLOG_MAX_EVENTS];
+    int nevents;
+
+    Evlog_Buffer *buffers[EVLOG_MAX_THREADS];
+}
+    lg = { -1, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void *flusher(void *);
+static void drain(void);
+static int writev_all(int fd, struct iovec *iov, int cnt);
+static size_t clamp(int len, int size);
+
+
+int evlog_init(int fd, unsigned flush_ms)
+{
+    int rc;
+
+    pthread_mutex_lock(&lg.lock);
+
+    if (lg.running)
+    {
+	pthread_mutex_unlock(&lg.lock);
+	return 0;
+    }
+
+    lg.fd = fd;
+    lg.flush_ms = flush_ms > 0 ? flush_ms : 100;
+    lg.stop = 0;
+    evlog_epoch_ns = evlog_now_ns();
+
+    rc = pthread_create(&lg.flusher, 0, flusher, 0);
+    lg.running = (rc == 0);
+
+    pthread_mutex_unlock(&lg.lock);
+
+    if (rc != 0)
+    {
+	errno = rc;
+	return -1;
+    }
+
+    return 0;
+}
+
+
+int evlog_event(const char *name)
+{
+    int i;
+
+    pthread_mutex_lock(&lg.lock);
+
+    for (i = 0; i < lg.nevents; i++)
+	if (strcmp(lg.events[i], name) == 0)
+	    break;
+
+    if (i == lg.nevents)
+    {
+	if (lg.nevents == EVLOG_MAX_EVENTS)
+	    i = -1;
+	else
+	    lg.events[lg.nevents++] = strdup(name);
+    }
+
+    pthread_mutex_unlock(&lg.lock);
+    return i;
+}
+
+
+int evlog_thread_start(const char *name)
+{
+    int i, slot = -1;
+    Evlog_Buffer *b;
+
+    if (evlog_self)
+	return 0;
+
+    pthread_mutex_lock(&lg.lock);
+
+    for (i = 0; i < EVLOG_MAX_THREADS && slot == -1; i++)
+    {
+	if (lg.buffers[i] == 0)
+	{
+	    lg.buffers[i] = aligned_alloc(64, sizeof(Evlog_Buffer));
+
+	    if (lg.buffers[i] == 0)
+		break;
+
+	    memset(lg.buffers[i], 0, sizeof(Evlog_Buffer));
+	    slot = i;
+	}
+	else if (atomic_load(&lg.buffers[i]->state) == EVLOG_FREE)
+	    slot = i;
+    }
+
+    if (slot == -1)
+    {
+	pthread_mutex_unlock(&lg.lock);
+	return -1;
+    }
+
+    b = lg.buffers[slot];
+    b->tail_cache = atomic_load(&b->tail);
+    b->tid = (uint32_t)syscall(SYS_gettid);
+    b->dropped_reported = atomic_load(&b->dropped);
+    strncpy(b->name, name ? name : "thread", sizeof(b->name) - 1);
+    atomic_store(&b->state, EVLOG_ACTIVE);
+
+    pthread_mutex_unlock(&lg.lock);
+
+    evlog_self = b;
+    return 0;
+}
+
+
+void evlog_thread_exit(void)     /* the flusher frees the ring once drained */
+{
+    if (evlog_self)
+    {
+	atomic_store(&evlog_self->state, EVLOG_RETIRED);
+	evlog_self = 0;
+    }
+}
+
+
+void evlog_shutdown(void)
+{
+    evlog_thread_exit();
+
+    pthread_mutex_lock(&lg.lock);
+
+    if (!lg.running)
+    {
+	pthread_mutex_unlock(&lg.lock);
+	return;
+    }
+
+    lg.stop = 1;
+    pthread_cond_signal(&lg.wake);
+    pthread_mutex_unlock(&lg.lock);
+
+    pthread_join(lg.flusher, 0);
+    lg.running = 0;
+}
+
+
+static void *flusher(void *arg)
+{
+    struct timespec t;
+
+    pthread_mutex_lock(&lg.lock);
+
+    while (!lg.stop)
+    {
+	clock_gettime(CLOCK_REALTIME, &t);
+	t.tv_sec += lg.flush_ms / 1000;
+	t.tv_nsec += (long)(lg.flush_ms % 1000) * 1000000L;
+	if (t.tv_nsec >= 1000000000L)
+	{
+	    t.tv_sec++;
+	    t.tv_nsec -= 1000000000L;
+	}
+
+	pthread_cond_timedwait(&lg.wake, &lg.lock, &t);
+
+	pthread_mutex_unlock(&lg.lock);
+	drain();
+	pthread_mutex_lock(&lg.lock);
+    }
+
+    pthread_mutex_unlock(&lg.lock);
+
+    drain();     /* final pass - pick up anything logged before shutdown */
+    return 0;
+}
+
+
+/* drain every ring once, merging records from different threads by
+   timestamp.  Only the flusher calls this, so it is the sole writer of
+   each ring's tail.
+*/
+
+static void drain(void)
+{
+    static struct iovec iov[BATCH_RECORDS * IOVS_PER_RECORD + 1];
+    static char scratch[BATCH_RECORDS * (PREFIX_MAX + SUFFIX_MAX)];
+    static char drops[EVLOG_MAX_THREADS * 64];
+
+    Evlog_Buffer *bufs[EVLOG_MAX_THREADS];
+    uint64_t pos[EVLOG_MAX_THREADS], end[EVLOG_MAX_THREADS];
+    const char *events[EVLOG_MAX_EVENTS];
+    int i, n = 0, nevents, niov, nrec, used, dused = 0;
+
+    pthread_mutex_lock(&lg.lock);
+
+    for (i = 0; i < EVLOG_MAX_THREADS; i++)
+	if (lg.buffers[i] && atomic_load(&lg.buffers[i]->state) != EVLOG_FREE)
+	    bufs[n++] = lg.buffers[i];
+
+    nevents = lg.nevents;
+    memcpy(events, lg.events, sizeof(events[0]) * nevents);
+
+    pthread_mutex_unlock(&lg.lock);
+
+    for (i = 0; i < n; i++)
+    {
+	int state = atomic_load(&bufs[i]->state);     /* read before head */
+
+	pos[i] = atomic_load_explicit(&bufs[i]->tail, memory_order_relaxed);
+	end[i] = atomic_load_explicit(&bufs[i]->head, memory_order_acquire);
+
+	if (state == EVLOG_RETIRED && pos[i] == end[i])
+	    atomic_store(&bufs[i]->state, EVLOG_FREE);
+    }
+
+    do
+    {
+	niov = nrec = used = 0;
+
+	while (nrec < BATCH_RECORDS)     /* k-way merge: oldest record first */
+	{
+	    int best = -1;
+	    Evlog_Record *r;
+	    Evlog_Buffer *b;
+
+	    for (i = 0; i < n; i++)
+		if (pos[i] < end[i] &&
+		    (best == -1 ||
+		     bufs[i]->ring[pos[i] & (EVLOG_RING_RECORDS - 1)].ts_ns <
+		     bufs[best]->ring[pos[best] & (EVLOG_RING_RECORDS - 1)].ts_ns))
+		    best = i;
+
+	    if (best == -1)
+		break;
+
+	    b = bufs[best];
+	    r = &b->ring[pos[best]++ & (EVLOG_RING_RECORDS - 1)];
+
+	    iov[niov].iov_base = scratch + used;
+	    iov[niov++].iov_len = clamp(snprintf(scratch + used, PREFIX_MAX,
+						 "%6lu.%09lu %s[%u] ",
+						 (unsigned long)(r->ts_ns / 1000000000u),
+						 (unsigned long)(r->ts_ns % 1000000000u),
+						 b->name, r->tid), PREFIX_MAX);
+	    used += iov[niov - 1].iov_len;
+
+	    if (r->event < nevents)
+	    {
+		iov[niov].iov_base = (void *)events[r->event];
+		iov[niov++].iov_len = strlen(events[r->event]);
+	    }
+	    else
+	    {
+		iov[niov].iov_base = "event";
+		iov[niov++].iov_len = 5;
+	    }
+
+	    iov[niov].iov_base = scratch + used;
+	    iov[niov++].iov_len = clamp(snprintf(scratch + used, SUFFIX_MAX,
+						 " %ld\n", (long)r->item), SUFFIX_MAX);
+	    used += iov[niov - 1].iov_len;
+	    nrec++;
+	}
+
+	/* everything in this batch has been copied out - release the slots */
+
+	for (i = 0; i < n; i++)
+	    atomic_store_explicit(&bufs[i]->tail, pos[i], memory_order_release);
+
+	if (niov > 0)
+	    writev_all(lg.fd, iov, niov);
+    }
+    while (nrec == BATCH_RECORDS);
+
+    for (i = 0; i < n; i++)     /* report records lost to full rings */
+    {
+	uint64_t d = atomic_load_explicit(&bufs[i]->dropped, memory_order_relaxed);
+
+	if (d != bufs[i]->dropped_reported)
+	{
+	    dused += clamp(snprintf(drops + dused, 64, "evlog: %s[%u] dropped %lu records\n",
+				    bufs[i]->name, bufs[i]->tid,
+				    (unsigned long)(d - bufs[i]->dropped_reported)), 64);
+	    bufs[i]->dropped_reported = d;
+	}
+    }
+
+    if (dused > 0)
+    {
+	iov[0].iov_base = drops;
+	iov[0].iov_len = dused;
+	writev_all(lg.fd, iov, 1);
+    }
+}
+
+
+static int writev_all(int fd, struct iovec *iov, int cnt)     /* retry short writes */
+{
+    ssize_t n;
+
+    while (cnt > 0)
+    {
+	n = writev(fd, iov, cnt > IOV_MAX ? IOV_MAX : cnt);
+
+	if (n == -1)
+	{
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+
+	while (cnt > 0 && (size_t)n >= iov->iov_len)
+	{
+	    n -= iov->iov_len;
+	    iov++;
+	    cnt--;
+	}
+
+	if (cnt > 0)
+	{
+	    iov->iov_base = (char *)iov->iov_base + n;
+	    iov->iov_len -= n;
+	}
+    }
+
+    return 0;
+}
+
+
+static size_t clamp(int len, int size)     /* snprintf length actually stored */
+{
+    if (len < 0)
+	return 0;
+    return len < size ? (size_t)len : (size_t)(size - 1);
+}
@@ -0,0 +1,120 @@
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/* a low-overhead event log for hot loops (e.g. the producer/consumer labs).
+
+   Instead of calling printf (which takes the stdio lock and makes a write
+   system call while the caller is inside its critical loop), each thread
+   appends fixed-size binary records to its own single-producer ring.  A
+   background flusher thread drains all of the rings, merges the records
+   by timestamp, formats them and writes them out with writev.
+
+   Usage:
+       evlog_init(STDOUT_FILENO, 100);            once, before any threads
+       ev = evlog_event("producing item");         define event names
+       evlog_thread_start("producer");             in each logging thread
+       evlog(ev, item);                            in the hot loop
+       evlog_shutdown();                           drain and stop the flusher
+
+   If a ring is full when a record is logged, the record is dropped (the
+   logging thread never blocks) and the drop is reported by the flusher.
+*/
+
+#define EVLOG_MAX_THREADS 64        /* max. concurrently registered threads */
+#define EVLOG_MAX_EVENTS 64         /* max. distinct event names */
+#define EVLOG_RING_RECORDS 4096     /* records per thread (power of two) */
+
+typedef struct
+{
+    uint64_t ts_ns;      /* nanoseconds since evlog_init */
+    uint32_t tid;        /* kernel thread id of the logging thread */
+    uint16_t event;      /* event id returned by evlog_event */
+    uint16_t flags;
+    int64_t item;        /* event argument (e.g. the item number) */
+    uint64_t reserved;
+}
+    Evlog_Record;        /* 32 bytes: two records per cache line */
+
+typedef struct
+{
+    _Atomic uint64_t head;          /* next record to write (owner only) */
+    uint64_t tail_cache;            /* owner's last view of tail */
+    _Atomic uint64_t dropped;       /* records dropped because ring was full */
+    char pad1[64 - 3 * sizeof(uint64_t)];
+
+    _Atomic uint64_t tail;          /* next record to read (flusher only) */
+    char pad2[64 - sizeof(uint64_t)];
+
+    _Atomic int state;              /* EVLOG_FREE, EVLOG_ACTIVE, EVLOG_RETIRED */
+    uint32_t tid;
+    uint64_t dropped_reported;
+    char name[16];
+
+    Evlog_Record ring[EVLOG_RING_RECORDS];
+}
+    Evlog_Buffer;
+
+enum { EVLOG_FREE = 0, EVLOG_ACTIVE = 1, EVLOG_RETIRED = 2 };
+
+int evlog_init(int fd, unsigned flush_ms);
+int evlog_event(const char *name);
+int evlog_thread_start(const char *name);
+void evlog_thread_exit(void);
+void evlog_shutdown(void);
+
+/* internals used by the inline fast path below */
+extern _Thread_local Evlog_Buffer *evlog_self;
+extern uint64_t evlog_epoch_ns;
+
+static inline uint64_t evlog_now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);     /* vDSO - no system call */
+    return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+}
+
+
+/* append one record to the calling thread's ring (never blocks) */
+
+static inline void evlog(int event, long item)
+{
+    Evlog_Buffer *b = evlog_self;
+    uint64_t head;
+    Evlog_Record *r;
+
+    if (b == 0)
+    {
+	if (evlog_thread_start(0) == -1)
+	    return;
+	b = evlog_self;
+    }
+
+    head = atomic_load_explicit(&b->head, memory_order_relaxed);
+
+    if (head - b->tail_cache >= EVLOG_RING_RECORDS)
+    {
+	b->tail_cache = atomic_load_explicit(&b->tail, memory_order_acquire);
+
+	if (head - b->tail_cache >= EVLOG_RING_RECORDS)
+	{
+	    atomic_fetch_add_explicit(&b->dropped, 1, memory_order_relaxed);
+	    return;
+	}
+    }
+
+    r = &b->ring[head & (EVLOG_RING_RECORDS - 1)];
+    r->ts_ns = evlog_now_ns() - evlog_epoch_ns;
+    r->tid = b->tid;
+    r->event = (uint16_t)event;
+    r->flags = 0;
+    r->item = item;
+
+    atomic_store_explicit(&b->head, head + 1, memory_order_release);     /* publish */
+}
+
+#endif
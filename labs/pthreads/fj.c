@@ -0,0 +1,342 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "fj.h"
+#include "topo.h"
+
+#define SPINS_BEFORE_YIELD 64
+
+typedef struct
+{
+    Fj_Deque deque;
+    pthread_t thread;
+    uint64_t rng;                   /* victim selection (xorshift) */
+    _Atomic uint64_t steals;        /* tasks this worker took from others */
+}
+    Fj_Worker;
+
+static _Thread_local Fj_Worker *fj_self;     /* 0 outside the pool */
+
+static struct
+{
+    Fj_Worker *workers;
+    int nworkers;
+    int stop;
+    _Atomic int active;             /* an fj_run is in progress: idle workers look for work */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_mutex_t run_lock;       /* one fj_run at a time */
+}
+    pool = { 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
+
+static void *worker(void *);
+static void run(Fj_Task *t);
+static Fj_Task *steal_any(Fj_Worker *w);
+static void backoff(int *idle);
+static int push(Fj_Deque *d, Fj_Task *t);
+static Fj_Task *pop(Fj_Deque *d);
+static Fj_Task *steal(Fj_Deque *d);
+
+
+int fj_init(int nworkers)
+{
+    pthread_attr_t attr;
+    int i, rc;
+
+    if (pool.workers)
+	return 0;
+
+    if (nworkers <= 0)
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers < 1)
+	nworkers = 1;
+    if (nworkers > FJ_MAX_WORKERS)
+	nworkers = FJ_MAX_WORKERS;
+
+    if ((pool.workers = aligned_alloc(64, sizeof(Fj_Worker) * nworkers)) == 0)
+	return -1;
+
+    memset(pool.workers, 0, sizeof(Fj_Worker) * nworkers);
+    pool.nworkers = nworkers;
+    pool.stop = 0;
+
+    for (i = 0; i < nworkers; i++)
+	pool.workers[i].rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+
+    topo_pin_self(0);     /* if a placement was chosen (topo.h) */
+
+    for (i = 1; i < nworkers; i++)     /* worker 0 is whoever calls fj_run */
+    {
+	if ((rc = pthread_create(&pool.workers[i].thread, topo_attr(&attr, i), worker, &pool.workers[i])) != 0)
+	{
+	    pool.nworkers = i;
+	    fj_shutdown();
+	    errno = rc;
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+void fj_run(void (*fn)(void *), void *arg)
+{
+    Fj_Worker *saved = fj_self;
+
+    pthread_mutex_lock(&pool.run_lock);
+    fj_self = &pool.workers[0];
+
+    pthread_mutex_lock(&pool.lock);
+    atomic_store(&pool.active, 1);
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    fn(arg);     /* returns after joining everything it spawned */
+
+    pthread_mutex_lock(&pool.lock);
+    atomic_store(&pool.active, 0);
+    pthread_mutex_unlock(&pool.lock);
+
+    fj_self = saved;
+    pthread_mutex_unlock(&pool.run_lock);
+}
+
+
+void fj_spawn(Fj_Task *t, void (*fn)(void *), void *arg)
+{
+    t->fn = fn;
+    t->arg = arg;
+    atomic_store_explicit(&t->done, 0, memory_order_relaxed);
+
+    if (fj_self == 0 || push(&fj_self->deque, t) == -1)
+	run(t);     /* not on a worker, or the deque is full */
+}
+
+
+/* wait for t.  If nobody stole it, it's at the bottom of our own deque:
+   pop it and run it here.  Otherwise, run other tasks (stolen from
+   anybody) until the thief finishes it.
+*/
+
+void fj_join(Fj_Task *t)
+{
+    Fj_Worker *w = fj_self;
+    Fj_Task *x;
+    int idle = 0;
+
+    while (!atomic_load_explicit(&t->done, memory_order_acquire))
+    {
+	if (w && (x = pop(&w->deque)) != 0)
+	    run(x);
+	else if (w && (x = steal_any(w)) != 0)
+	{
+	    run(x);
+	    idle = 0;
+	}
+	else
+	    backoff(&idle);
+    }
+}
+
+
+int fj_workers(void)
+{
+    return pool.nworkers;
+}
+
+
+int fj_worker_id(void)     /* 0 .. fj_workers() - 1, or -1 outside the pool */
+{
+    return fj_self ? (int)(fj_self - pool.workers) : -1;
+}
+
+
+uint64_t fj_steals(void)
+{
+    uint64_t n = 0;
+    int i;
+
+    for (i = 0; i < pool.nworkers; i++)
+	n += atomic_load_explicit(&pool.workers[i].steals, memory_order_relaxed);
+
+    return n;
+}
+
+
+void fj_shutdown(void)
+{
+    int i;
+
+    if (pool.workers == 0)
+	return;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i = 1; i < pool.nworkers; i++)
+	pthread_join(pool.workers[i].thread, 0);
+
+    free(pool.workers);
+    pool.workers = 0;
+    pool.nworkers = 0;
+}
+
+
+static void *worker(void *arg)
+{
+    Fj_Worker *w = (Fj_Worker *)arg;
+    Fj_Task *x;
+    int stop, idle = 0;
+
+    fj_self = w;
+
+    while (1)
+    {
+	pthread_mutex_lock(&pool.lock);
+	while (!pool.stop && !atomic_load(&pool.active))
+	    pthread_cond_wait(&pool.wake, &pool.lock);
+	stop = pool.stop;
+	pthread_mutex_unlock(&pool.lock);
+
+	if (stop)
+	    return 0;
+
+	while (atomic_load_explicit(&pool.active, memory_order_relaxed))
+	{
+	    if ((x = steal_any(w)) != 0)
+	    {
+		run(x);
+		idle = 0;
+	    }
+	    else
+		backoff(&idle);
+	}
+    }
+}
+
+
+static void run(Fj_Task *t)
+{
+    t->fn(t->arg);
+    atomic_store_explicit(&t->done, 1, memory_order_release);
+}
+
+
+static Fj_Task *steal_any(Fj_Worker *w)     /* one pass over the other workers, from a random one */
+{
+    int n = pool.nworkers, v, i;
+    Fj_Task *x;
+
+    if (n < 2)
+	return 0;
+
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    v = w->rng % n;
+
+    for (i = 0; i < n; i++, v = (v + 1) % n)
+    {
+	if (&pool.workers[v] == w)
+	    continue;
+
+	if ((x = steal(&pool.workers[v].deque)) != 0)
+	{
+	    atomic_fetch_add_explicit(&w->steals, 1, memory_order_relaxed);
+	    return x;
+	}
+    }
+
+    return 0;
+}
+
+
+static void backoff(int *idle)     /* spin briefly, then give the CPU to someone with work */
+{
+    if (++*idle < SPINS_BEFORE_YIELD)
+	__builtin_ia32_pause();
+    else
+	sched_yield();
+}
+
+
+/* the deque (Chase and Lev, with the C11 orderings from Le, Pop, Cohen and
+   Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory
+   Models").  Only the owner touches bottom; top only ever increases, by
+   compare-and-swap, so exactly one of the owner and the thieves gets the
+   last task.  The array has a fixed size: push refuses to overwrite a slot
+   a thief may still be reading.
+*/
+
+static int push(Fj_Deque *d, Fj_Task *t)
+{
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+
+    if (b - top >= FJ_DEQUE_SIZE)
+	return -1;
+
+    atomic_store_explicit(&d->tasks[b & (FJ_DEQUE_SIZE - 1)], t, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);     /* task is visible before the new bottom */
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+
+static Fj_Task *pop(Fj_Deque *d)
+{
+    int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    int64_t top;
+    Fj_Task *t = 0;
+
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);     /* thieves see the smaller bottom before we read top */
+    top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (top <= b)
+    {
+	t = atomic_load_explicit(&d->tasks[b & (FJ_DEQUE_SIZE - 1)], memory_order_relaxed);
+
+	if (top == b)     /* last task: race the thieves for it */
+	{
+	    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+							 memory_order_seq_cst, memory_order_relaxed))
+		t = 0;
+	    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+	}
+    }
+    else
+	atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);     /* was empty */
+
+    return t;
+}
+
+
+static Fj_Task *steal(Fj_Deque *d)     /* 0 if empty or another thread got there first */
+{
+    int64_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+    int64_t b;
+    Fj_Task *t;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+    if (top >= b)
+	return 0;
+
+    t = atomic_load_explicit(&d->tasks[top & (FJ_DEQUE_SIZE - 1)], memory_order_relaxed);
+
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+						 memory_order_seq_cst, memory_order_relaxed))
+	return 0;
+
+    return t;
+}
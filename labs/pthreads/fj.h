@@ -0,0 +1,72 @@
+#ifndef FJ_H
+#define FJ_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* a fork-join runtime: a fixed pool of worker threads (one per core by
+   default) that run tasks spawned by other tasks.
+
+   Each worker keeps its spawned tasks on its own deque (Chase and Lev's
+   work-stealing deque): the owner pushes and pops at the bottom without
+   locking, and idle workers steal the oldest task from the top of a
+   randomly chosen victim.  A recursive divide-and-conquer computation
+   therefore runs depth-first on each worker, and the big subproblems near
+   the root are what gets stolen.  No threads are created after fj_init,
+   however deep the recursion goes.
+
+   Usage:
+       fj_init(0);                              once; 0 = one worker per core
+       fj_run(root, &arg);                      run root(&arg) on the pool, wait for it
+
+       void root(void *arg)                     inside a task:
+       {
+           Fj_Task t;
+
+           fj_spawn(&t, left_half, &left);      may be stolen by another worker
+           right_half(&right);                  meanwhile, do the other half here
+           fj_join(&t);                         wait for (or run) left_half
+       }
+
+       fj_shutdown();
+
+   Tasks must be joined in the reverse order they were spawned, and a task
+   must be joined before the function that spawned it returns (the Fj_Task
+   usually lives on its stack).  The thread calling fj_run becomes worker 0
+   for the duration of the call; only one fj_run may be in progress.
+
+   With a --placement policy (topo.h), worker i runs on the policy's i'th
+   CPU; the thread calling fj_init is pinned as worker 0.
+*/
+
+#define FJ_MAX_WORKERS 256
+#define FJ_DEQUE_SIZE 4096      /* tasks per worker (power of two); a full deque runs spawns inline */
+
+typedef struct
+{
+    void (*fn)(void *);
+    void *arg;
+    _Atomic int done;
+}
+    Fj_Task;
+
+typedef struct
+{
+    _Atomic int64_t top;        /* thieves take from here */
+    char pad1[64 - sizeof(int64_t)];
+    _Atomic int64_t bottom;     /* owner pushes and pops here */
+    char pad2[64 - sizeof(int64_t)];
+    Fj_Task *_Atomic tasks[FJ_DEQUE_SIZE];
+}
+    Fj_Deque;
+
+int fj_init(int nworkers);
+void fj_run(void (*fn)(void *), void *arg);
+void fj_spawn(Fj_Task *t, void (*fn)(void *), void *arg);
+void fj_join(Fj_Task *t);
+int fj_workers(void);
+int fj_worker_id(void);
+uint64_t fj_steals(void);
+void fj_shutdown(void);
+
+#endif
@@ -2,25 +2,29 @@
 #include <stdlib.h>
 #include <pthread.h>
 
+#include "fj.h"
+#include "topo.h"
+
 
 struct range
 {
     int depth;
     long lower;
     long upper;
+    long sum;
 };
 
 
-void *par_add(void *);
+void par_add(void *);
 
 
 int main(int argc, char **argv)
 {
     struct range top_level;
 
-    if (argc < 3)
+    if (topo_option(&argc, argv) == -1 || argc < 3)
     {
-	fprintf(stderr, "usage: %s add-to depth\n", argv[0]);
+	fprintf(stderr, "usage: %s add-to depth [workers] [--placement=policy]\n", argv[0]);
 	exit(EXIT_FAILURE);
     }
 
@@ -28,45 +32,54 @@ int main(int argc, char **argv)
     top_level.lower = 1;
     top_level.upper = atol(argv[1]);
 
-    printf("sum of 1 to %ld = %ld\n", top_level.upper, (long)par_add(&top_level));
-    
+    if (fj_init(argc > 3 ? atoi(argv[3]) : 0) == -1)     /* default: one worker per core */
+    {
+	perror("fj_init failed");
+	exit(EXIT_FAILURE);
+    }
+
+    topo_describe(fj_workers());
+    fj_run(par_add, &top_level);
+
+    printf("sum of 1 to %ld = %ld\n", top_level.upper, top_level.sum);
+    printf("%d workers, %llu tasks stolen\n", fj_workers(), (unsigned long long)fj_steals());
+
+    fj_shutdown();
     return 0;
 }
 
 
-void *par_add(void *arg)
+/* split the range in two: spawn the left half (an idle worker may steal
+   it), add up the right half here, then join
+*/
+
+void par_add(void *arg)
 {
-    long sum, sum_left, sum_right, next;
-    pthread_t left, right;
+    long next;
     struct range range_left, range_right, *rangep = (struct range *)arg;
+    Fj_Task left;
 
     if (rangep->depth > 1 && rangep->lower < rangep->upper)
     {
 	range_left.depth = rangep->depth - 1;
 	range_left.lower = rangep->lower;
 	range_left.upper = (rangep->lower + rangep->upper) / 2;
-	
+
 	range_right.depth = rangep->depth - 1;
 	range_right.lower = range_left.upper + 1;
 	range_right.upper = rangep->upper;
-	
-	printf("summing %ld to %ld\n", range_left.lower, range_left.upper); 
-        pthread_create(&left, 0, par_add, &range_left);
-	printf("summing %ld to %ld\n", range_right.lower, range_right.upper); 
-	pthread_create(&right, 0, par_add, &range_right);
 
-	pthread_join(left, (void **)&sum_left);
-	pthread_join(right, (void **)&sum_right);
+	fj_spawn(&left, par_add, &range_left);
+	par_add(&range_right);
+	fj_join(&left);
 
-	sum = sum_left + sum_right;
+	rangep->sum = range_left.sum + range_right.sum;
     }
     else
     {
-	sum = 0;
+	rangep->sum = 0;
 
 	for (next = rangep->lower; next <= rangep->upper; next++)
-	    sum += next;
+	    rangep->sum += next;
     }
-
-    return (void *)sum;
 }
@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <time.h>
 #include <pthread.h>
+#include <unistd.h>
+
+#include "evlog.h"
+#include "topo.h"
 
 
 typedef int Item;     /* some item type - doesn't matter what it is */
@@ -28,18 +32,29 @@ volatile Item buffer[BUFFER_SIZE];     /* the bounded buffer */
 volatile int in;                       /* index of next enqueue */
 volatile int out;                      /* index of next dequeue */
 
+int ev_produce, ev_consume;     /* event log ids (printf stays out of the loops) */
+
 
-int main()
+int main(int argc, char **argv)
 {
     pthread_t id1, id2;
-    
+    pthread_attr_t attr1, attr2;
+
+    if (topo_option(&argc, argv) == -1)     /* --placement=policy, e.g. compact to share a cache */
+	exit(EXIT_FAILURE);
+
     srandom(time(NULL));     /* seed random number generator */
 
+    evlog_init(STDOUT_FILENO, 100);     /* flushed by a background thread */
+    ev_produce = evlog_event("producing item");
+    ev_consume = evlog_event("consuming item");
+
     in = 0;      /* initialize the shared data structure (a bounded buffer) */
     out = 0;
 
-    pthread_create(&id1, 0, producer, 0);     /* create producer thread */
-    pthread_create(&id2, 0, consumer, 0);     /* create consumer thread */
+    topo_describe(2);
+    pthread_create(&id1, topo_attr(&attr1, 0), producer, 0);     /* create producer thread */
+    pthread_create(&id2, topo_attr(&attr2, 1), consumer, 0);     /* create consumer thread */
 
     pthread_join(id1, 0);     /* neither terminates, so this blocks forever */
     pthread_join(id2, 0);     /* not reached */
@@ -51,6 +66,8 @@ void *producer(void *arg)     /* this function runs in its own thread */
 {
     Item item;
 
+    evlog_thread_start("producer");
+
     while (1)     /* repeatedly (forever) produce and enqueue items in the bounded buffer */
     {
 	item = produce_item();
@@ -58,7 +75,7 @@ void *producer(void *arg)     /* this function runs in its own thread */
 	while (((in + 1) % BUFFER_SIZE) == out)
 	    ;     /* do nothing - busy wait if buffer full */
 
-	printf("producing item %d\n", item);
+	evlog(ev_produce, item);
 
 	buffer[in] = item;               /* enqueue */
 	in = (in + 1) % BUFFER_SIZE;
@@ -84,6 +101,8 @@ void *consumer(void *arg)     /* this function runs in its own thread */
 {
     Item item;
 
+    evlog_thread_start("consumer");
+
     while (1)     /* repeatedly (forever) dequeue and consume items from the bounded buffer */
     {
 	while (in == out)
@@ -92,7 +111,7 @@ void *consumer(void *arg)     /* this function runs in its own thread */
 	item = buffer[out];                /* dequeue */
 	out = (out + 1) % BUFFER_SIZE;
 
-	printf("consuming item %d\n", item);
+	evlog(ev_consume, item);
 
 	consume_item(item);
     }
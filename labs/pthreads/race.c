@@ -1,26 +1,65 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
 #include <pthread.h>
 
+#include "topo.h"
+#include "counter.h"
+
 
 void *thread(void *);
 
+int benchmark(int argc, char **argv);
+void *bench_thread(void *);
+double now();
+
 
 volatile long n = 0;
 long iters;
 
+/* benchmark mode (-b): threads doing iters operations each on a counter,
+   read_pct percent of them reads and the rest increments - or with -m
+   (mixed signs) every other thread decrements, so that what the threads
+   post at once often adds up to nothing
+*/
+
+#define MAX_THREADS 256
+
+int kind;                        /* a Counter_Kind, or -1 for the unsynchronized n */
+Counter *counter;
+int read_pct;
+int mixed;
+struct result
+{
+    long writes;                 /* what the thread added: increments less decrements */
+    double start, end;
+}
+    results[MAX_THREADS];
+pthread_barrier_t start;
+volatile long sink;              /* keeps the reads from being optimized away */
+
 
 int main(int argc, char **argv)
 {
     pthread_t id1, id2;
+    pthread_attr_t attr1, attr2;
+
+    if (topo_option(&argc, argv) == -1)     /* --placement=policy */
+	exit(EXIT_FAILURE);
+
+    if (argc > 1 && strcmp(argv[1], "-b") == 0)
+	return benchmark(argc - 1, argv + 1);
 
     if (argc < 2)
 	iters = 10;
     else
 	iters = atol(argv[1]);
 
-    pthread_create(&id1, 0, thread, 0);
-    pthread_create(&id2, 0, thread, 0);
+    topo_describe(2);
+    pthread_create(&id1, topo_attr(&attr1, 0), thread, 0);
+    pthread_create(&id2, topo_attr(&attr2, 1), thread, 0);
 
     pthread_join(id1, 0);
     pthread_join(id2, 0);
@@ -40,3 +79,119 @@ void *thread(void *arg)
 
     return 0;
 }
+
+
+int benchmark(int argc, char **argv)
+{
+    pthread_t id[MAX_THREADS];
+    pthread_attr_t attr[MAX_THREADS];
+    int opt, nthreads = 4, i;
+    long expected, got;
+    double first, last;
+
+    iters = 1000000;
+    read_pct = 0;
+    mixed = 0;
+
+    while ((opt = getopt(argc, argv, "t:n:r:m")) != -1)
+    {
+	switch (opt)
+	{
+	case 't': nthreads = atoi(optarg); break;
+	case 'n': iters = atol(optarg); break;
+	case 'r': read_pct = atoi(optarg); break;
+	case 'm': mixed = 1; break;
+	default:
+	    fprintf(stderr, "usage: race -b [-t threads] [-n iterations] [-r read-percent] [-m] [--placement=policy]\n");
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    if (nthreads < 1 || nthreads > MAX_THREADS || read_pct < 0 || read_pct > 100)
+    {
+	fprintf(stderr, "race: 1 to %d threads, 0 to 100 percent reads\n", MAX_THREADS);
+	exit(EXIT_FAILURE);
+    }
+
+    topo_describe(nthreads);
+    printf("%d threads x %ld operations, %d%% reads%s\n", nthreads, iters, read_pct,
+	   mixed ? ", every other thread decrementing" : "");
+    printf("%-14s %12s %12s %8s %12s\n", "counter", "expected", "counted", "", "Mops/s");
+
+    for (kind = -1; kind < COUNTER_KINDS; kind++)
+    {
+	n = 0;
+	counter = kind == -1 ? 0 : counter_create(kind);
+	pthread_barrier_init(&start, 0, nthreads + 1);
+
+	for (i = 0; i < nthreads; i++)
+	    pthread_create(&id[i], topo_attr(&attr[i], i), bench_thread, &results[i]);
+
+	pthread_barrier_wait(&start);
+	for (i = 0; i < nthreads; i++)
+	    pthread_join(id[i], 0);
+
+	/* time from the first thread starting to the last one finishing */
+	first = results[0].start;
+	last = results[0].end;
+	for (expected = 0, i = 0; i < nthreads; i++)
+	{
+	    expected += results[i].writes;
+	    first = results[i].start < first ? results[i].start : first;
+	    last = results[i].end > last ? results[i].end : last;
+	}
+	got = kind == -1 ? n : counter_read(counter);
+
+	printf("%-14s %12ld %12ld %8s %12.2f\n", kind == -1 ? "unsynchronized" : counter_kind_name(kind),
+	       expected, got, got == expected ? "ok" : "WRONG", nthreads * iters / (last - first) / 1e6);
+
+	if (counter)
+	    counter_destroy(counter);
+	pthread_barrier_destroy(&start);
+    }
+
+    return 0;
+}
+
+
+void *bench_thread(void *arg)
+{
+    struct result *res = (struct result *)arg;
+    long i, w = 0, r = 0, delta = mixed && (res - results) % 2 ? -1 : 1;
+    unsigned long rng = (unsigned long)arg | 1;
+
+    pthread_barrier_wait(&start);
+    res->start = now();
+
+    for (i = 0; i < iters; i++)
+    {
+	rng ^= rng << 13;     /* xorshift: which operations are reads */
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+
+	if ((int)(rng % 100) < read_pct)
+	    r += kind == -1 ? n : counter_read(counter);
+	else
+	{
+	    if (kind == -1)
+		n = n + delta;
+	    else
+		counter_add(counter, delta);
+	    w += delta;
+	}
+    }
+
+    res->end = now();
+    res->writes = w;
+    sink = r;
+    return 0;
+}
+
+
+double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
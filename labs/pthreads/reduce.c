@@ -0,0 +1,455 @@
+#include <immintrin.h>
+
+#include "reduce.h"
+#include "fj.h"
+
+typedef struct
+{
+    _Alignas(64) char acc[REDUCE_ACC_MAX];
+}
+    Reduce_Partial;     /* one cache line per worker */
+
+typedef struct
+{
+    const char *a;
+    size_t n;
+    const Reduce_Op *op;
+}
+    Reduce_Range;
+
+static Reduce_Partial partials[FJ_MAX_WORKERS];     /* fj_run allows one reduction at a time */
+static int isa_chosen = -1;
+
+static void reduce_range(void *arg);
+static void reduce_serial(const Reduce_Range *r, void *result);
+static void choose_isa(void);
+
+static int64_t sum_i64_scalar(const int64_t *a, size_t n);
+static int64_t sum_i64_sse2(const int64_t *a, size_t n);
+static int64_t sum_i64_avx2(const int64_t *a, size_t n);
+static int64_t sum_i64_avx512(const int64_t *a, size_t n);
+static double sum_f64_scalar(const double *a, size_t n);
+static double sum_f64_sse2(const double *a, size_t n);
+static double sum_f64_avx2(const double *a, size_t n);
+static double sum_f64_avx512(const double *a, size_t n);
+static double sum_f32_scalar(const float *a, size_t n);
+static double sum_f32_sse2(const float *a, size_t n);
+static double sum_f32_avx2(const float *a, size_t n);
+static double sum_f32_avx512(const float *a, size_t n);
+
+static int64_t (*const sum_i64[])(const int64_t *, size_t) =
+    { sum_i64_scalar, sum_i64_sse2, sum_i64_avx2, sum_i64_avx512 };
+static double (*const sum_f64[])(const double *, size_t) =
+    { sum_f64_scalar, sum_f64_sse2, sum_f64_avx2, sum_f64_avx512 };
+static double (*const sum_f32[])(const float *, size_t) =
+    { sum_f32_scalar, sum_f32_sse2, sum_f32_avx2, sum_f32_avx512 };
+
+
+void parallel_reduce(const void *a, size_t n, const Reduce_Op *op, void *result)
+{
+    Reduce_Range top = { (const char *)a, n, op };
+    int i;
+
+    choose_isa();
+    if (fj_workers() == 0 && fj_init(0) == -1)
+    {
+	reduce_serial(&top, result);     /* no pool (no threads to be had) */
+	return;
+    }
+
+    for (i = 0; i < fj_workers(); i++)
+	op->identity(partials[i].acc);
+
+    fj_run(reduce_range, &top);
+
+    op->identity(result);
+    for (i = 0; i < fj_workers(); i++)
+	op->combine(result, partials[i].acc);
+}
+
+
+/* the same leaves, one after another in this thread, each combined into
+   result as it's done - so floats are still summed in double across leaves */
+static void reduce_serial(const Reduce_Range *r, void *result)
+{
+    Reduce_Partial leaf;
+    size_t per_leaf = REDUCE_GRAIN / r->op->elem_size, i, m;
+
+    r->op->identity(result);
+    for (i = 0; i < r->n; i += m)
+    {
+	m = r->n - i < per_leaf ? r->n - i : per_leaf;
+	r->op->identity(leaf.acc);
+	r->op->leaf(r->a + i * r->op->elem_size, m, leaf.acc);
+	r->op->combine(result, leaf.acc);
+    }
+}
+
+
+static void reduce_range(void *arg)
+{
+    Reduce_Range *r = (Reduce_Range *)arg, left, right;
+    Fj_Task t;
+
+    if (r->n * r->op->elem_size <= REDUCE_GRAIN || r->n < 2)
+    {
+	r->op->leaf(r->a, r->n, partials[fj_worker_id()].acc);
+	return;
+    }
+
+    left.a = r->a;
+    left.n = r->n / 2;
+    left.op = r->op;
+
+    right.a = r->a + left.n * r->op->elem_size;
+    right.n = r->n - left.n;
+    right.op = r->op;
+
+    fj_spawn(&t, reduce_range, &left);
+    reduce_range(&right);
+    fj_join(&t);
+}
+
+
+/* ---- the built-in sums ---- */
+
+static void zero_i64(void *acc) { *(int64_t *)acc = 0; }
+static void zero_f64(void *acc) { *(double *)acc = 0; }
+static void add_i64(void *acc, const void *other) { *(int64_t *)acc += *(const int64_t *)other; }
+static void add_f64(void *acc, const void *other) { *(double *)acc += *(const double *)other; }
+
+static void leaf_i64(const void *a, size_t n, void *acc) { *(int64_t *)acc += sum_i64[isa_chosen](a, n); }
+static void leaf_f64(const void *a, size_t n, void *acc) { *(double *)acc += sum_f64[isa_chosen](a, n); }
+static void leaf_f32(const void *a, size_t n, void *acc) { *(double *)acc += sum_f32[isa_chosen](a, n); }
+
+const Reduce_Op reduce_sum_i64 = { sizeof(int64_t), zero_i64, leaf_i64, add_i64 };
+const Reduce_Op reduce_sum_f64 = { sizeof(double), zero_f64, leaf_f64, add_f64 };
+const Reduce_Op reduce_sum_f32 = { sizeof(float), zero_f64, leaf_f32, add_f64 };
+
+
+int64_t parallel_sum_i64(const int64_t *a, size_t n)
+{
+    int64_t sum;
+
+    parallel_reduce(a, n, &reduce_sum_i64, &sum);
+    return sum;
+}
+
+
+double parallel_sum_f64(const double *a, size_t n)
+{
+    double sum;
+
+    parallel_reduce(a, n, &reduce_sum_f64, &sum);
+    return sum;
+}
+
+
+double parallel_sum_f32(const float *a, size_t n)
+{
+    double sum;
+
+    parallel_reduce(a, n, &reduce_sum_f32, &sum);
+    return sum;
+}
+
+
+int64_t reduce_seq_sum_i64(const int64_t *a, size_t n)
+{
+    choose_isa();
+    return sum_i64[isa_chosen](a, n);
+}
+
+
+double reduce_seq_sum_f64(const double *a, size_t n)
+{
+    choose_isa();
+    return sum_f64[isa_chosen](a, n);
+}
+
+
+/* ---- kernel selection ---- */
+
+Reduce_Isa reduce_isa(void)     /* best supported by this CPU */
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+	return REDUCE_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+	return REDUCE_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+	return REDUCE_SSE2;
+    return REDUCE_SCALAR;
+}
+
+
+Reduce_Isa reduce_use_isa(Reduce_Isa isa)
+{
+    Reduce_Isa best = reduce_isa();
+
+    isa_chosen = isa < best ? isa : best;
+    return isa_chosen;
+}
+
+
+const char *reduce_isa_name(Reduce_Isa isa)
+{
+    static const char *names[] = { "scalar", "sse2", "avx2", "avx512" };
+
+    return names[isa];
+}
+
+
+static void choose_isa(void)
+{
+    if (isa_chosen == -1)
+	isa_chosen = reduce_isa();
+}
+
+
+/* ---- kernels: four independent accumulators each, then the tail ---- */
+
+static int64_t sum_i64_scalar(const int64_t *a, size_t n)
+{
+    int64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+	s0 += a[i];
+	s1 += a[i + 1];
+	s2 += a[i + 2];
+	s3 += a[i + 3];
+    }
+    for (; i < n; i++)
+	s0 += a[i];
+
+    return s0 + s1 + s2 + s3;
+}
+
+
+__attribute__((target("sse2")))
+static int64_t sum_i64_sse2(const int64_t *a, size_t n)
+{
+    __m128i s0 = _mm_setzero_si128(), s1 = s0, s2 = s0, s3 = s0;
+    int64_t lanes[2];
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+	s0 = _mm_add_epi64(s0, _mm_loadu_si128((const __m128i *)(a + i)));
+	s1 = _mm_add_epi64(s1, _mm_loadu_si128((const __m128i *)(a + i + 2)));
+	s2 = _mm_add_epi64(s2, _mm_loadu_si128((const __m128i *)(a + i + 4)));
+	s3 = _mm_add_epi64(s3, _mm_loadu_si128((const __m128i *)(a + i + 6)));
+    }
+
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(_mm_add_epi64(s0, s1), _mm_add_epi64(s2, s3)));
+    return lanes[0] + lanes[1] + sum_i64_scalar(a + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static int64_t sum_i64_avx2(const int64_t *a, size_t n)
+{
+    __m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+    int64_t lanes[4];
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+	s0 = _mm256_add_epi64(s0, _mm256_loadu_si256((const __m256i *)(a + i)));
+	s1 = _mm256_add_epi64(s1, _mm256_loadu_si256((const __m256i *)(a + i + 4)));
+	s2 = _mm256_add_epi64(s2, _mm256_loadu_si256((const __m256i *)(a + i + 8)));
+	s3 = _mm256_add_epi64(s3, _mm256_loadu_si256((const __m256i *)(a + i + 12)));
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(_mm256_add_epi64(s0, s1), _mm256_add_epi64(s2, s3)));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_i64_scalar(a + i, n - i);
+}
+
+
+__attribute__((target("avx512f")))
+static int64_t sum_i64_avx512(const int64_t *a, size_t n)
+{
+    __m512i s0 = _mm512_setzero_si512(), s1 = s0, s2 = s0, s3 = s0;
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+	s0 = _mm512_add_epi64(s0, _mm512_loadu_si512(a + i));
+	s1 = _mm512_add_epi64(s1, _mm512_loadu_si512(a + i + 8));
+	s2 = _mm512_add_epi64(s2, _mm512_loadu_si512(a + i + 16));
+	s3 = _mm512_add_epi64(s3, _mm512_loadu_si512(a + i + 24));
+    }
+
+    return _mm512_reduce_add_epi64(_mm512_add_epi64(_mm512_add_epi64(s0, s1), _mm512_add_epi64(s2, s3))) +
+	sum_i64_scalar(a + i, n - i);
+}
+
+
+static double sum_f64_scalar(const double *a, size_t n)
+{
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+	s0 += a[i];
+	s1 += a[i + 1];
+	s2 += a[i + 2];
+	s3 += a[i + 3];
+    }
+    for (; i < n; i++)
+	s0 += a[i];
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+
+__attribute__((target("sse2")))
+static double sum_f64_sse2(const double *a, size_t n)
+{
+    __m128d s0 = _mm_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+    double lanes[2];
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+	s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+	s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+	s2 = _mm_add_pd(s2, _mm_loadu_pd(a + i + 4));
+	s3 = _mm_add_pd(s3, _mm_loadu_pd(a + i + 6));
+    }
+
+    _mm_storeu_pd(lanes, _mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3)));
+    return lanes[0] + lanes[1] + sum_f64_scalar(a + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static double sum_f64_avx2(const double *a, size_t n)
+{
+    __m256d s0 = _mm256_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+    double lanes[4];
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+	s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+	s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+	s2 = _mm256_add_pd(s2, _mm256_loadu_pd(a + i + 8));
+	s3 = _mm256_add_pd(s3, _mm256_loadu_pd(a + i + 12));
+    }
+
+    _mm256_storeu_pd(lanes, _mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + sum_f64_scalar(a + i, n - i);
+}
+
+
+__attribute__((target("avx512f")))
+static double sum_f64_avx512(const double *a, size_t n)
+{
+    __m512d s0 = _mm512_setzero_pd(), s1 = s0, s2 = s0, s3 = s0;
+    size_t i;
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+	s0 = _mm512_add_pd(s0, _mm512_loadu_pd(a + i));
+	s1 = _mm512_add_pd(s1, _mm512_loadu_pd(a + i + 8));
+	s2 = _mm512_add_pd(s2, _mm512_loadu_pd(a + i + 16));
+	s3 = _mm512_add_pd(s3, _mm512_loadu_pd(a + i + 24));
+    }
+
+    return _mm512_reduce_add_pd(_mm512_add_pd(_mm512_add_pd(s0, s1), _mm512_add_pd(s2, s3))) +
+	sum_f64_scalar(a + i, n - i);
+}
+
+
+static double sum_f32_scalar(const float *a, size_t n)
+{
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+	s0 += a[i];
+	s1 += a[i + 1];
+	s2 += a[i + 2];
+	s3 += a[i + 3];
+    }
+    for (; i < n; i++)
+	s0 += a[i];
+
+    return ((double)s0 + s1) + ((double)s2 + s3);
+}
+
+
+__attribute__((target("sse2")))
+static double sum_f32_sse2(const float *a, size_t n)
+{
+    __m128 s0 = _mm_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+    float lanes[4];
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16)
+    {
+	s0 = _mm_add_ps(s0, _mm_loadu_ps(a + i));
+	s1 = _mm_add_ps(s1, _mm_loadu_ps(a + i + 4));
+	s2 = _mm_add_ps(s2, _mm_loadu_ps(a + i + 8));
+	s3 = _mm_add_ps(s3, _mm_loadu_ps(a + i + 12));
+    }
+
+    _mm_storeu_ps(lanes, _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+    return ((double)lanes[0] + lanes[1]) + ((double)lanes[2] + lanes[3]) + sum_f32_scalar(a + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static double sum_f32_avx2(const float *a, size_t n)
+{
+    __m256 s0 = _mm256_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+    float lanes[8];
+    double sum = 0;
+    size_t i;
+    int j;
+
+    for (i = 0; i + 32 <= n; i += 32)
+    {
+	s0 = _mm256_add_ps(s0, _mm256_loadu_ps(a + i));
+	s1 = _mm256_add_ps(s1, _mm256_loadu_ps(a + i + 8));
+	s2 = _mm256_add_ps(s2, _mm256_loadu_ps(a + i + 16));
+	s3 = _mm256_add_ps(s3, _mm256_loadu_ps(a + i + 24));
+    }
+
+    _mm256_storeu_ps(lanes, _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+    for (j = 0; j < 8; j++)
+	sum += lanes[j];
+
+    return sum + sum_f32_scalar(a + i, n - i);
+}
+
+
+__attribute__((target("avx512f")))
+static double sum_f32_avx512(const float *a, size_t n)
+{
+    __m512 s0 = _mm512_setzero_ps(), s1 = s0, s2 = s0, s3 = s0;
+    float lanes[16];
+    double sum = 0;
+    size_t i;
+    int j;
+
+    for (i = 0; i + 64 <= n; i += 64)
+    {
+	s0 = _mm512_add_ps(s0, _mm512_loadu_ps(a + i));
+	s1 = _mm512_add_ps(s1, _mm512_loadu_ps(a + i + 16));
+	s2 = _mm512_add_ps(s2, _mm512_loadu_ps(a + i + 32));
+	s3 = _mm512_add_ps(s3, _mm512_loadu_ps(a + i + 48));
+    }
+
+    _mm512_storeu_ps(lanes, _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+    for (j = 0; j < 16; j++)
+	sum += lanes[j];
+
+    return sum + sum_f32_scalar(a + i, n - i);
+}
@@ -0,0 +1,59 @@
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* parallel reduction of an in-memory array on the fork-join pool (fj.h).
+
+   The array is split in halves recursively, as in par_add, down to leaves
+   of REDUCE_GRAIN bytes.  A leaf is reduced by a vectorized kernel into
+   the accumulator of the worker running it; each worker has its own
+   accumulator on its own cache line, so leaves never share a line or
+   pass results back up the tree.  The accumulators are combined once at
+   the end.
+
+   The sums of int64, double and float come with kernels for plain C,
+   SSE2, AVX2 and AVX-512, each with several independent accumulators so
+   consecutive additions don't wait for each other.  The best kernel the
+   CPU supports is chosen when first used (reduce_use_isa overrides it).
+   Floats are summed in float within a leaf and in double across leaves.
+
+   Floating point addition isn't associative, and which worker reduces
+   which leaf varies from run to run, so floating point results can
+   differ in the last bits between runs.
+
+   Any other reduction can be run by describing it with a Reduce_Op.
+   parallel_reduce starts the pool (fj_init(0)) if it isn't running.
+*/
+
+#define REDUCE_GRAIN (128 * 1024)       /* bytes per leaf */
+#define REDUCE_ACC_MAX 56               /* largest accumulator a Reduce_Op may use */
+
+typedef enum { REDUCE_SCALAR, REDUCE_SSE2, REDUCE_AVX2, REDUCE_AVX512 } Reduce_Isa;
+
+typedef struct
+{
+    size_t elem_size;
+    void (*identity)(void *acc);                        /* acc = empty reduction */
+    void (*leaf)(const void *a, size_t n, void *acc);   /* acc = acc + reduce(a[0 .. n)) */
+    void (*combine)(void *acc, const void *other);      /* acc = acc + other */
+}
+    Reduce_Op;
+
+void parallel_reduce(const void *a, size_t n, const Reduce_Op *op, void *result);
+
+int64_t parallel_sum_i64(const int64_t *a, size_t n);
+double parallel_sum_f64(const double *a, size_t n);
+double parallel_sum_f32(const float *a, size_t n);
+
+int64_t reduce_seq_sum_i64(const int64_t *a, size_t n);     /* in the calling thread, with the chosen kernel */
+double reduce_seq_sum_f64(const double *a, size_t n);
+
+Reduce_Isa reduce_isa(void);
+Reduce_Isa reduce_use_isa(Reduce_Isa isa);     /* returns the one used: isa, or the best supported below it */
+const char *reduce_isa_name(Reduce_Isa isa);
+
+extern const Reduce_Op reduce_sum_i64, reduce_sum_f64, reduce_sum_f32;
+
+#endif
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include "fj.h"
+#include "topo.h"
+#include "reduce.h"
+
+/* sum arrays from L1-sized up to gigabytes and report GB/s for:
+
+     recursive   par_add's recursion (spawn/compute/join, each node returns
+                 its sum through its range struct) with a plain loop at the
+                 leaves
+     scalar ...  parallel_reduce with each of the kernels this CPU runs
+*/
+
+struct range
+{
+    const void *a;
+    size_t n;
+    double sum;
+};
+
+enum { I64, F64, F32 };
+
+int type = I64;
+size_t elem_size = sizeof(int64_t);
+
+void recursive_sum(void *arg);
+double reduce(const void *a, size_t n);
+double expected_sum(size_t n);
+size_t parse_size(const char *s);
+double now();
+
+
+int main(int argc, char **argv)
+{
+    size_t max = 1UL << 30, size, n, i;
+    int opt, workers = 0, best, isa, reps, r;
+    char *a;
+    double t, fastest, sum, expect;
+    struct range top;
+
+    if (topo_option(&argc, argv) == -1)     /* --placement=policy, for the pool's workers */
+	exit(EXIT_FAILURE);
+
+    while ((opt = getopt(argc, argv, "m:w:t:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'm': max = parse_size(optarg); break;
+	case 'w': workers = atoi(optarg); break;
+	case 't':
+	    type = !strcmp(optarg, "f64") ? F64 : !strcmp(optarg, "f32") ? F32 : I64;
+	    elem_size = type == F32 ? sizeof(float) : 8;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-m max-bytes] [-w workers] [--placement=policy] [-t i64|f64|f32]\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    if (fj_init(workers) == -1 || (a = malloc(max)) == 0)
+    {
+	perror("setup failed");
+	exit(EXIT_FAILURE);
+    }
+    topo_describe(fj_workers());
+
+    for (i = 0; i < max / elem_size; i++)     /* also faults every page in */
+    {
+	if (type == I64)
+	    ((int64_t *)a)[i] = i % 1000;
+	else if (type == F64)
+	    ((double *)a)[i] = (i % 1000) * 0.5;
+	else
+	    ((float *)a)[i] = (i % 1000) * 0.5f;
+    }
+
+    best = reduce_isa();
+
+    printf("%d workers, GB/s (best of several runs)\n%12s %10s", fj_workers(), "bytes", "recursive");
+    for (isa = REDUCE_SCALAR; isa <= best; isa++)
+	printf(" %10s", reduce_isa_name(isa));
+    printf("\n");
+
+    for (size = 4096; size <= max; size *= 4)
+    {
+	n = size / elem_size;
+	reps = (256 << 20) / size;
+	reps = reps < 3 ? 3 : reps > 10000 ? 10000 : reps;
+	expect = expected_sum(n);
+
+	printf("%12zu", size);
+
+	for (isa = -1; isa <= best; isa++)     /* -1: the recursive version */
+	{
+	    if (isa >= 0)
+		reduce_use_isa(isa);
+
+	    for (fastest = 1e30, r = 0; r < reps; r++)
+	    {
+		t = now();
+		if (isa == -1)
+		{
+		    top.a = a;
+		    top.n = n;
+		    fj_run(recursive_sum, &top);
+		    sum = top.sum;
+		}
+		else
+		    sum = reduce(a, n);
+		t = now() - t;
+
+		if (t < fastest)
+		    fastest = t;
+	    }
+
+	    if (fabs(sum - expect) > 1e-6 * fabs(expect))
+		printf(" %10s", "WRONG");
+	    else
+		printf(" %10.2f", size / fastest / 1e9);
+	    fflush(stdout);
+	}
+
+	printf("\n");
+    }
+
+    free(a);
+    fj_shutdown();
+    return 0;
+}
+
+
+void recursive_sum(void *arg)
+{
+    struct range *r = (struct range *)arg, left, right;
+    Fj_Task t;
+    size_t i;
+
+    if (r->n * elem_size > REDUCE_GRAIN)
+    {
+	left.a = r->a;
+	left.n = r->n / 2;
+	right.a = (const char *)r->a + left.n * elem_size;
+	right.n = r->n - left.n;
+
+	fj_spawn(&t, recursive_sum, &left);
+	recursive_sum(&right);
+	fj_join(&t);
+
+	r->sum = left.sum + right.sum;
+	return;
+    }
+
+    for (r->sum = 0, i = 0; i < r->n; i++)
+    {
+	if (type == I64)
+	    r->sum += ((const int64_t *)r->a)[i];
+	else if (type == F64)
+	    r->sum += ((const double *)r->a)[i];
+	else
+	    r->sum += ((const float *)r->a)[i];
+    }
+}
+
+
+double reduce(const void *a, size_t n)
+{
+    if (type == I64)
+	return parallel_sum_i64(a, n);
+    if (type == F64)
+	return parallel_sum_f64(a, n);
+    return parallel_sum_f32(a, n);
+}
+
+
+double expected_sum(size_t n)     /* the fill pattern's sum, in closed form */
+{
+    double full = (double)(n / 1000) * (999 * 1000 / 2), rest = (double)(n % 1000) * (n % 1000 - 1) / 2;
+
+    return type == I64 ? full + rest : (full + rest) * 0.5;
+}
+
+
+size_t parse_size(const char *s)
+{
+    char *end;
+    size_t n = strtoul(s, &end, 10);
+
+    switch (*end)
+    {
+    case 'G': case 'g': n <<= 10;     /* fall through */
+    case 'M': case 'm': n <<= 10;     /* fall through */
+    case 'K': case 'k': n <<= 10;
+    }
+
+    return n;
+}
+
+
+double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <immintrin.h>
+
+#include "scan.h"
+#include "reduce.h"
+#include "fj.h"
+
+enum { I64, F64 };
+
+typedef struct
+{
+    int type;
+    int exclusive;
+    int pass;                   /* 1: block sums, 2: scan blocks */
+    const char *in;
+    char *out;
+    size_t n;
+    void *sums;                 /* per block: its sum, then its starting offset */
+    size_t lo, hi;              /* blocks [lo, hi) */
+}
+    Scan_Job;
+
+static int use_avx2 = -1;
+
+static void scan(int type, const void *in, void *out, size_t n, int exclusive);
+static void scan_blocks(void *arg);
+static void scan_i64_scalar(const int64_t *in, int64_t *out, size_t n, int64_t carry, int exclusive);
+static void scan_i64_avx2(const int64_t *in, int64_t *out, size_t n, int64_t carry, int exclusive);
+static void scan_f64_scalar(const double *in, double *out, size_t n, double carry, int exclusive);
+static void scan_f64_avx2(const double *in, double *out, size_t n, double carry, int exclusive);
+
+
+void parallel_scan_i64(const int64_t *in, int64_t *out, size_t n, int exclusive)
+{
+    scan(I64, in, out, n, exclusive);
+}
+
+
+void parallel_scan_f64(const double *in, double *out, size_t n, int exclusive)
+{
+    scan(F64, in, out, n, exclusive);
+}
+
+
+static void scan(int type, const void *in, void *out, size_t n, int exclusive)
+{
+    size_t nblocks = (n + SCAN_BLOCK - 1) / SCAN_BLOCK, b;
+    int64_t *isums, isum = 0, itmp;
+    double *dsums, dsum = 0, dtmp;
+    Scan_Job job;
+
+    if (use_avx2 == -1)
+	use_avx2 = reduce_isa() >= REDUCE_AVX2;
+    if (fj_workers() == 0 && fj_init(0) == -1)
+	nblocks = 1;     /* no pool (no threads to be had): scan it all here */
+
+    job.type = type;
+    job.exclusive = exclusive;
+    job.in = in;
+    job.out = out;
+    job.n = n;
+    job.lo = 0;
+    job.hi = nblocks;
+
+    if (nblocks < 2 || (job.sums = malloc(nblocks * sizeof(int64_t))) == 0)
+    {
+	job.sums = 0;     /* one block (or no memory, or no pool): scan it all here */
+	if (type == I64)
+	    (use_avx2 ? scan_i64_avx2 : scan_i64_scalar)(in, out, n, 0, exclusive);
+	else
+	    (use_avx2 ? scan_f64_avx2 : scan_f64_scalar)(in, out, n, 0, exclusive);
+	return;
+    }
+
+    job.pass = 1;
+    fj_run(scan_blocks, &job);
+
+    isums = job.sums;     /* exclusive scan of the block sums */
+    dsums = job.sums;
+    for (b = 0; b < nblocks; b++)
+    {
+	if (type == I64)
+	{
+	    itmp = isums[b];
+	    isums[b] = isum;
+	    isum += itmp;
+	}
+	else
+	{
+	    dtmp = dsums[b];
+	    dsums[b] = dsum;
+	    dsum += dtmp;
+	}
+    }
+
+    job.pass = 2;
+    fj_run(scan_blocks, &job);
+
+    free(job.sums);
+}
+
+
+static void scan_blocks(void *arg)
+{
+    Scan_Job *j = (Scan_Job *)arg, left, right;
+    Fj_Task t;
+    size_t start, len;
+
+    if (j->hi - j->lo > 1)
+    {
+	left = right = *j;
+	left.hi = right.lo = j->lo + (j->hi - j->lo) / 2;
+
+	fj_spawn(&t, scan_blocks, &left);
+	scan_blocks(&right);
+	fj_join(&t);
+	return;
+    }
+
+    start = j->lo * SCAN_BLOCK;
+    len = j->n - start < SCAN_BLOCK ? j->n - start : SCAN_BLOCK;
+
+    if (j->type == I64)
+    {
+	const int64_t *in = (const int64_t *)j->in + start;
+	int64_t *out = (int64_t *)j->out + start, *sums = j->sums;
+
+	if (j->pass == 1)
+	    sums[j->lo] = reduce_seq_sum_i64(in, len);
+	else
+	    (use_avx2 ? scan_i64_avx2 : scan_i64_scalar)(in, out, len, sums[j->lo], j->exclusive);
+    }
+    else
+    {
+	const double *in = (const double *)j->in + start;
+	double *out = (double *)j->out + start, *sums = j->sums;
+
+	if (j->pass == 1)
+	    sums[j->lo] = reduce_seq_sum_f64(in, len);
+	else
+	    (use_avx2 ? scan_f64_avx2 : scan_f64_scalar)(in, out, len, sums[j->lo], j->exclusive);
+    }
+}
+
+
+/* ---- local scans, starting from carry ---- */
+
+static void scan_i64_scalar(const int64_t *in, int64_t *out, size_t n, int64_t carry, int exclusive)
+{
+    int64_t x;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+	x = in[i];     /* in may be out */
+	out[i] = exclusive ? carry : carry + x;
+	carry += x;
+    }
+}
+
+
+static void scan_f64_scalar(const double *in, double *out, size_t n, double carry, int exclusive)
+{
+    double x;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+	x = in[i];
+	out[i] = exclusive ? carry : carry + x;
+	carry += x;
+    }
+}
+
+
+/* four lanes at a time: shift-and-add the vector onto itself by one lane
+   and then two (a Hillis-Steele scan in the register), add the running
+   carry, and broadcast the last lane as the next carry.  An exclusive
+   scan shifts the inclusive result up a lane, bringing in the old carry.
+*/
+
+__attribute__((target("avx2")))
+static void scan_i64_avx2(const int64_t *in, int64_t *out, size_t n, int64_t carry, int exclusive)
+{
+    __m256i zero = _mm256_setzero_si256(), c = _mm256_set1_epi64x(carry), x, p;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+	x = _mm256_loadu_si256((const __m256i *)(in + i));
+	x = _mm256_add_epi64(x, _mm256_blend_epi32(_mm256_permute4x64_epi64(x, 0x90), zero, 0x03));
+	x = _mm256_add_epi64(x, _mm256_blend_epi32(_mm256_permute4x64_epi64(x, 0x40), zero, 0x0f));
+	p = _mm256_add_epi64(x, c);
+
+	if (exclusive)
+	    _mm256_storeu_si256((__m256i *)(out + i), _mm256_blend_epi32(_mm256_permute4x64_epi64(p, 0x90), c, 0x03));
+	else
+	    _mm256_storeu_si256((__m256i *)(out + i), p);
+
+	c = _mm256_permute4x64_epi64(p, 0xff);
+    }
+
+    scan_i64_scalar(in + i, out + i, n - i, _mm256_extract_epi64(c, 0), exclusive);
+}
+
+
+__attribute__((target("avx2")))
+static void scan_f64_avx2(const double *in, double *out, size_t n, double carry, int exclusive)
+{
+    __m256d zero = _mm256_setzero_pd(), c = _mm256_set1_pd(carry), x, p;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+	x = _mm256_loadu_pd(in + i);
+	x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, 0x90), zero, 0x1));
+	x = _mm256_add_pd(x, _mm256_blend_pd(_mm256_permute4x64_pd(x, 0x40), zero, 0x3));
+	p = _mm256_add_pd(x, c);
+
+	if (exclusive)
+	    _mm256_storeu_pd(out + i, _mm256_blend_pd(_mm256_permute4x64_pd(p, 0x90), c, 0x1));
+	else
+	    _mm256_storeu_pd(out + i, p);
+
+	c = _mm256_permute4x64_pd(p, 0xff);
+    }
+
+    scan_f64_scalar(in + i, out + i, n - i, _mm256_cvtsd_f64(c), exclusive);
+}
@@ -0,0 +1,35 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* parallel prefix sums on the fork-join pool (fj.h):
+
+       inclusive: out[i] = in[0] + ... + in[i]
+       exclusive: out[i] = in[0] + ... + in[i - 1]       (out[0] = 0)
+
+   The array is cut into blocks of SCAN_BLOCK elements.  The first pass
+   sums each block in parallel (with the reduce.h kernels); a short
+   sequential scan of the block sums then gives each block its starting
+   offset; the second pass scans each block in parallel from its offset,
+   four elements at a time with AVX2 where the CPU has it.  The input is
+   read twice and the output written once, all sequentially, so the scan
+   runs at memory speed rather than being limited by the sequential pass
+   (which only touches one number per block).
+
+   The block size is fixed, so the order of the additions - and for
+   doubles the rounding - is the same whatever the number of workers:
+   the output is deterministic for a given machine.
+
+   in and out may be the same array.
+*/
+
+#define SCAN_BLOCK 16384                /* elements per block */
+
+enum { SCAN_INCLUSIVE = 0, SCAN_EXCLUSIVE = 1 };
+
+void parallel_scan_i64(const int64_t *in, int64_t *out, size_t n, int exclusive);
+void parallel_scan_f64(const double *in, double *out, size_t n, int exclusive);
+
+#endif
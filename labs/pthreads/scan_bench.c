@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "fj.h"
+#include "topo.h"
+#include "scan.h"
+
+/* time parallel_scan against a plain sequential loop from 4 KiB up to
+   -m bytes, check every result against the loop, and report GB/s of
+   input scanned.  For doubles, the parallel result is checked for being
+   identical across repeated runs rather than equal to the loop's (the
+   additions are grouped differently).
+*/
+
+int type_f64 = 0, exclusive = 0;
+
+void seq_scan(const void *in, void *out, size_t n);
+int check(const void *a, const void *b, size_t n);
+size_t parse_size(const char *s);
+double now();
+
+
+int main(int argc, char **argv)
+{
+    size_t max = 256UL << 20, size, n, i;
+    int opt, workers = 0, reps, r, ok;
+    char *in, *out, *ref;
+    double t, seq, par;
+
+    if (topo_option(&argc, argv) == -1)     /* --placement=policy, for the pool's workers */
+	exit(EXIT_FAILURE);
+
+    while ((opt = getopt(argc, argv, "m:w:de")) != -1)
+    {
+	switch (opt)
+	{
+	case 'm': max = parse_size(optarg); break;
+	case 'w': workers = atoi(optarg); break;
+	case 'd': type_f64 = 1; break;
+	case 'e': exclusive = 1; break;
+	default:
+	    fprintf(stderr, "usage: %s [-m max-bytes] [-w workers] [--placement=policy] [-d] [-e]\n"
+		    "  -d: doubles (default int64)   -e: exclusive scan (default inclusive)\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    if (fj_init(workers) == -1 || (in = malloc(max)) == 0 || (out = malloc(max)) == 0 || (ref = malloc(max)) == 0)
+    {
+	perror("setup failed");
+	exit(EXIT_FAILURE);
+    }
+    topo_describe(fj_workers());
+
+    for (i = 0; i < max / 8; i++)
+    {
+	if (type_f64)
+	    ((double *)in)[i] = (i % 977) * 0.25;
+	else
+	    ((int64_t *)in)[i] = i % 977;
+    }
+    memset(out, 0, max);
+    memset(ref, 0, max);
+
+    printf("%d workers, %s %s scan, GB/s of input\n%12s %10s %10s %8s\n", fj_workers(),
+	   exclusive ? "exclusive" : "inclusive", type_f64 ? "double" : "int64",
+	   "bytes", "sequential", "parallel", "check");
+
+    for (size = 4096; size <= max; size *= 4)
+    {
+	n = size / 8;
+	reps = (256 << 20) / size;
+	reps = reps < 3 ? 3 : reps > 10000 ? 10000 : reps;
+
+	for (seq = 1e30, r = 0; r < reps; r++)
+	{
+	    t = now();
+	    seq_scan(in, ref, n);
+	    if ((t = now() - t) < seq)
+		seq = t;
+	}
+
+	if (type_f64)     /* reference: the first parallel run */
+	    parallel_scan_f64((double *)in, (double *)ref, n, exclusive);
+
+	for (ok = 1, par = 1e30, r = 0; r < reps; r++)
+	{
+	    t = now();
+	    if (type_f64)
+		parallel_scan_f64((double *)in, (double *)out, n, exclusive);
+	    else
+		parallel_scan_i64((int64_t *)in, (int64_t *)out, n, exclusive);
+	    if ((t = now() - t) < par)
+		par = t;
+
+	    ok &= check(out, ref, n);
+	}
+
+	printf("%12zu %10.2f %10.2f %8s\n", size, size / seq / 1e9, size / par / 1e9, ok ? "ok" : "WRONG");
+	fflush(stdout);
+    }
+
+    free(in);
+    free(out);
+    free(ref);
+    fj_shutdown();
+    return 0;
+}
+
+
+void seq_scan(const void *in, void *out, size_t n)
+{
+    size_t i;
+
+    if (type_f64)
+    {
+	const double *a = in;
+	double *b = out, sum = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    b[i] = exclusive ? sum : sum + a[i];
+	    sum += a[i];
+	}
+    }
+    else
+    {
+	const int64_t *a = in;
+	int64_t *b = out, sum = 0;
+
+	for (i = 0; i < n; i++)
+	{
+	    b[i] = exclusive ? sum : sum + a[i];
+	    sum += a[i];
+	}
+    }
+}
+
+
+int check(const void *a, const void *b, size_t n)     /* bitwise equal */
+{
+    return memcmp(a, b, n * 8) == 0;
+}
+
+
+size_t parse_size(const char *s)
+{
+    char *end;
+    size_t n = strtoul(s, &end, 10);
+
+    switch (*end)
+    {
+    case 'G': case 'g': n <<= 10;     /* fall through */
+    case 'M': case 'm': n <<= 10;     /* fall through */
+    case 'K': case 'k': n <<= 10;
+    }
+
+    return n;
+}
+
+
+double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,319 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "stage.h"
+#include "topo.h"
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    int go;                          /* 1: run, -1: a thread couldn't be created, give up */
+}
+    gate = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+
+static void *stage_thread(void *arg);
+static int queue_init(Stage_Queue *q, int size);
+static void queue_put(Stage_Queue *q, void *item, double *blocked);
+static int queue_get(Stage_Queue *q, void **item, double *starved);
+static void queue_close(Stage_Queue *q);
+static double now();
+
+
+Stage_Pipeline *stage_pipeline_create(void)
+{
+    return calloc(1, sizeof(Stage_Pipeline));
+}
+
+
+int stage_add(Stage_Pipeline *p, const char *name, int threads, int queue_size, Stage_Fn fn, void *arg)
+{
+    Stage *s;
+
+    if (p->n == STAGE_MAX || threads < 1 || threads > STAGE_MAX_THREADS || (p->n > 0 && queue_size < 1))
+    {
+	errno = EINVAL;
+	return -1;
+    }
+
+    s = &p->stages[p->n];
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->fn = fn;
+    s->arg = arg;
+    s->threads = threads;
+
+    if (p->n > 0)     /* its input is the previous stage's output */
+    {
+	if ((s->in = malloc(sizeof(Stage_Queue))) == 0 || queue_init(s->in, queue_size) == -1)
+	{
+	    free(s->in);
+	    return -1;
+	}
+	p->stages[p->n - 1].out = s->in;
+    }
+    return p->n++;
+}
+
+
+/* every thread is created before any of them starts, so that if one can't
+   be, none has run and there's nothing half-done to drain.  The queues are
+   emptied and reopened first, so a pipeline can be run again. */
+int stage_run(Stage_Pipeline *p)
+{
+    pthread_attr_t attr;
+    int i, t, k, created = 0, rc = 0;
+    double start;
+
+    gate.go = 0;
+    for (i = 0; i < p->n; i++)
+    {
+	if (p->stages[i].in)
+	{
+	    p->stages[i].in->in = p->stages[i].in->out = p->stages[i].in->count = 0;
+	    p->stages[i].in->closed = 0;
+	}
+	p->stages[i].running = p->stages[i].threads;
+	for (t = 0; t < p->stages[i].threads; t++)
+	{
+	    memset(&p->stages[i].ctx[t].m, 0, sizeof(Stage_Metrics));
+	    p->stages[i].ctx[t].stage = &p->stages[i];
+	    p->stages[i].ctx[t].thread = t;
+	}
+    }
+
+    for (i = 0; i < p->n && rc == 0; i++)
+	for (t = 0; t < p->stages[i].threads && rc == 0; t++)
+	    if ((rc = pthread_create(&p->stages[i].ctx[t].id, topo_attr(&attr, created), stage_thread, &p->stages[i].ctx[t])) == 0)
+		created++;
+
+    start = now();
+    pthread_mutex_lock(&gate.lock);
+    gate.go = rc == 0 ? 1 : -1;
+    pthread_cond_broadcast(&gate.start);
+    pthread_mutex_unlock(&gate.lock);
+
+    for (i = 0, k = 0; i < p->n; i++)     /* only the ones that were created: the first created, in order */
+	for (t = 0; t < p->stages[i].threads && k < created; t++, k++)
+	    pthread_join(p->stages[i].ctx[t].id, 0);
+    p->elapsed = now() - start;
+
+    if (rc != 0)
+    {
+	errno = rc;
+	return -1;
+    }
+    return 0;
+}
+
+
+static void *stage_thread(void *arg)
+{
+    Stage_Context *ctx = arg;
+    Stage *s = ctx->stage;
+    void *item;
+    double start;
+
+    pthread_mutex_lock(&gate.lock);
+    while (gate.go == 0)
+	pthread_cond_wait(&gate.start, &gate.lock);
+    pthread_mutex_unlock(&gate.lock);
+    if (gate.go < 0)
+	return 0;
+
+    start = now();
+    if (s->in == 0)     /* the source */
+	s->fn(ctx, 0, s->arg);
+    else
+	while (queue_get(s->in, &item, &ctx->m.starved))
+	{
+	    ctx->m.items_in++;
+	    s->fn(ctx, item, s->arg);
+	}
+    ctx->m.elapsed = now() - start;
+
+    if (atomic_fetch_sub(&s->running, 1) == 1 && s->out)     /* the stage's last thread */
+	queue_close(s->out);
+    return 0;
+}
+
+
+void stage_emit(Stage_Context *ctx, void *item)
+{
+    ctx->m.items_out++;
+    if (ctx->stage->out)
+	queue_put(ctx->stage->out, item, &ctx->m.blocked);
+}
+
+
+void stage_metrics(const Stage_Pipeline *p, int stage, Stage_Metrics *m)     /* summed over its threads */
+{
+    const Stage *s = &p->stages[stage];
+    int t;
+
+    memset(m, 0, sizeof(*m));
+    for (t = 0; t < s->threads; t++)
+    {
+	m->items_in += s->ctx[t].m.items_in;
+	m->items_out += s->ctx[t].m.items_out;
+	m->blocked += s->ctx[t].m.blocked;
+	m->starved += s->ctx[t].m.starved;
+	m->elapsed += s->ctx[t].m.elapsed;
+    }
+}
+
+
+static double busy(const Stage_Metrics *m)     /* fraction of its threads' time spent working */
+{
+    return m->elapsed > 0 ? (m->elapsed - m->blocked - m->starved) / m->elapsed : 0;
+}
+
+
+int stage_bottleneck(const Stage_Pipeline *p)     /* the busiest stage, or -1 */
+{
+    Stage_Metrics m;
+    double most = -1;
+    int i, worst = -1;
+
+    for (i = 0; i < p->n; i++)
+    {
+	stage_metrics(p, i, &m);
+	if (busy(&m) > most)
+	{
+	    most = busy(&m);
+	    worst = i;
+	}
+    }
+    return worst;
+}
+
+
+void stage_report(const Stage_Pipeline *p, FILE *f)
+{
+    Stage_Metrics m;
+    double items;
+    int i, b = stage_bottleneck(p);
+
+    fprintf(f, "%-12s %7s %10s %11s %6s %8s %8s\n", "stage", "threads", "items", "items/s", "busy", "blocked", "starved");
+    for (i = 0; i < p->n; i++)
+    {
+	stage_metrics(p, i, &m);
+	items = i == 0 ? m.items_out : m.items_in;
+	fprintf(f, "%-12s %7d %10llu %11.0f %5.0f%% %7.0f%% %7.0f%%%s\n", p->stages[i].name, p->stages[i].threads,
+		(unsigned long long)items, p->elapsed > 0 ? items / p->elapsed : 0, 100 * busy(&m),
+		m.elapsed > 0 ? 100 * m.blocked / m.elapsed : 0, m.elapsed > 0 ? 100 * m.starved / m.elapsed : 0,
+		i == b ? "  <-" : "");
+    }
+
+    if (b < 0)
+	return;
+    stage_metrics(p, b, &m);
+    fprintf(f, "%.3f s; bottleneck: %s, busy %.0f%% of the time", p->elapsed, p->stages[b].name, 100 * busy(&m));
+    if (busy(&m) > 0.8)
+	fprintf(f, " - the stages before it wait for it: give it more threads, or make it cheaper\n");
+    else
+	fprintf(f, " - no stage is busy all the time: the queues or the machine are the limit\n");
+}
+
+
+void stage_pipeline_destroy(Stage_Pipeline *p)
+{
+    int i;
+
+    for (i = 1; i < p->n; i++)
+    {
+	pthread_mutex_destroy(&p->stages[i].in->lock);
+	pthread_cond_destroy(&p->stages[i].in->not_full);
+	pthread_cond_destroy(&p->stages[i].in->not_empty);
+	free(p->stages[i].in->items);
+	free(p->stages[i].in);
+    }
+    free(p);
+}
+
+
+static int queue_init(Stage_Queue *q, int size)
+{
+    memset(q, 0, sizeof(*q));
+    if ((q->items = malloc(size * sizeof(void *))) == 0)
+	return -1;
+    q->size = size;
+    pthread_mutex_init(&q->lock, 0);
+    pthread_cond_init(&q->not_full, 0);
+    pthread_cond_init(&q->not_empty, 0);
+    return 0;
+}
+
+
+/* put and get time only the waits: the clock isn't read at all when the
+   queue has room (or an item) already */
+static void queue_put(Stage_Queue *q, void *item, double *blocked)
+{
+    double t;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->size)
+    {
+	t = now();
+	while (q->count == q->size)
+	    pthread_cond_wait(&q->not_full, &q->lock);
+	*blocked += now() - t;
+    }
+
+    q->items[q->in] = item;     /* enqueue */
+    q->in = (q->in + 1) % q->size;
+    q->count++;
+
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+static int queue_get(Stage_Queue *q, void **item, double *starved)     /* 0: closed and drained */
+{
+    double t;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count == 0 && !q->closed)
+    {
+	t = now();
+	while (q->count == 0 && !q->closed)
+	    pthread_cond_wait(&q->not_empty, &q->lock);
+	*starved += now() - t;
+    }
+
+    if (q->count == 0)
+    {
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+    }
+
+    *item = q->items[q->out];     /* dequeue */
+    q->out = (q->out + 1) % q->size;
+    q->count--;
+
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return 1;
+}
+
+
+static void queue_close(Stage_Queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+static double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
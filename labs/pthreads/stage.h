@@ -0,0 +1,116 @@
+#ifndef STAGE_H
+#define STAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* a pipeline of stages in one process: each stage is a function run by
+   one or more threads, and each stage hands its results to the next
+   through a bounded queue - the bounded buffer of prodcons.c, with its
+   busy waits replaced by condition variables.  A full queue blocks the
+   stage feeding it (backpressure: a slow stage slows everything before
+   it instead of letting its input pile up), and an empty one blocks the
+   stage reading it.
+
+   Usage:
+       Stage_Pipeline *p = stage_pipeline_create();
+       stage_add(p, "parse", 1, 0, parse, &in);         the source: queue size unused
+       stage_add(p, "transform", 4, 256, transform, 0); 4 threads, reading a 256-item queue
+       stage_add(p, "emit", 1, 256, emit, &out);
+       stage_run(p);                                    start every thread, wait for them all
+       stage_report(p, stdout);
+       stage_pipeline_destroy(p);
+
+       void transform(Stage_Context *ctx, void *item, void *arg)
+       {
+           ...
+           stage_emit(ctx, result);                     to the next stage (any number of times)
+       }
+
+   The first stage's function is called once per thread, with item 0, and
+   emits until it has nothing more to produce; every other stage's is
+   called once per item.  When every thread of a stage has returned, its
+   output queue is closed, and the next stage finishes once it has drained
+   it.  Items are pointers that the stages own in turn; what the last stage
+   emits is counted and dropped.  A stage with several threads doesn't
+   keep its items in order.
+
+   Each thread counts its items and the time it spends waiting on a full
+   output queue (blocked) and on an empty input queue (starved), timing
+   only the waits themselves.  stage_report shows, per stage, items/s,
+   how busy its threads were, and blocked and starved as a fraction of
+   their time; the bottleneck is the busiest stage - the ones before it
+   are blocked by it and the ones after it starved by it.  Busy is what's
+   left of a thread's time after its waits, so with more threads than
+   CPUs it includes time spent runnable but not running.
+
+   Threads are created with topo_attr (topo.h), numbered across the whole
+   pipeline in stage order, so --placement applies.  Only one stage_run
+   may be in progress at a time.
+*/
+
+#define STAGE_MAX 16                 /* stages in a pipeline */
+#define STAGE_MAX_THREADS 64         /* threads in a stage */
+
+typedef struct
+{
+    void **items;
+    int size, in, out, count;        /* ring of size slots: in = next put, out = next get */
+    int closed;                      /* no more items will be put */
+    pthread_mutex_t lock;
+    pthread_cond_t not_full, not_empty;
+}
+    Stage_Queue;
+
+typedef struct
+{
+    uint64_t items_in, items_out;
+    double blocked, starved;         /* seconds waiting on a full / empty queue */
+    double elapsed;                  /* seconds the thread ran */
+}
+    Stage_Metrics;
+
+typedef struct Stage Stage;
+
+typedef struct
+{
+    Stage *stage;
+    int thread;                      /* 0 .. threads-1 within the stage */
+    pthread_t id;
+    Stage_Metrics m;                 /* written only by this thread */
+}
+    Stage_Context;
+
+typedef void (*Stage_Fn)(Stage_Context *ctx, void *item, void *arg);
+
+struct Stage
+{
+    const char *name;
+    Stage_Fn fn;
+    void *arg;
+    int threads;
+    Stage_Queue *in, *out;           /* 0 for the first stage's input, the last one's output */
+    _Atomic int running;             /* threads still running: the last one closes out */
+    Stage_Context ctx[STAGE_MAX_THREADS];
+};
+
+typedef struct
+{
+    Stage stages[STAGE_MAX];
+    int n;
+    double elapsed;                  /* of the whole run */
+}
+    Stage_Pipeline;
+
+Stage_Pipeline *stage_pipeline_create(void);
+int stage_add(Stage_Pipeline *p, const char *name, int threads, int queue_size, Stage_Fn fn, void *arg);
+int stage_run(Stage_Pipeline *p);
+void stage_emit(Stage_Context *ctx, void *item);
+void stage_metrics(const Stage_Pipeline *p, int stage, Stage_Metrics *m);
+int stage_bottleneck(const Stage_Pipeline *p);
+void stage_report(const Stage_Pipeline *p, FILE *f);
+void stage_pipeline_destroy(Stage_Pipeline *p);
+
+#endif
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stage.h"
+#include "topo.h"
+
+/* a parse -> transform -> emit service on the stage framework (stage.h):
+
+     parse       the source: formats each record as text ("id,value") and
+                 parses it back, as if it had been read
+     transform   the per-record work
+     emit        folds the records into a checksum and frees them
+
+   Each stage's cost per item is a number of rounds of a hash (-w), and its
+   thread count is set with -t; the report says which stage is holding the
+   others back, and adding threads there (and only there) is what helps.
+   The checksum is checked against the same work done in one thread.
+
+     stage_demo [-n items] [-t threads,threads,threads] [-w rounds,rounds,rounds] [-q queue size] [--placement=policy]
+*/
+
+typedef struct
+{
+    long id;
+    uint64_t value;
+}
+    Record;
+
+long n_items = 1000000;
+long rounds[3] = { 200, 2000, 100 };
+_Atomic uint64_t checksum;
+
+void parse(Stage_Context *ctx, void *item, void *arg);
+void transform(Stage_Context *ctx, void *item, void *arg);
+void emit(Stage_Context *ctx, void *item, void *arg);
+uint64_t mix(uint64_t x, long rounds);
+int parse_list(char *s, long *list, int max);
+
+
+int main(int argc, char **argv)
+{
+    long threads[3] = { 1, 1, 1 }, i;
+    int opt, queue = 256;
+    uint64_t expected = 0;
+    Stage_Pipeline *p;
+
+    if (topo_option(&argc, argv) == -1)     /* --placement=policy, for every stage's threads */
+	exit(EXIT_FAILURE);
+
+    while ((opt = getopt(argc, argv, "n:t:w:q:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'n': n_items = atol(optarg); break;
+	case 't': parse_list(optarg, threads, 3); break;
+	case 'w': parse_list(optarg, rounds, 3); break;
+	case 'q': queue = atoi(optarg); break;
+	default:
+	    fprintf(stderr, "usage: %s [-n items] [-t threads,threads,threads] [-w rounds,rounds,rounds]"
+		    " [-q queue size] [--placement=policy]\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    if ((p = stage_pipeline_create()) == 0
+	|| stage_add(p, "parse", threads[0], 0, parse, 0) == -1
+	|| stage_add(p, "transform", threads[1], queue, transform, 0) == -1
+	|| stage_add(p, "emit", threads[2], queue, emit, 0) == -1)
+    {
+	perror("stage_demo: bad stage settings");
+	exit(EXIT_FAILURE);
+    }
+
+    topo_describe(threads[0] + threads[1] + threads[2]);
+    printf("%ld items; rounds per item %ld, %ld, %ld; queues of %d\n\n", n_items, rounds[0], rounds[1], rounds[2], queue);
+
+    if (stage_run(p) == -1)
+    {
+	perror("stage_demo: can't start the threads");
+	exit(EXIT_FAILURE);
+    }
+    stage_report(p, stdout);
+
+    for (i = 0; i < n_items; i++)
+	expected += mix(mix(mix(i, rounds[0]), rounds[1]), rounds[2]);
+    printf("\nchecksum %s\n", checksum == expected ? "ok" : "WRONG");
+
+    stage_pipeline_destroy(p);
+    return checksum == expected ? 0 : 1;
+}
+
+
+void parse(Stage_Context *ctx, void *item, void *arg)     /* the source: its share of the ids */
+{
+    char text[64], *end;
+    Record *r;
+    long id;
+
+    for (id = ctx->thread; id < n_items; id += ctx->stage->threads)
+    {
+	snprintf(text, sizeof(text), "%ld,%llu", id, (unsigned long long)id);
+	if ((r = malloc(sizeof(Record))) == 0)
+	    abort();
+	r->id = strtol(text, &end, 10);
+	r->value = mix(strtoull(end + 1, 0, 10), rounds[0]);
+	stage_emit(ctx, r);
+    }
+}
+
+
+void transform(Stage_Context *ctx, void *item, void *arg)
+{
+    Record *r = item;
+
+    r->value = mix(r->value, rounds[1]);
+    stage_emit(ctx, r);
+}
+
+
+void emit(Stage_Context *ctx, void *item, void *arg)
+{
+    Record *r = item;
+
+    atomic_fetch_add(&checksum, mix(r->value, rounds[2]));     /* a sum: the order doesn't matter */
+    free(r);
+}
+
+
+uint64_t mix(uint64_t x, long rounds)     /* the simulated work: rounds of a 64-bit finalizer */
+{
+    while (rounds-- > 0)
+    {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x += 0x9e3779b97f4a7c15ULL;
+    }
+    return x;
+}
+
+
+int parse_list(char *s, long *list, int max)     /* comma-separated numbers: how many */
+{
+    int n = 0;
+
+    for (s = strtok(s, ","); s && n < max; s = strtok(0, ","))
+	list[n++] = atol(s);
+    return n;
+}
@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "topo.h"
+
+#define SYS_CPU "/sys/devices/system/cpu"
+
+typedef struct
+{
+    int key[4];
+    int cpu;
+}
+    Sort_Entry;
+
+static const char *policy_names[] = { "none", "compact", "scatter", "same-l3", "one-per-core" };
+
+static struct
+{
+    Topo_Policy policy;
+    int order[TOPO_MAX_CPUS];
+    int norder;
+}
+    placement;
+
+static Topo topo;     /* big: keep it off the stack */
+
+static int read_list(const char *path, cpu_set_t *set);
+static int first_cpu(const cpu_set_t *set);
+static int rank_in(const cpu_set_t *set, int cpu);
+static int cpu_node(int cpu);
+static int rank_among(const Topo *t, const Topo_Cpu *c, int same_l3);
+static int compare_entries(const void *a, const void *b);
+
+
+int topo_read(Topo *t)
+{
+    cpu_set_t allowed, set;
+    char path[128], level[8];
+    Topo_Cpu *c;
+    FILE *f;
+    int cpu, i, lvl;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+	return -1;
+
+    t->ncpus = 0;
+
+    for (cpu = 0; cpu < TOPO_MAX_CPUS && cpu < CPU_SETSIZE; cpu++)
+    {
+	if (!CPU_ISSET(cpu, &allowed))
+	    continue;
+
+	c = &t->cpus[t->ncpus++];
+	c->cpu = cpu;
+	c->core = cpu;
+	c->smt = 0;
+	c->l2 = c->l3 = -1;
+	c->node = cpu_node(cpu);
+
+	snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/thread_siblings_list", cpu);
+	if (read_list(path, &set) == 0)
+	{
+	    c->core = first_cpu(&set);
+	    CPU_AND(&set, &set, &allowed);     /* first of the ones we may use: a lone second hyperthread is 0 */
+	    c->smt = rank_in(&set, cpu);
+	}
+
+	for (i = 0; ; i++)     /* cache/index0, index1 ... until one is missing */
+	{
+	    snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/level", cpu, i);
+	    if ((f = fopen(path, "r")) == 0)
+		break;
+	    lvl = fgets(level, sizeof(level), f) ? atoi(level) : 0;
+	    fclose(f);
+
+	    snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+	    if ((lvl == 2 || lvl == 3) && read_list(path, &set) == 0)
+		*(lvl == 2 ? &c->l2 : &c->l3) = first_cpu(&set);
+	}
+    }
+
+    return 0;
+}
+
+
+/* fill cpus with the CPUs of t in the order the policy uses them; returns
+   how many there are
+*/
+
+int topo_order(const Topo *t, Topo_Policy policy, int *cpus)
+{
+    static Sort_Entry e[TOPO_MAX_CPUS];
+    const Topo_Cpu *c;
+    int i, n = 0;
+
+    for (i = 0; i < t->ncpus; i++)
+    {
+	c = &t->cpus[i];
+
+	switch (policy)
+	{
+	case TOPO_NONE:
+	case TOPO_COMPACT:
+	    e[n] = (Sort_Entry){ { c->node, c->l3, c->core, c->smt }, c->cpu };
+	    break;
+	case TOPO_SCATTER:     /* k'th core of every L3 (of every node) before the k+1'th */
+	    e[n] = (Sort_Entry){ { c->smt, rank_among(t, c, 1), rank_among(t, c, 0), c->node }, c->cpu };
+	    break;
+	case TOPO_SAME_L3:
+	    if (c->l3 != t->cpus[0].l3)
+		continue;
+	    e[n] = (Sort_Entry){ { c->smt, c->core, 0, 0 }, c->cpu };
+	    break;
+	case TOPO_ONE_PER_CORE:
+	    if (c->smt != 0)
+		continue;
+	    e[n] = (Sort_Entry){ { c->node, c->l3, c->core, 0 }, c->cpu };
+	    break;
+	}
+	n++;
+    }
+
+    qsort(e, n, sizeof(Sort_Entry), compare_entries);
+
+    for (i = 0; i < n; i++)
+	cpus[i] = e[i].cpu;
+
+    return n;
+}
+
+
+Topo_Policy topo_parse_policy(const char *name)     /* -1 if unknown */
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(policy_names) / sizeof(policy_names[0])); i++)
+	if (strcmp(name, policy_names[i]) == 0)
+	    return i;
+
+    return -1;
+}
+
+
+/* find and remove --placement=POLICY from the arguments, and work out the
+   CPU order for it.  Returns -1 (with a message) if the policy is unknown.
+*/
+
+int topo_option(int *argc, char **argv)
+{
+    int i, j, p;
+
+    for (i = 1; i < *argc; i++)
+    {
+	if (strncmp(argv[i], "--placement=", 12) != 0)
+	    continue;
+
+	if ((p = topo_parse_policy(argv[i] + 12)) == -1)
+	{
+	    fprintf(stderr, "%s: unknown placement '%s' (compact, scatter, same-l3, one-per-core)\n",
+		    argv[0], argv[i] + 12);
+	    return -1;
+	}
+
+	for (j = i; j < *argc; j++)     /* argv[*argc] is 0 and moves down too */
+	    argv[j] = argv[j + 1];
+	(*argc)--;
+	i--;
+
+	placement.policy = p;
+    }
+
+    if (placement.policy != TOPO_NONE)
+    {
+	if (topo_read(&topo) == -1)
+	{
+	    perror("reading the CPU topology failed");
+	    return -1;
+	}
+	placement.norder = topo_order(&topo, placement.policy, placement.order);
+	if (placement.norder == 0)
+	    fprintf(stderr, "%s: no allowed CPU fits placement '%s': threads won't be placed\n",
+		    argv[0], policy_names[placement.policy]);
+    }
+
+    return 0;
+}
+
+
+Topo_Policy topo_policy(void)
+{
+    return placement.policy;
+}
+
+
+/* attributes pinning the thread'th thread per the chosen policy, for
+   pthread_create - or 0 (default attributes) if there's no policy
+*/
+
+pthread_attr_t *topo_attr(pthread_attr_t *attr, int thread)
+{
+    cpu_set_t set;
+
+    if (placement.policy == TOPO_NONE || placement.norder == 0)
+	return 0;
+
+    CPU_ZERO(&set);
+    CPU_SET(placement.order[thread % placement.norder], &set);
+
+    pthread_attr_init(attr);
+    pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    return attr;
+}
+
+
+int topo_pin_self(int thread)     /* for threads that already exist, e.g. main */
+{
+    cpu_set_t set;
+
+    if (placement.policy == TOPO_NONE || placement.norder == 0)
+	return 0;
+
+    CPU_ZERO(&set);
+    CPU_SET(placement.order[thread % placement.norder], &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+}
+
+
+void topo_describe(int nthreads)     /* thread -> CPU, on stderr */
+{
+    int i;
+
+    if (placement.policy == TOPO_NONE || placement.norder == 0)
+	return;
+
+    fprintf(stderr, "placement %s: threads on cpus", policy_names[placement.policy]);
+    for (i = 0; i < nthreads; i++)
+	fprintf(stderr, " %d", placement.order[i % placement.norder]);
+    fprintf(stderr, "\n");
+}
+
+
+static int read_list(const char *path, cpu_set_t *set)     /* e.g. "0-3,8-11" */
+{
+    char buf[4096], *p;
+    FILE *f;
+    long lo, hi;
+
+    if ((f = fopen(path, "r")) == 0)
+	return -1;
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    if (p == 0)
+	return -1;
+
+    CPU_ZERO(set);
+
+    while (*p >= '0' && *p <= '9')
+    {
+	lo = hi = strtol(p, &p, 10);
+	if (*p == '-')
+	    hi = strtol(p + 1, &p, 10);
+	for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+	    CPU_SET(lo, set);
+	if (*p == ',')
+	    p++;
+    }
+
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+
+static int first_cpu(const cpu_set_t *set)
+{
+    int cpu;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	if (CPU_ISSET(cpu, set))
+	    return cpu;
+
+    return -1;
+}
+
+
+static int rank_in(const cpu_set_t *set, int cpu)     /* how many CPUs of set come before cpu */
+{
+    int i, n = 0;
+
+    for (i = 0; i < cpu; i++)
+	n += CPU_ISSET(i, set) != 0;
+
+    return n;
+}
+
+
+static int cpu_node(int cpu)     /* the cpuN/nodeM link; 0 without NUMA */
+{
+    char path[64];
+    struct dirent *d;
+    DIR *dir;
+    int node = 0;
+
+    snprintf(path, sizeof(path), SYS_CPU "/cpu%d", cpu);
+    if ((dir = opendir(path)) == 0)
+	return 0;
+
+    while ((d = readdir(dir)) != 0)
+	if (strncmp(d->d_name, "node", 4) == 0 && d->d_name[4] >= '0' && d->d_name[4] <= '9')
+	    node = atoi(d->d_name + 4);
+
+    closedir(dir);
+    return node;
+}
+
+
+/* same_l3: how many cores of c's L3 come before c's core.
+   otherwise: how many L3s of c's node come before c's L3.
+   Only the allowed CPUs are in t, and a core's or an L3's first CPU may
+   not be one of them, so each distinct core (or L3) is counted once
+   rather than by its first CPU.
+*/
+
+static int rank_among(const Topo *t, const Topo_Cpu *c, int same_l3)
+{
+    static char seen[TOPO_MAX_CPUS];     /* by core / L3: their ids are CPU numbers */
+    const Topo_Cpu *o;
+    int i, id, n = 0;
+
+    memset(seen, 0, sizeof(seen));
+    for (i = 0; i < t->ncpus; i++)
+    {
+	o = &t->cpus[i];
+	id = same_l3 ? o->core : o->l3;
+
+	if (same_l3 ? o->l3 != c->l3 || o->core >= c->core : o->node != c->node || o->l3 >= c->l3)
+	    continue;
+	if (id < 0 || seen[id])
+	    continue;
+	seen[id] = 1;
+	n++;
+    }
+
+    return n;
+}
+
+
+static int compare_entries(const void *a, const void *b)
+{
+    const Sort_Entry *x = a, *y = b;
+    int i;
+
+    for (i = 0; i < 4; i++)
+	if (x->key[i] != y->key[i])
+	    return x->key[i] < y->key[i] ? -1 : 1;
+
+    return x->cpu - y->cpu;
+}
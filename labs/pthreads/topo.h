@@ -0,0 +1,62 @@
+#ifndef TOPO_H
+#define TOPO_H
+
+#include <pthread.h>
+
+/* CPU topology (from /sys/devices/system/cpu) and thread placement.
+
+   topo_read finds, for each CPU this process may run on, its core, its
+   position among the core's SMT siblings, the L2 and L3 caches it shares
+   and its NUMA node.  A placement policy orders those CPUs, and thread i
+   of a program is pinned to the i'th CPU in that order (wrapping around
+   if there are more threads than CPUs):
+
+     compact       fill each core's SMT siblings, then the next core in the
+                   same L3, then the next L3 - neighbouring threads share
+                   as much cache as possible
+     scatter       one thread per core, spread across L3s and nodes first,
+                   then the second SMT sibling of each core
+     same-l3       every thread in the first L3 domain, on different cores
+                   before doubling up on siblings
+     one-per-core  only the first SMT sibling of each core, in compact order
+                   - threads never compete for a core's execution units
+
+   Programs take the common option --placement=POLICY (topo_option) and
+   create their threads with topo_attr(&attr, i) where they used to pass
+   0 for the attributes; with no option given, topo_attr returns 0 and
+   nothing changes.
+*/
+
+#define TOPO_MAX_CPUS 1024
+
+typedef enum { TOPO_NONE, TOPO_COMPACT, TOPO_SCATTER, TOPO_SAME_L3, TOPO_ONE_PER_CORE } Topo_Policy;
+
+typedef struct
+{
+    int cpu;         /* logical CPU number */
+    int core;        /* first CPU of its SMT sibling list (identifies the core) */
+    int smt;         /* position among its siblings: 0 = first hardware thread */
+    int l2;          /* first CPU sharing its L2 / L3, or -1 if unknown */
+    int l3;
+    int node;        /* NUMA node */
+}
+    Topo_Cpu;
+
+typedef struct
+{
+    int ncpus;
+    Topo_Cpu cpus[TOPO_MAX_CPUS];     /* in CPU number order */
+}
+    Topo;
+
+int topo_read(Topo *t);
+int topo_order(const Topo *t, Topo_Policy policy, int *cpus);
+Topo_Policy topo_parse_policy(const char *name);
+
+int topo_option(int *argc, char **argv);
+Topo_Policy topo_policy(void);
+pthread_attr_t *topo_attr(pthread_attr_t *attr, int thread);
+int topo_pin_self(int thread);
+void topo_describe(int nthreads);
+
+#endif
@@ -0,0 +1,31 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* echo_rt.c on glibc, for comparison: the same work, so any difference
+   is in starting up (dynamic linking, libc initialization) and exiting. */
+
+int main(int argc, char **argv)
+{
+    size_t n = 0, len;
+    char *line, *p;
+    int i;
+
+    for (i = 1; i < argc; i++)
+	n += strlen(argv[i]) + 1;
+
+    if ((line = p = malloc(n + 1)) == 0)
+	return 1;
+
+    for (i = 1; i < argc; i++)
+    {
+	len = strlen(argv[i]);
+	memcpy(p, argv[i], len);
+	p += len;
+	*p++ = i < argc - 1 ? ' ' : '\n';
+    }
+    if (argc == 1)
+	*p++ = '\n';
+
+    return write(1, line, p - line) < 0;
+}
@@ -0,0 +1,29 @@
+#include "rt.h"
+
+/* echo, on the freestanding runtime: the kind of short-lived helper that
+   is run over and over.  echo_libc.c is the same program on glibc. */
+
+int main(int argc, char **argv, char **envp)
+{
+    size_t n = 0, len;
+    char *line, *p;
+    int i;
+
+    for (i = 1; i < argc; i++)
+	n += rt_strlen(argv[i]) + 1;
+
+    if ((line = p = rt_alloc(n + 1)) == 0)
+	return 1;
+
+    for (i = 1; i < argc; i++)
+    {
+	len = rt_strlen(argv[i]);
+	memcpy(p, argv[i], len);
+	p += len;
+	*p++ = i < argc - 1 ? ' ' : '\n';
+    }
+    if (argc == 1)
+	*p++ = '\n';
+
+    return rt_write_all(1, line, p - line) < 0;
+}
@@ -0,0 +1,168 @@
+#include "rt.h"
+
+/* the runtime itself: startup, the environment and auxiliary vector, the
+   bump allocator and the few string functions a small tool needs. */
+
+#define ARENA_SIZE (256 << 10)     /* mapped at a time, unless asked for more */
+#define ALIGN 16
+
+char **rt_environ;
+unsigned long *rt_auxv;
+
+static char *arena, *arena_end;
+
+void rt_start(long *sp);
+
+
+void rt_start(long *sp)     /* called by _start with the initial stack pointer */
+{
+    int argc = sp[0];
+    char **argv = (char **)(sp + 1);
+    char **p;
+
+    rt_environ = argv + argc + 1;
+    for (p = rt_environ; *p; p++)
+	;
+    rt_auxv = (unsigned long *)(p + 1);
+
+    sys_exit_group(main(argc, argv, rt_environ));
+}
+
+
+unsigned long rt_getauxval(unsigned long type)
+{
+    unsigned long *a;
+
+    for (a = rt_auxv; a[0] != AT_NULL; a += 2)
+	if (a[0] == type)
+	    return a[1];
+    return 0;
+}
+
+
+char *rt_getenv(const char *name)
+{
+    size_t n = rt_strlen(name), i;
+    char **p;
+
+    for (p = rt_environ; *p; p++)
+    {
+	for (i = 0; i < n && (*p)[i] == name[i]; i++)
+	    ;
+	if (i == n && (*p)[n] == '=')
+	    return *p + n + 1;
+    }
+    return 0;
+}
+
+
+void *rt_alloc(size_t n)
+{
+    size_t page, size;
+    char *p;
+
+    n = (n + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+
+    if (arena == 0 || (size_t)(arena_end - arena) < n)
+    {
+	/* start a new arena: what's left of the old one is abandoned */
+	page = rt_getauxval(AT_PAGESZ);
+	if (page == 0)
+	    page = 4096;
+	size = n > ARENA_SIZE ? n : ARENA_SIZE;
+	size = (size + page - 1) & ~(page - 1);
+
+	p = sys_mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ((unsigned long)p > -4096UL)
+	    return 0;
+	arena = p;
+	arena_end = p + size;
+    }
+
+    p = arena;
+    arena += n;
+    return p;
+}
+
+
+size_t rt_strlen(const char *s)
+{
+    const char *p = s;
+
+    while (*p)
+	p++;
+    return p - s;
+}
+
+
+int rt_strcmp(const char *a, const char *b)
+{
+    while (*a && *a == *b)
+	a++, b++;
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+
+ssize_t rt_write_all(int fd, const char *s, size_t n)
+{
+    size_t done;
+    ssize_t m;
+
+    for (done = 0; done < n; done += m)
+	if ((m = sys_write(fd, s + done, n - done)) < 0)
+	    return m;
+    return done;
+}
+
+
+ssize_t rt_puts(int fd, const char *s)
+{
+    return rt_write_all(fd, s, rt_strlen(s));
+}
+
+
+char *rt_utoa(unsigned long n, char *buf)
+{
+    char digits[20];
+    int i = 0, j = 0;
+
+    do
+	digits[i++] = '0' + n % 10;
+    while ((n /= 10) != 0);
+
+    while (i > 0)
+	buf[j++] = digits[--i];
+    buf[j] = 0;
+    return buf;
+}
+
+
+long rt_atol(const char *s)
+{
+    long n = 0;
+
+    while (*s >= '0' && *s <= '9')
+	n = n * 10 + *s++ - '0';
+    return n;
+}
+
+
+void *memset(void *s, int c, size_t n)
+{
+    unsigned char *p = s;
+
+    while (n--)
+	*p++ = c;
+    return s;
+}
+
+
+void *memcpy(void *dst, const void *src, size_t n)
+{
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+
+    while (n--)
+	*d++ = *s++;
+    return dst;
+}
@@ -0,0 +1,172 @@
+#ifndef RT_H
+#define RT_H
+
+/* a freestanding runtime: just enough to run a C program with no libc at
+   all, as ../wrap/caller2.c does, but with more than exit.
+
+   start.s provides _start, which hands the initial stack to rt_start:
+   that finds argv, envp and the auxiliary vector the kernel left there,
+   calls main(argc, argv, envp) and exits with what it returns.
+
+   The system calls are inline asm: each one is a few instructions right
+   where it's called, with no errno - like the kernel, they return the
+   result, or -errno on failure.  Memory comes from rt_alloc, a bump
+   allocator over mmap'd arenas that never frees anything, which suits a
+   program that does one job and exits.
+
+   Build with -ffreestanding -fno-stack-protector -nostdlib -static (see
+   the Makefile): the stack protector, for instance, reads a canary that
+   libc would have set up in thread-local storage, and there isn't any.
+*/
+
+#include <stddef.h>
+#include <asm/unistd.h>
+#include <linux/fcntl.h>
+#include <linux/mman.h>
+#include <linux/sched.h>
+#include <linux/auxvec.h>
+#include <linux/ptrace.h>
+#include <linux/resource.h>
+#include <linux/time_types.h>
+
+typedef long ssize_t;
+typedef int pid_t;
+
+#define SIGCHLD 17
+#define CLOCK_MONOTONIC 1
+
+extern char **rt_environ;
+extern unsigned long *rt_auxv;
+
+int main(int argc, char **argv, char **envp);
+
+unsigned long rt_getauxval(unsigned long type);     /* 0 if the kernel didn't pass it */
+char *rt_getenv(const char *name);
+void *rt_alloc(size_t n);                           /* 16-byte aligned, 0 if out of memory */
+
+/* run fn(arg) in a child on its own stack (which stays the caller's to
+   free): the child exits with fn's result.  The child's pid, or -errno. */
+long rt_clone(unsigned long flags, void *stack_top, int (*fn)(void *), void *arg);
+
+size_t rt_strlen(const char *s);
+int rt_strcmp(const char *a, const char *b);
+ssize_t rt_write_all(int fd, const char *s, size_t n);
+ssize_t rt_puts(int fd, const char *s);             /* no newline added */
+char *rt_utoa(unsigned long n, char *buf);          /* buf needs 21 bytes; returns buf */
+long rt_atol(const char *s);
+
+/* the compiler may generate calls to these for structure copies and initializers */
+void *memset(void *s, int c, size_t n);
+void *memcpy(void *dst, const void *src, size_t n);
+
+
+static inline long rt_syscall6(long n, long a, long b, long c, long d, long e, long f)
+{
+    register long r10 __asm__("r10") = d;
+    register long r8 __asm__("r8") = e;
+    register long r9 __asm__("r9") = f;
+    long ret;
+
+    /* the kernel returns in rax and clobbers rcx (return address) and r11 (flags) */
+    __asm__ volatile ("syscall"
+		      : "=a" (ret)
+		      : "a" (n), "D" (a), "S" (b), "d" (c), "r" (r10), "r" (r8), "r" (r9)
+		      : "rcx", "r11", "memory");
+    return ret;
+}
+
+
+static inline long rt_syscall3(long n, long a, long b, long c)
+{
+    long ret;
+
+    __asm__ volatile ("syscall"
+		      : "=a" (ret)
+		      : "a" (n), "D" (a), "S" (b), "d" (c)
+		      : "rcx", "r11", "memory");
+    return ret;
+}
+
+
+static inline ssize_t sys_read(int fd, void *buf, size_t n)
+{
+    return rt_syscall3(__NR_read, fd, (long)buf, n);
+}
+
+
+static inline ssize_t sys_write(int fd, const void *buf, size_t n)
+{
+    return rt_syscall3(__NR_write, fd, (long)buf, n);
+}
+
+
+static inline int sys_open(const char *path, int flags, int mode)
+{
+    return rt_syscall3(__NR_open, (long)path, flags, mode);
+}
+
+
+static inline int sys_close(int fd)
+{
+    return rt_syscall3(__NR_close, fd, 0, 0);
+}
+
+
+static inline int sys_dup2(int old, int new)
+{
+    return rt_syscall3(__NR_dup2, old, new, 0);
+}
+
+
+static inline void *sys_mmap(void *addr, size_t n, int prot, int flags, int fd, long offset)
+{
+    return (void *)rt_syscall6(__NR_mmap, (long)addr, n, prot, flags, fd, offset);     /* -errno on failure */
+}
+
+
+/* the raw call, which continues in both processes from here: only safe
+   without a new stack (like fork), so use rt_clone to start a function on one */
+static inline long sys_clone(unsigned long flags, void *stack, int *parent_tid, int *child_tid, unsigned long tls)
+{
+    return rt_syscall6(__NR_clone, flags, (long)stack, (long)parent_tid, (long)child_tid, tls, 0);
+}
+
+
+static inline int sys_execve(const char *path, char *const argv[], char *const envp[])
+{
+    return rt_syscall3(__NR_execve, (long)path, (long)argv, (long)envp);
+}
+
+
+static inline pid_t sys_wait4(pid_t pid, int *status, int options, struct rusage *usage)
+{
+    return rt_syscall6(__NR_wait4, pid, (long)status, options, (long)usage, 0, 0);
+}
+
+
+static inline long sys_ptrace(long request, pid_t pid, void *addr, void *data)
+{
+    return rt_syscall6(__NR_ptrace, request, pid, (long)addr, (long)data, 0, 0);
+}
+
+
+static inline int sys_clock_gettime(int clock, struct __kernel_timespec *t)
+{
+    return rt_syscall3(__NR_clock_gettime, clock, (long)t, 0);     /* a real syscall: there's no vDSO here */
+}
+
+
+static inline void sys_exit(int status)     /* just this thread */
+{
+    rt_syscall3(__NR_exit, status, 0, 0);
+    __builtin_unreachable();
+}
+
+
+static inline void sys_exit_group(int status)
+{
+    rt_syscall3(__NR_exit_group, status, 0, 0);
+    __builtin_unreachable();
+}
+
+#endif
@@ -0,0 +1,54 @@
+/* entry point and clone trampoline for rt.c (x86-64).
+
+   At _start the kernel has left, from the stack pointer up:
+
+	argc
+	argv[0] ... argv[argc - 1], 0
+	envp[0] ... , 0
+	auxv: (type, value) pairs, ending with AT_NULL
+
+   and nothing else is set up: rsp is 16-byte aligned but there's no
+   return address, so rbp is cleared to mark the outermost frame.
+*/
+
+	.global	_start
+	.global	rt_clone
+
+	.text
+_start:
+	xorl	%ebp, %ebp
+	movq	%rsp, %rdi	/* rt_start(sp) */
+	andq	$-16, %rsp
+	callq	rt_start	/* doesn't return */
+	hlt
+
+/* long rt_clone(unsigned long flags, void *stack_top, int (*fn)(void *), void *arg)
+
+   The child starts with the new stack and the parent's registers, so fn
+   and arg are left on the child's stack for it to pick up. */
+rt_clone:
+	andq	$-16, %rsi
+	subq	$16, %rsi
+	movq	%rdx, (%rsi)	/* fn */
+	movq	%rcx, 8(%rsi)	/* arg */
+
+	movl	$56, %eax	/* clone(flags, stack, 0, 0, 0) */
+	xorl	%edx, %edx
+	xorl	%r10d, %r10d
+	xorl	%r8d, %r8d
+	syscall
+	testq	%rax, %rax
+	jnz	1f		/* the parent (or an error) */
+
+	xorl	%ebp, %ebp	/* the child: exit(fn(arg)) */
+	popq	%rax
+	popq	%rdi
+	callq	*%rax
+	movl	%eax, %edi
+	movl	$60, %eax
+	syscall
+	hlt
+1:
+	ret
+
+	.section	.note.GNU-stack,"",@progbits
@@ -0,0 +1,221 @@
+#include "rt.h"
+
+/* time how long a program takes to run, start to finish, when it's
+   started over and over - and how much memory it touches doing it:
+
+     startbench [-n runs] program [arg...]
+
+   Itself on the runtime, so that it adds as little as possible: each run
+   is a clone sharing our memory (like vfork, so nothing is copied) that
+   sends standard output to /dev/null and execs the program, then a wait4.
+
+   The memory isn't wait4's ru_maxrss: the kernel counts resident pages in
+   per-CPU batches, and the sum it takes at exit can leave out everything
+   a small program touched (echo_rt showed as 0 kB).  Nor can it be read
+   from /proc once the child has exited, since a zombie has no memory
+   left to describe.  So after the timed runs, one more run is traced:
+   it's stopped on its way out (PTRACE_O_TRACEEXIT), with its memory still
+   mapped, and its peak resident set is read from VmHWM in
+   /proc/PID/status (which recent kernels sum over the CPUs exactly) -
+   that of the program alone, since the exec gave it memory of its own. */
+
+#define STACK_SIZE (16 << 10)
+
+#define STATUS_SIZE 4096     /* /proc/PID/status is under 2 kB */
+#define STOPPED(status) (((status) & 0xff) == 0x7f)     /* WIFSTOPPED */
+
+struct job
+{
+    char **argv;
+    int devnull;
+    int traced;
+};
+
+int child(void *arg);
+long peak_rss(struct job *job, char *stack);
+long status_field(long pid, const char *name);
+char *append(char *p, const char *s);
+long now_ns();
+void put_number(const char *label, unsigned long n, const char *unit);
+void put_tenths(const char *label, unsigned long n, const char *unit);
+
+
+int main(int argc, char **argv, char **envp)
+{
+    long runs = 1000, i, pid, t, ns, min_ns = -1, total_ns = 0, rss;
+    struct job job;
+    char *stack;
+    int status;
+
+    argv++;
+    if (*argv && rt_strcmp(*argv, "-n") == 0 && argv[1])
+    {
+	runs = rt_atol(argv[1]);
+	argv += 2;
+    }
+
+    if (*argv == 0 || runs < 1)
+    {
+	rt_puts(2, "usage: startbench [-n runs] program [arg...]\n");
+	return 1;
+    }
+
+    job.argv = argv;
+    job.traced = 0;
+    if ((job.devnull = sys_open("/dev/null", O_WRONLY, 0)) < 0 || (stack = rt_alloc(STACK_SIZE)) == 0)
+    {
+	rt_puts(2, "startbench: setup failed\n");
+	return 1;
+    }
+
+    for (i = 0; i < runs; i++)
+    {
+	t = now_ns();
+	pid = rt_clone(CLONE_VM | CLONE_VFORK | SIGCHLD, stack + STACK_SIZE, child, &job);
+	if (pid < 0 || sys_wait4(pid, &status, 0, 0) < 0)
+	{
+	    rt_puts(2, "startbench: clone or wait4 failed\n");
+	    return 1;
+	}
+	ns = now_ns() - t;
+
+	if (status != 0)     /* 127: the exec failed */
+	{
+	    rt_puts(2, "startbench: ");
+	    rt_puts(2, argv[0]);
+	    rt_puts(2, " failed\n");
+	    return 1;
+	}
+
+	total_ns += ns;
+	if (min_ns == -1 || ns < min_ns)
+	    min_ns = ns;
+    }
+
+    if ((rss = peak_rss(&job, stack)) < 0)
+    {
+	rt_puts(2, "startbench: can't trace the program to measure its memory\n");
+	return 1;
+    }
+
+    rt_puts(1, argv[0]);
+    put_number(": ", runs, " runs,");
+    put_tenths(" ", total_ns / runs / 100, " us/run");
+    put_tenths(" (min ", min_ns / 100, " us),");
+    put_number(" peak rss ", rss, " kB\n");
+    return 0;
+}
+
+
+int child(void *arg)     /* runs on the small stack, sharing our memory until the exec */
+{
+    struct job *job = arg;
+
+    sys_dup2(job->devnull, 1);
+    if (job->traced)
+	sys_ptrace(PTRACE_TRACEME, 0, 0, 0);     /* stops with SIGTRAP once the exec is done */
+    sys_execve(job->argv[0], job->argv, rt_environ);
+    return 127;
+}
+
+
+/* one traced run: the child's VmHWM in kB, read while it's stopped at
+   exit, or -1 */
+
+long peak_rss(struct job *job, char *stack)
+{
+    long pid, kb = -1;
+    int status;
+
+    job->traced = 1;
+    pid = rt_clone(CLONE_VM | CLONE_VFORK | SIGCHLD, stack + STACK_SIZE, child, job);
+    job->traced = 0;
+    if (pid < 0)
+	return -1;
+
+    /* stopped after the exec: have it stop again at exit, and let it run */
+    if (sys_wait4(pid, &status, 0, 0) == pid && STOPPED(status))
+    {
+	if (sys_ptrace(PTRACE_SETOPTIONS, pid, 0, (void *)(PTRACE_O_TRACEEXIT | PTRACE_O_EXITKILL)) == 0
+	    && sys_ptrace(PTRACE_CONT, pid, 0, 0) == 0
+	    && sys_wait4(pid, &status, 0, 0) == pid && STOPPED(status) && status >> 16 == PTRACE_EVENT_EXIT)
+	    kb = status_field(pid, "VmHWM:");
+	sys_ptrace(PTRACE_CONT, pid, 0, 0);
+    }
+
+    while (sys_wait4(pid, &status, 0, 0) == pid && STOPPED(status))     /* any other stop: carry on */
+	sys_ptrace(PTRACE_CONT, pid, 0, 0);
+    return kb;
+}
+
+
+long status_field(long pid, const char *name)     /* a number from /proc/PID/status, or -1 */
+{
+    static char buf[STATUS_SIZE];
+    char path[40], num[21], *p;
+    const char *q;
+    long n;
+    int fd;
+
+    p = append(append(append(path, "/proc/"), rt_utoa(pid, num)), "/status");
+    *p = 0;
+    if ((fd = sys_open(path, O_RDONLY, 0)) < 0)
+	return -1;
+    n = sys_read(fd, buf, sizeof(buf) - 1);
+    sys_close(fd);
+    buf[n > 0 ? n : 0] = 0;
+
+    for (p = buf; *p; )     /* line by line: "VmHWM:\t      24 kB" */
+    {
+	for (q = name; *q && *p == *q; p++, q++)
+	    ;
+	if (*q == 0)
+	{
+	    while (*p == ' ' || *p == '\t')
+		p++;
+	    return rt_atol(p);
+	}
+	while (*p && *p++ != '\n')
+	    ;
+    }
+    return -1;
+}
+
+
+char *append(char *p, const char *s)     /* copy s to p, without its 0: the end */
+{
+    while (*s)
+	*p++ = *s++;
+    return p;
+}
+
+
+long now_ns()
+{
+    struct __kernel_timespec t;
+
+    sys_clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+
+void put_number(const char *label, unsigned long n, const char *unit)
+{
+    char buf[21];
+
+    rt_puts(1, label);
+    rt_puts(1, rt_utoa(n, buf));
+    rt_puts(1, unit);
+}
+
+
+void put_tenths(const char *label, unsigned long n, const char *unit)     /* n / 10, to one place */
+{
+    char buf[21];
+
+    rt_puts(1, label);
+    rt_puts(1, rt_utoa(n / 10, buf));
+    rt_puts(1, ".");
+    rt_puts(1, rt_utoa(n % 10, buf));
+    rt_puts(1, unit);
+}
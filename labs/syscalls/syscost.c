@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <x86intrin.h>
+
+/* what a system call costs, per call:
+
+     empty            nothing: the cost of timing a call at all, which is
+                      subtracted from all the others
+     getpid raw       the syscall instruction, inline, as in ex9.c and ex4.s
+     getpid glibc     the same call through glibc's wrapper
+     clock vdso       clock_gettime through the vDSO, which reads the clock
+                      in user mode without entering the kernel
+     clock syscall    clock_gettime forced into the kernel
+     write null       a one-byte write to /dev/null
+     futex wake       FUTEX_WAKE with nobody waiting
+     sched_yield      with nothing else to run, the scheduler's round trip
+     pipe pingpong    one byte to a child process and back: two writes, two
+                      reads and two context switches per call
+
+   Each call is timed on its own with the time-stamp counter (fenced, so
+   the call can't be reordered around the reads), after a warm-up, and the
+   report gives the median and tail over all the samples, in TSC cycles
+   and in nanoseconds (the TSC is calibrated against clock_gettime).
+
+     syscost [-n samples] [-w warm-up calls] [test...]
+
+   gcc -O2 syscost.c -o syscost
+*/
+
+typedef struct
+{
+    const char *name;
+    void (*setup)();
+    void (*call)();
+    void (*teardown)();
+}
+Test;
+
+void nothing();
+void getpid_raw();
+void getpid_glibc();
+void clock_vdso();
+void clock_syscall();
+void null_open();
+void null_write();
+void null_close();
+void futex_wake();
+void yield();
+void pingpong_start();
+void pingpong();
+void pingpong_stop();
+
+Test tests[] = {
+    { "empty", 0, nothing, 0 },
+    { "getpid raw", 0, getpid_raw, 0 },
+    { "getpid glibc", 0, getpid_glibc, 0 },
+    { "clock vdso", 0, clock_vdso, 0 },
+    { "clock syscall", 0, clock_syscall, 0 },
+    { "write null", null_open, null_write, null_close },
+    { "futex wake", 0, futex_wake, 0 },
+    { "sched_yield", 0, yield, 0 },
+    { "pipe pingpong", pingpong_start, pingpong, pingpong_stop },
+};
+
+#define N_TESTS (sizeof(tests) / sizeof(tests[0]))
+
+int fd, to_child[2], from_child[2], futex_word;
+pid_t child;
+
+void measure(Test *t, unsigned long long *samples, long n, long warmup);
+int compare(const void *a, const void *b);
+double tsc_per_ns();
+int selected(const char *name, int argc, char **argv);
+
+
+int main(int argc, char **argv)
+{
+    long n = 100000, warmup = 10000, i;
+    int opt;
+    unsigned k;
+    unsigned long long *samples, overhead = 0, median;
+    double ghz;
+
+    while ((opt = getopt(argc, argv, "n:w:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'n': n = atol(optarg); break;
+	case 'w': warmup = atol(optarg); break;
+	default:
+	    fprintf(stderr, "usage: %s [-n samples] [-w warm-up calls] [test...]\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    if (n < 1 || (samples = malloc(n * sizeof(*samples))) == 0)
+    {
+	fprintf(stderr, "syscost: bad sample count\n");
+	exit(EXIT_FAILURE);
+    }
+
+    ghz = tsc_per_ns();
+    printf("TSC %.3f GHz, %ld samples per test\n\n", ghz, n);
+    printf("%-14s %9s %9s %9s %9s %9s %11s\n", "cycles", "median", "p90", "p99", "p99.9", "max", "median ns");
+
+    for (k = 0; k < N_TESTS; k++)
+    {
+	if (k > 0 && !selected(tests[k].name, argc - optind, argv + optind))
+	    continue;
+
+	measure(&tests[k], samples, n, warmup);
+	qsort(samples, n, sizeof(*samples), compare);
+
+	/* the timing's own cost, measured by "empty", comes off every sample */
+	if (k == 0)
+	    overhead = samples[n / 2];
+	for (i = 0; i < n; i++)
+	    samples[i] = samples[i] > overhead ? samples[i] - overhead : 0;
+
+	median = samples[n / 2];
+	printf("%-14s %9llu %9llu %9llu %9llu %9llu %11.1f\n", tests[k].name, median,
+	       samples[(long)(n * 0.9)], samples[(long)(n * 0.99)], samples[(long)(n * 0.999)],
+	       samples[n - 1], median / ghz);
+    }
+
+    printf("\n(\"empty\" is the %llu-cycle timing overhead itself, before subtraction)\n", overhead);
+    free(samples);
+    return 0;
+}
+
+
+void measure(Test *t, unsigned long long *samples, long n, long warmup)
+{
+    unsigned long long start;
+    unsigned aux;
+    long i;
+
+    if (t->setup)
+	t->setup();
+
+    for (i = 0; i < warmup; i++)     /* fault in the code, data and kernel paths */
+	t->call();
+
+    for (i = 0; i < n; i++)
+    {
+	_mm_lfence();
+	start = __rdtsc();
+	_mm_lfence();
+	t->call();
+	samples[i] = __rdtscp(&aux) - start;     /* rdtscp waits for the call to finish */
+	_mm_lfence();
+    }
+
+    if (t->teardown)
+	t->teardown();
+}
+
+
+int compare(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+double tsc_per_ns()     /* TSC ticks per nanosecond, over 100 ms */
+{
+    struct timespec t0, t1;
+    unsigned long long c0, c1;
+    double ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = __rdtsc();
+    do
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+    while ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec) < 1e8);
+    c1 = __rdtsc();
+
+    ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    return (c1 - c0) / ns;
+}
+
+
+int selected(const char *name, int argc, char **argv)     /* all of them, if none are named */
+{
+    int i;
+
+    for (i = 0; i < argc; i++)
+	if (strncmp(name, argv[i], strlen(argv[i])) == 0)
+	    return 1;
+    return argc == 0;
+}
+
+
+__attribute__((noinline)) void nothing()
+{
+    __asm__ volatile ("");
+}
+
+
+void getpid_raw()
+{
+    long ret;
+
+    __asm__ volatile ("syscall" : "=a" (ret) : "a" (SYS_getpid) : "rcx", "r11", "memory");
+}
+
+
+void getpid_glibc()
+{
+    getpid();
+}
+
+
+void clock_vdso()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+}
+
+
+void clock_syscall()
+{
+    struct timespec t;
+
+    syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &t);
+}
+
+
+void null_open()
+{
+    if ((fd = open("/dev/null", O_WRONLY)) == -1)
+    {
+	perror("syscost: /dev/null");
+	exit(EXIT_FAILURE);
+    }
+}
+
+
+void null_write()
+{
+    if (write(fd, "", 1) != 1)
+	abort();
+}
+
+
+void null_close()
+{
+    close(fd);
+}
+
+
+void futex_wake()
+{
+    syscall(SYS_futex, &futex_word, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+}
+
+
+void yield()
+{
+    sched_yield();
+}
+
+
+void pingpong_start()     /* a child that echoes every byte back until its input closes */
+{
+    char c;
+
+    if (pipe(to_child) == -1 || pipe(from_child) == -1 || (child = fork()) == -1)
+    {
+	perror("syscost: pipe or fork failed");
+	exit(EXIT_FAILURE);
+    }
+
+    if (child == 0)
+    {
+	close(to_child[1]);
+	close(from_child[0]);
+	while (read(to_child[0], &c, 1) == 1)
+	    if (write(from_child[1], &c, 1) != 1)
+		break;
+	_exit(0);
+    }
+
+    close(to_child[0]);
+    close(from_child[1]);
+}
+
+
+void pingpong()
+{
+    char c = 0;
+
+    if (write(to_child[1], &c, 1) != 1 || read(from_child[0], &c, 1) != 1)
+	abort();
+}
+
+
+void pingpong_stop()
+{
+    close(to_child[1]);
+    close(from_child[0]);
+    waitpid(child, 0, 0);
+}
@@ -0,0 +1,676 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* concatenate many files into one, with many reads and writes in flight.
+
+     uringcat [-v] [-t] [-d] [-q depth] [-b KiB] [-o output] file...
+
+   mycat copies one file at a time, each by one system call after another,
+   which is fine for a few large files; for thousands of small ones every
+   file costs an open, a read and a write in turn, and the time goes on
+   waiting for each of them.  Since every input's size is known in advance,
+   so is where each byte goes in the output, so all the pieces can be
+   copied at once, in any order:
+
+     io_uring   a queue of up to depth chunks in flight, each a read linked
+                to a write of the same buffer (the kernel starts the write
+                when the read completes, without coming back to us).  The
+                buffers and files are registered with the ring, so the
+                kernel doesn't have to map the pages or look up the file
+                for every request.  With -d the inputs are read with
+                O_DIRECT, bypassing the page cache (where the filesystem
+                allows it).
+     threads    where io_uring isn't available (or with -t): a pool of
+                threads each doing pread/pwrite a chunk at a time.
+
+   The inputs must be regular files, and so must the output: standard
+   output, unless -o names a file to create.
+
+   gcc -O2 -pthread uringcat.c -o uringcat     (uringcat_bench.sh compares
+   it with cat and mycat on many small files)
+*/
+
+#define DEFAULT_DEPTH 64
+#define MAX_DEPTH 1024
+#define DEFAULT_CHUNK (128 << 10)
+#define MAX_OPEN 256               /* input files open (and registered) at once */
+#define MAX_THREADS 16
+#define BUFFER_ALIGN 4096
+#define OUTPUT_SLOT 0              /* the output's index in the registered files */
+
+#define ALIGN_UP(n) (((n) + BUFFER_ALIGN - 1) & ~(size_t)(BUFFER_ALIGN - 1))
+
+typedef struct
+{
+    char *name;
+    off_t size;
+    off_t out_offset;              /* where it goes in the output */
+    off_t next;                    /* start of the next chunk to queue */
+    int fd;                        /* -1 unless open */
+    int direct;                    /* opened with O_DIRECT */
+    int slot;                      /* index in the registered files */
+    int pending;                   /* chunks queued and not yet finished */
+}
+Input;
+
+typedef struct
+{
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned tail;                 /* our copy of the submission tail */
+    unsigned queued;               /* entries filled in but not yet submitted */
+}
+Ring;
+
+typedef struct                     /* a chunk in flight: read into buffer, then written out */
+{
+    Input *in;
+    off_t offset;
+    size_t length;
+    char *buffer;
+    int read_res, write_res;
+    int done;                      /* completions seen: READ_DONE | WRITE_DONE */
+}
+Request;
+
+enum { READ_DONE = 1, WRITE_DONE = 2 };
+
+Input *inputs;
+int n_inputs;
+int out_fd = STDOUT_FILENO;
+size_t chunk = DEFAULT_CHUNK;
+int depth = DEFAULT_DEPTH, direct, verbose;
+int fixed_buffers, fixed_files;
+
+/* the thread pool's shared position in the inputs */
+pthread_mutex_t cursor_lock = PTHREAD_MUTEX_INITIALIZER;
+int cursor_input;
+off_t cursor_offset;
+int pool_failed;
+
+int uring_copy();
+int ring_init(Ring *r, unsigned entries);
+struct io_uring_sqe *ring_sqe(Ring *r);
+int ring_submit(Ring *r, unsigned wait);
+int ring_register(Ring *r, int opcode, void *arg, unsigned n);
+int open_input(Ring *r, Input *in, int *free_slots, int *n_free_slots);
+void close_input(Ring *r, Input *in, int *free_slots, int *n_free_slots);
+void queue_read(Ring *r, Request *req, int index);
+void queue_write(Ring *r, Request *req, int index);
+int thread_copy();
+void *worker(void *arg);
+int next_chunk(Input **in, off_t *offset, size_t *length);
+int open_file(const char *name, int *is_direct);
+int copy_sync(int fd, int is_direct, char *buffer, Input *in, off_t offset, size_t length);
+double now();
+
+
+int main(int argc, char *argv[])
+{
+    int opt, i, use_threads = 0, status = 0, result;
+    char *output = 0;
+    const char *engine;
+    off_t base, total;
+    struct stat st;
+    double t;
+
+    while ((opt = getopt(argc, argv, "q:b:o:dtv")) != -1)
+    {
+	switch (opt)
+	{
+	case 'q': depth = atoi(optarg); break;
+	case 'b': chunk = ALIGN_UP((size_t)atol(optarg) << 10); break;
+	case 'o': output = optarg; break;
+	case 'd': direct = 1; break;
+	case 't': use_threads = 1; break;
+	case 'v': verbose = 1; break;
+	default:
+	    fprintf(stderr, "usage: %s [-v] [-t] [-d] [-q depth] [-b KiB] [-o output] file...\n", argv[0]);
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    if (depth < 1 || depth > MAX_DEPTH || chunk == 0)
+    {
+	fprintf(stderr, "uringcat: the depth must be 1 to %d, and the chunk size positive\n", MAX_DEPTH);
+	exit(EXIT_FAILURE);
+    }
+
+    if (output && (out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1)
+    {
+	fprintf(stderr, "uringcat: %s: %s\n", output, strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+
+    /* the writes go to explicit offsets, which needs a regular file not in append mode */
+    if (fstat(out_fd, &st) == -1 || !S_ISREG(st.st_mode) || (fcntl(out_fd, F_GETFL) & O_APPEND))
+    {
+	fprintf(stderr, "uringcat: the output must be a regular file, not in append mode (mycat handles the rest)\n");
+	exit(EXIT_FAILURE);
+    }
+    base = total = lseek(out_fd, 0, SEEK_CUR);
+
+    /* size up the inputs, so that we know where each one goes */
+    if ((inputs = calloc(argc, sizeof(Input))) == 0)
+    {
+	perror("uringcat: calloc failed");
+	exit(EXIT_FAILURE);
+    }
+    for (i = optind; i < argc; i++)
+    {
+	errno = 0;
+	if (stat(argv[i], &st) == -1 || !S_ISREG(st.st_mode))
+	{
+	    fprintf(stderr, "uringcat: %s: %s\n", argv[i], errno ? strerror(errno) : "not a regular file");
+	    status = 1;
+	    continue;
+	}
+	inputs[n_inputs].name = argv[i];
+	inputs[n_inputs].size = st.st_size;
+	inputs[n_inputs].out_offset = total;
+	inputs[n_inputs].fd = -1;
+	total += st.st_size;
+	n_inputs++;
+    }
+
+    if (ftruncate(out_fd, total) == -1)     /* one size change, rather than one per write past the end */
+    {
+	perror("uringcat: ftruncate failed");
+	exit(EXIT_FAILURE);
+    }
+
+    t = now();
+    engine = "io_uring";
+    if (use_threads || (result = uring_copy()) == -2)
+    {
+	if (!use_threads && verbose)
+	    fprintf(stderr, "uringcat: io_uring unavailable (%s), using threads\n", strerror(errno));
+	engine = "threads";
+	result = thread_copy();
+    }
+    t = now() - t;
+
+    if (result == -1)
+	status = 1;
+    lseek(out_fd, total, SEEK_SET);     /* leave standard output after what we wrote */
+
+    if (verbose)
+	fprintf(stderr, "uringcat: %s, depth %d, %d KiB chunks%s%s: %d files, %.1f MiB in %.3f s, %.1f MiB/s\n",
+		engine, depth, (int)(chunk >> 10), direct ? ", O_DIRECT" : "",
+		engine[0] == 'i' ? (fixed_buffers && fixed_files ? ", registered" : ", unregistered") : "",
+		n_inputs, (total - base) / 1048576.0, t, (total - base) / 1048576.0 / t);
+
+    return status;
+}
+
+
+int uring_copy()     /* 0 if done, -1 on failure, -2 if io_uring can't be set up */
+{
+    Ring ring;
+    Request *reqs, *req;
+    struct iovec *iov;
+    struct io_uring_cqe *cqe;
+    int *files, free_slots[MAX_OPEN], n_free_slots = 0, *free_reqs, n_free_reqs = 0;
+    int i, index, next = 0, in_flight = 0, failed = 0;
+    unsigned head, tail;
+    Input *in;
+
+    if (ring_init(&ring, 2 * depth) == -1)
+	return -2;
+
+    reqs = calloc(depth, sizeof(Request));
+    iov = calloc(depth, sizeof(struct iovec));
+    free_reqs = calloc(depth, sizeof(int));
+    files = calloc(MAX_OPEN + 1, sizeof(int));
+    if (!reqs || !iov || !free_reqs || !files)
+	return -2;
+
+    for (i = 0; i < depth; i++)
+    {
+	if (posix_memalign((void **)&reqs[i].buffer, BUFFER_ALIGN, chunk) != 0)
+	    return -2;
+	iov[i].iov_base = reqs[i].buffer;
+	iov[i].iov_len = chunk;
+	free_reqs[n_free_reqs++] = depth - 1 - i;
+    }
+
+    /* an unused slot in the file table is -1, filled in as inputs are opened */
+    files[OUTPUT_SLOT] = out_fd;
+    for (i = MAX_OPEN; i > 0; i--)
+    {
+	files[i] = -1;
+	free_slots[n_free_slots++] = i;
+    }
+
+    /* both are optional: without them the requests just take ordinary fds and addresses */
+    fixed_buffers = ring_register(&ring, IORING_REGISTER_BUFFERS, iov, depth) == 0;
+    fixed_files = ring_register(&ring, IORING_REGISTER_FILES, files, MAX_OPEN + 1) == 0;
+
+    while (!failed && (next < n_inputs || in_flight > 0))
+    {
+	/* queue chunks, in input order, until the queue is full */
+	while (in_flight < depth && next < n_inputs)
+	{
+	    in = &inputs[next];
+	    if (in->fd == -1)
+	    {
+		if (n_free_slots == 0)
+		    break;     /* wait for a file to finish */
+		if (open_input(&ring, in, free_slots, &n_free_slots) == -1)
+		{
+		    fprintf(stderr, "uringcat: %s: %s\n", in->name, strerror(errno));
+		    failed = 1;
+		    break;
+		}
+	    }
+
+	    if (in->next == in->size)     /* empty */
+	    {
+		close_input(&ring, in, free_slots, &n_free_slots);
+		next++;
+		continue;
+	    }
+
+	    index = free_reqs[--n_free_reqs];
+	    req = &reqs[index];
+	    req->in = in;
+	    req->offset = in->next;
+	    req->length = in->size - in->next < (off_t)chunk ? (size_t)(in->size - in->next) : chunk;
+	    req->done = 0;
+	    in->next += req->length;
+	    in->pending++;
+	    if (in->next == in->size)
+		next++;
+
+	    queue_read(&ring, req, index);
+	    queue_write(&ring, req, index);
+	    in_flight++;
+	}
+
+	if (in_flight == 0)
+	    continue;
+
+	if (ring_submit(&ring, 1) == -1)
+	{
+	    perror("uringcat: io_uring_enter failed");
+	    return -1;
+	}
+
+	/* each request finishes when both its read and its write have completed */
+	head = *ring.cq_head;
+	tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++)
+	{
+	    cqe = &ring.cqes[head & *ring.cq_mask];
+	    index = cqe->user_data >> 1;
+	    req = &reqs[index];
+	    if (cqe->user_data & 1)
+	    {
+		req->write_res = cqe->res;
+		req->done |= WRITE_DONE;
+	    }
+	    else
+	    {
+		req->read_res = cqe->res;
+		req->done |= READ_DONE;
+	    }
+
+	    if (req->done != (READ_DONE | WRITE_DONE))
+		continue;
+
+	    if (req->write_res == -ECANCELED && req->read_res >= (int)req->length)
+	    {
+		/* a "short" read of an O_DIRECT tail (rounded up past the end of
+		   the file) breaks the link, but the data is all there */
+		req->done = READ_DONE;
+		queue_write(&ring, req, index);
+		continue;
+	    }
+
+	    if (req->write_res != (int)req->length
+		&& copy_sync(req->in->fd, req->in->direct, req->buffer, req->in, req->offset, req->length) == -1)
+	    {
+		/* the read or write failed or came up short: the synchronous
+		   copy retries, and reports the real error */
+		fprintf(stderr, "uringcat: %s: %s\n", req->in->name, strerror(errno));
+		failed = 1;
+	    }
+
+	    if (--req->in->pending == 0 && req->in->next == req->in->size)
+		close_input(&ring, req->in, free_slots, &n_free_slots);
+	    free_reqs[n_free_reqs++] = index;
+	    in_flight--;
+	}
+	__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    close(ring.fd);     /* the buffers are released with the process */
+    return failed ? -1 : 0;
+}
+
+
+int ring_init(Ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    size_t sq_len, cq_len;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) == -1)
+	return -1;
+
+    /* the kernel shares the rings' indices and entries with us by mmap */
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	sq_len = cq_len = sq_len > cq_len ? sq_len : cq_len;
+
+    sq = mmap(0, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	cq = sq;
+    else
+	cq = mmap(0, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+
+    if (sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED)
+    {
+	close(r->fd);
+	return -1;
+    }
+
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->tail = *r->sq_tail;
+    r->queued = 0;
+    return 0;
+}
+
+
+struct io_uring_sqe *ring_sqe(Ring *r)     /* the next free submission entry, cleared */
+{
+    struct io_uring_sqe *sqe;
+    unsigned i;
+
+    /* there's always room: the ring has two entries per request, and
+       io_uring_enter consumes everything we submit */
+    i = r->tail++ & *r->sq_mask;
+    r->sq_array[i] = i;
+    r->queued++;
+
+    sqe = &r->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+
+int ring_submit(Ring *r, unsigned wait)     /* submit what's queued, and wait for wait completions */
+{
+    int n;
+
+    __atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+
+    do
+	n = syscall(__NR_io_uring_enter, r->fd, r->queued, wait, IORING_ENTER_GETEVENTS, 0, 0);
+    while (n == -1 && errno == EINTR);
+
+    if (n == -1)
+	return -1;
+
+    r->queued -= n;
+    return 0;
+}
+
+
+int ring_register(Ring *r, int opcode, void *arg, unsigned n)
+{
+    return syscall(__NR_io_uring_register, r->fd, opcode, arg, n) == -1 ? -1 : 0;
+}
+
+
+int open_input(Ring *r, Input *in, int *free_slots, int *n_free_slots)
+{
+    struct io_uring_files_update update;
+
+    if ((in->fd = open_file(in->name, &in->direct)) == -1)
+	return -1;
+
+    in->slot = free_slots[--*n_free_slots];
+    if (fixed_files)
+    {
+	memset(&update, 0, sizeof(update));
+	update.offset = in->slot;
+	update.fds = (unsigned long)&in->fd;
+	if (ring_register(r, IORING_REGISTER_FILES_UPDATE, &update, 1) == -1)
+	{
+	    close(in->fd);
+	    free_slots[(*n_free_slots)++] = in->slot;
+	    in->fd = -1;
+	    return -1;
+	}
+    }
+
+    return 0;
+}
+
+
+void close_input(Ring *r, Input *in, int *free_slots, int *n_free_slots)
+{
+    struct io_uring_files_update update;
+    int none = -1;
+
+    if (fixed_files)     /* the ring holds its own reference until the slot is cleared */
+    {
+	memset(&update, 0, sizeof(update));
+	update.offset = in->slot;
+	update.fds = (unsigned long)&none;
+	ring_register(r, IORING_REGISTER_FILES_UPDATE, &update, 1);
+    }
+
+    close(in->fd);
+    in->fd = -1;
+    free_slots[(*n_free_slots)++] = in->slot;
+}
+
+
+void queue_read(Ring *r, Request *req, int index)     /* linked to the write queued next */
+{
+    struct io_uring_sqe *sqe = ring_sqe(r);
+
+    sqe->opcode = fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->flags = IOSQE_IO_LINK | (fixed_files ? IOSQE_FIXED_FILE : 0);
+    sqe->fd = fixed_files ? req->in->slot : req->in->fd;
+    sqe->addr = (unsigned long)req->buffer;
+    sqe->len = req->in->direct ? ALIGN_UP(req->length) : req->length;     /* O_DIRECT reads whole blocks */
+    sqe->off = req->offset;
+    sqe->buf_index = index;
+    sqe->user_data = (unsigned long)index << 1;
+}
+
+
+void queue_write(Ring *r, Request *req, int index)
+{
+    struct io_uring_sqe *sqe = ring_sqe(r);
+
+    sqe->opcode = fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->flags = fixed_files ? IOSQE_FIXED_FILE : 0;
+    sqe->fd = fixed_files ? OUTPUT_SLOT : out_fd;
+    sqe->addr = (unsigned long)req->buffer;
+    sqe->len = req->length;
+    sqe->off = req->in->out_offset + req->offset;
+    sqe->buf_index = index;
+    sqe->user_data = (unsigned long)index << 1 | 1;
+}
+
+
+int thread_copy()
+{
+    pthread_t ids[MAX_THREADS];
+    int i, n = depth < MAX_THREADS ? depth : MAX_THREADS;
+
+    for (i = 0; i < n; i++)
+	if (pthread_create(&ids[i], 0, worker, 0) != 0)
+	    break;
+
+    if (i == 0)
+    {
+	perror("uringcat: pthread_create failed");
+	return -1;
+    }
+
+    n = i;
+    for (i = 0; i < n; i++)
+	pthread_join(ids[i], 0);
+
+    return pool_failed ? -1 : 0;
+}
+
+
+void *worker(void *arg)     /* copy chunks until there are none left */
+{
+    Input *in, *open_in = 0;
+    off_t offset;
+    size_t length;
+    int fd = -1, is_direct = 0;
+    char *buffer;
+
+    if (posix_memalign((void **)&buffer, BUFFER_ALIGN, chunk) != 0)
+    {
+	pool_failed = 1;
+	return 0;
+    }
+
+    while (!pool_failed && next_chunk(&in, &offset, &length))
+    {
+	if (in != open_in)
+	{
+	    if (fd != -1)
+		close(fd);
+	    open_in = in;
+	    if ((fd = open_file(in->name, &is_direct)) == -1)
+	    {
+		fprintf(stderr, "uringcat: %s: %s\n", in->name, strerror(errno));
+		pool_failed = 1;
+		break;
+	    }
+	}
+
+	if (copy_sync(fd, is_direct, buffer, in, offset, length) == -1)
+	{
+	    fprintf(stderr, "uringcat: %s: %s\n", in->name, strerror(errno));
+	    pool_failed = 1;
+	}
+    }
+
+    if (fd != -1)
+	close(fd);
+    free(buffer);
+    return 0;
+}
+
+
+int next_chunk(Input **in, off_t *offset, size_t *length)     /* 0 when there are no more */
+{
+    int found = 0;
+
+    pthread_mutex_lock(&cursor_lock);
+
+    while (cursor_input < n_inputs && cursor_offset == inputs[cursor_input].size)
+    {
+	cursor_input++;
+	cursor_offset = 0;
+    }
+
+    if (cursor_input < n_inputs)
+    {
+	*in = &inputs[cursor_input];
+	*offset = cursor_offset;
+	*length = (*in)->size - cursor_offset < (off_t)chunk ? (size_t)((*in)->size - cursor_offset) : chunk;
+	cursor_offset += *length;
+	found = 1;
+    }
+
+    pthread_mutex_unlock(&cursor_lock);
+    return found;
+}
+
+
+int open_file(const char *name, int *is_direct)
+{
+    int fd = -1;
+
+    *is_direct = 0;
+    if (direct && (fd = open(name, O_RDONLY | O_DIRECT)) != -1)
+	*is_direct = 1;
+    else if (direct && errno != EINVAL)     /* EINVAL: the filesystem doesn't do O_DIRECT */
+	return -1;
+
+    if (fd == -1 && (fd = open(name, O_RDONLY)) == -1)
+	return -1;
+
+    if (!*is_direct)
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fd;
+}
+
+
+int copy_sync(int fd, int is_direct, char *buffer, Input *in, off_t offset, size_t length)
+{
+    size_t want = is_direct ? ALIGN_UP(length) : length, done;
+    ssize_t n;
+
+    for (done = 0; done < length; done += n)
+    {
+	if ((n = pread(fd, buffer + done, want - done, offset + done)) == -1 && errno == EINTR)
+	    n = 0;
+	else if (n <= 0)
+	{
+	    if (n == 0)
+		errno = EIO;     /* the file has shrunk since we sized it */
+	    return -1;
+	}
+    }
+
+    for (done = 0; done < length; done += n)
+    {
+	if ((n = pwrite(out_fd, buffer + done, length - done, in->out_offset + offset + done)) == -1)
+	{
+	    if (errno != EINTR)
+		return -1;
+	    n = 0;
+	}
+    }
+
+    return 0;
+}
+
+
+double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
@@ -0,0 +1,48 @@
+#!/bin/sh
+# concatenate many small files with cat, mycat and uringcat (both engines):
+#   uringcat_bench.sh [files] [directory for the test files]
+#
+# The files are between 0 and 64 KiB, like a directory of rotated logs.
+# As with mycat_bench.sh, set DROP_CACHES=1 (as root) to time cold reads,
+# which is where keeping many reads in flight matters most.
+
+FILES=${1:-5000}
+DIR=${2:-${TMPDIR:-/tmp}}/uringcat_bench
+OUT=$DIR.out
+
+cd "$(dirname "$0")" || exit 1
+gcc -O2 -Wall mycat.c -o mycat || exit 1
+gcc -O2 -Wall -pthread uringcat.c -o uringcat || exit 1
+
+echo "creating $FILES files in $DIR"
+mkdir -p "$DIR" || exit 1
+i=0
+while [ $i -lt "$FILES" ]
+do
+    head -c $(( $(od -An -N2 -tu2 /dev/urandom) )) /dev/urandom > "$DIR/$i.log"
+    i=$((i + 1))
+done
+cat "$DIR"/* > "$DIR.ref"
+
+run() {     # run name command...: print the elapsed time, and check the output
+    name=$1
+    shift
+    [ "$DROP_CACHES" = 1 ] && sync && echo 3 > /proc/sys/vm/drop_caches
+    rm -f "$OUT"
+    start=$(date +%s.%N)
+    "$@"
+    end=$(date +%s.%N)
+    echo "$name $start $end $FILES" | awk '{ t = $3 - $2; printf "  %-16s %7.3f s %9.0f files/s\n", $1, t, $4 / t }'
+    cmp -s "$DIR.ref" "$OUT" || echo "  $name output differs!"
+}
+
+run cat            sh -c "cat '$DIR'/* > '$OUT'"
+run mycat          sh -c "./mycat '$DIR'/* > '$OUT'"
+run uringcat-t     sh -c "./uringcat -t -o '$OUT' '$DIR'/*"
+for q in 1 16 64 256
+do
+    run uringcat-q$q sh -c "./uringcat -q $q -o '$OUT' '$DIR'/*"
+done
+run uringcat-d     sh -c "./uringcat -d -o '$OUT' '$DIR'/*"
+
+rm -rf "$DIR" "$DIR.ref" "$OUT" mycat uringcat